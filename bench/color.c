@@ -0,0 +1,168 @@
+// pixels per second of the batched color transforms against the scalar ones, over every 8 bit color. fails when a
+// batched result is more than 1 off the scalar one in any channel
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "color.h"
+#include "util.h"
+
+// every color once, plus a few so the batched kernels run their tails too
+#define BENCH_PIXELS ((1u << 24) + 5)
+#define BENCH_ROUNDS 3
+#define BENCH_AMOUNT 0.3f
+
+typedef struct
+{
+    const char *name;
+    void (*batched)(rgb_planes_t *, const RGB *);
+    void (*scalar)(RGB *, const RGB *);
+} bench_op_t;
+
+static void darken_batched(rgb_planes_t *, const RGB *);
+static void darken_scalar(RGB *, const RGB *);
+static void lighten_batched(rgb_planes_t *, const RGB *);
+static void lighten_scalar(RGB *, const RGB *);
+static void saturate_batched(rgb_planes_t *, const RGB *);
+static void saturate_scalar(RGB *, const RGB *);
+static void blend_batched(rgb_planes_t *, const RGB *);
+static void blend_scalar(RGB *, const RGB *);
+static double now(void);
+static bool bench_op(const bench_op_t *, const uint8_t *, size_t);
+
+static void darken_batched(rgb_planes_t *planes, const RGB *color)
+{
+    darken_colors(planes, BENCH_AMOUNT);
+}
+
+static void darken_scalar(RGB *pixel, const RGB *color)
+{
+    darken_color(pixel, BENCH_AMOUNT);
+}
+
+static void lighten_batched(rgb_planes_t *planes, const RGB *color)
+{
+    lighten_colors(planes, BENCH_AMOUNT);
+}
+
+static void lighten_scalar(RGB *pixel, const RGB *color)
+{
+    lighten_color(pixel, BENCH_AMOUNT);
+}
+
+static void saturate_batched(rgb_planes_t *planes, const RGB *color)
+{
+    saturate_colors(planes, BENCH_AMOUNT);
+}
+
+static void saturate_scalar(RGB *pixel, const RGB *color)
+{
+    saturate_color(pixel, BENCH_AMOUNT);
+}
+
+static void blend_batched(rgb_planes_t *planes, const RGB *color)
+{
+    blend_colors(planes, color);
+}
+
+static void blend_scalar(RGB *pixel, const RGB *color)
+{
+    blend_color(pixel, color);
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static bool bench_op(const bench_op_t *op, const uint8_t *pixels, size_t size)
+{
+    const RGB target = {0xee, 0xee, 0xee};
+    rgb_planes_t planes;
+    rgb_planes_init(&planes, size);
+    RGB *reference = safe_malloc(size * sizeof(RGB));
+
+    double best_scalar = INFINITY, best_batched = INFINITY;
+    for (int round = 0; round < BENCH_ROUNDS; round++)
+    {
+        for (size_t i = 0; i < size; i++)
+        {
+            reference[i] = (RGB){pixels[3 * i], pixels[3 * i + 1], pixels[3 * i + 2]};
+        }
+        double start = now();
+        for (size_t i = 0; i < size; i++)
+        {
+            op->scalar(&reference[i], &target);
+        }
+        double middle = now();
+        rgb_planes_from_interleaved(&planes, pixels);
+        op->batched(&planes, &target);
+        double end = now();
+
+        best_scalar = fmin(best_scalar, middle - start);
+        best_batched = fmin(best_batched, end - middle);
+    }
+
+    // the contract of the batched API: within 1 of the scalar function in every channel
+    int max_error = 0;
+    size_t mismatches = 0;
+    for (size_t i = 0; i < size; i++)
+    {
+        int errors[] = {abs((int)planes.r[i] - (int)reference[i].r), abs((int)planes.g[i] - (int)reference[i].g),
+                        abs((int)planes.b[i] - (int)reference[i].b)};
+        for (size_t c = 0; c < 3; c++)
+        {
+            max_error = errors[c] > max_error ? errors[c] : max_error;
+            mismatches += errors[c] > 1;
+        }
+    }
+
+    printf("%-9s scalar %8.2f Mpx/s, batched %8.2f Mpx/s (%.2fx, max error %d)\n", op->name,
+           (double)size / best_scalar / 1e6, (double)size / best_batched / 1e6, best_scalar / best_batched,
+           max_error);
+    if (mismatches > 0)
+    {
+        fprintf(stderr, "%s: %zu channels off by more than 1\n", op->name, mismatches);
+    }
+
+    free(reference);
+    rgb_planes_free(&planes);
+    return mismatches == 0;
+}
+
+int main(void)
+{
+    uint8_t *pixels = safe_malloc(3 * (size_t)BENCH_PIXELS);
+    for (uint32_t value = 0; value < BENCH_PIXELS; value++)
+    {
+        pixels[3 * (size_t)value] = (uint8_t)(value >> 16);
+        pixels[3 * (size_t)value + 1] = (uint8_t)(value >> 8);
+        pixels[3 * (size_t)value + 2] = (uint8_t)value;
+    }
+
+#if defined(__x86_64__)
+    // the kernels are cloned for avx2, the loader picks the clone this cpu runs
+    printf("avx2:      %s\n", __builtin_cpu_supports("avx2") ? "yes" : "no");
+#endif
+
+    static const bench_op_t ops[] = {
+        {"darken", darken_batched, darken_scalar},
+        {"lighten", lighten_batched, lighten_scalar},
+        {"saturate", saturate_batched, saturate_scalar},
+        {"blend", blend_batched, blend_scalar},
+    };
+    bool ok = true;
+    for (size_t i = 0; i < sizeof(ops) / sizeof(ops[0]); i++)
+    {
+        ok &= bench_op(&ops[i], pixels, BENCH_PIXELS);
+    }
+
+    free(pixels);
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
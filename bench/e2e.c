@@ -0,0 +1,319 @@
+// end to end timings with stand-in commands from bench/stubs, written as json for tracking across commits:
+//     theming_bench [results.json]
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "color.h"
+#include "config.h"
+#include "fixture.h"
+#include "quantize.h"
+#include "theme.h"
+#include "thumbnail.h"
+#include "util.h"
+
+#define BENCH_ROUNDS 5
+#define BENCH_CONFIG_INIT_CALLS 100
+#define BENCH_RESULTS_MAX 32
+#define BENCH_SKELETON_FILES 400
+#define BENCH_ICON_FILES 1000
+
+typedef struct
+{
+    char *name;
+    double wall[BENCH_ROUNDS];
+    double cpu[BENCH_ROUNDS]; // only for runs of the binary
+    bool has_cpu;
+    size_t size;
+} bench_result_t;
+
+static const struct
+{
+    unsigned int width;
+    unsigned int height;
+} wallpapers[] = {
+    {640, 360},
+    {1920, 1080},
+    {3840, 2160},
+};
+
+static bench_result_t results[BENCH_RESULTS_MAX];
+static size_t results_size;
+static char *work_path;
+
+static bench_result_t *bench_result(const char *, ...) __attribute__((format(printf, 1, 2)));
+static void run_theming(bench_result_t *, const char *, const char *);
+static void bench_config_init(void);
+static void bench_generate(void);
+static void bench_extraction(void);
+static void bench_rendering(void);
+static void bench_reload(void);
+static int compare_double(const void *, const void *);
+static void print_results(FILE *);
+
+static bench_result_t *bench_result(const char *format, ...)
+{
+    if (results_size == BENCH_RESULTS_MAX)
+    {
+        die("Error: too many results");
+    }
+
+    va_list args;
+    va_start(args, format);
+    char name[256];
+    vsnprintf(name, sizeof(name), format, args);
+    va_end(args);
+
+    bench_result_t *result = &results[results_size++];
+    *result = (bench_result_t){.name = strdup(name)};
+    return result;
+}
+
+static void run_theming(bench_result_t *result, const char *option, const char *argument)
+{
+    // the child reopens stdout, pending output must not be written twice
+    fflush(NULL);
+    double start = fixture_now();
+    pid_t pid = fork();
+    if (pid == -1)
+    {
+        die("fork failed:");
+    }
+    if (pid == 0)
+    {
+        if (freopen("/dev/null", "w", stdout) == NULL)
+        {
+            die("freopen failed");
+        }
+        execl(THEMING_BINARY, "theming", option, argument, (char *)NULL);
+        die("execl failed:");
+    }
+
+    int status;
+    struct rusage usage;
+    if (wait4(pid, &status, 0, &usage) == -1)
+    {
+        die("wait4 failed:");
+    }
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+    {
+        die("Error: theming %s failed during %s", option, result->name);
+    }
+
+    result->wall[result->size] = fixture_now() - start;
+    result->cpu[result->size] = (double)(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) +
+                                (double)(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+    result->has_cpu = true;
+    result->size++;
+}
+
+static void bench_config_init(void)
+{
+    bench_result_t *result = bench_result("config_init");
+    for (size_t round = 0; round < BENCH_ROUNDS; round++)
+    {
+        double start = fixture_now();
+        for (size_t i = 0; i < BENCH_CONFIG_INIT_CALLS; i++)
+        {
+            config_t config;
+            config_init(&config);
+            config_free(&config);
+        }
+        result->wall[result->size++] = (fixture_now() - start) / BENCH_CONFIG_INIT_CALLS;
+    }
+}
+
+// the whole of theming -i, every round starts from an image it has not seen
+static void bench_generate(void)
+{
+    char *thumbnails_path = format_string("%s/cache/thumbnails", work_path);
+    for (size_t i = 0; i < sizeof(wallpapers) / sizeof(wallpapers[0]); i++)
+    {
+        char *image_path = format_string("%s/wallpaper-%ux%u.ppm", work_path, wallpapers[i].width, wallpapers[i].height);
+        bench_result_t *result = bench_result("generate_themes/%ux%u", wallpapers[i].width, wallpapers[i].height);
+        for (size_t round = 0; round < BENCH_ROUNDS; round++)
+        {
+            rmrf(thumbnails_path);
+            run_theming(result, "-i", image_path);
+        }
+        free(image_path);
+    }
+    free(thumbnails_path);
+}
+
+static void bench_extraction(void)
+{
+    config_t config;
+    config_init(&config);
+
+    char *thumbnails_path = format_string("%s/thumbnails", config.cache_path);
+    for (size_t i = 0; i < sizeof(wallpapers) / sizeof(wallpapers[0]); i++)
+    {
+        char *image_path = format_string("%s/wallpaper-%ux%u.ppm", work_path, wallpapers[i].width, wallpapers[i].height);
+        bench_result_t *decode = bench_result("extraction/%ux%u/thumbnail", wallpapers[i].width, wallpapers[i].height);
+        bench_result_t *kmeans = bench_result("extraction/%ux%u/kmeans", wallpapers[i].width, wallpapers[i].height);
+        for (size_t round = 0; round < BENCH_ROUNDS; round++)
+        {
+            rmrf(thumbnails_path);
+
+            double start = fixture_now();
+            thumbnail_t thumbnail;
+            thumbnail_get(config.cache_path, image_path, &thumbnail);
+            double middle = fixture_now();
+            RGB palette[PALETTE_SIZE];
+            quantize_kmeans(thumbnail.pixels, (size_t)thumbnail.width * thumbnail.height, COLOR_SPACE_OKLAB, palette,
+                            PALETTE_SIZE);
+            double end = fixture_now();
+            thumbnail_free(&thumbnail);
+
+            decode->wall[decode->size++] = middle - start;
+            kmeans->wall[kmeans->size++] = end - middle;
+        }
+        free(image_path);
+    }
+
+    free(thumbnails_path);
+    config_free(&config);
+}
+
+// from scratch every round, the manifests would otherwise skip all of it
+static void bench_rendering(void)
+{
+    config_t config;
+    config_init(&config);
+
+    char *colors_path = format_string("%s/colors-oomox", config.cache_path);
+    char *theme_path = format_string("%s/render-themes", work_path);
+    char *icons_path = format_string("%s/render-icons", work_path);
+    char *theme_manifest_path = format_string("%s/render-theme.manifest", work_path);
+    char *icons_manifest_path = format_string("%s/render-icons.manifest", work_path);
+
+    bench_result_t *theme = bench_result("rendering/theme");
+    bench_result_t *icons = bench_result("rendering/icons");
+    for (size_t round = 0; round < BENCH_ROUNDS; round++)
+    {
+        rmrf(theme_path);
+        rmrf(icons_path);
+        unlink(theme_manifest_path);
+        unlink(icons_manifest_path);
+        mkdir_p(theme_path);
+        mkdir_p(icons_path);
+
+        theme_stats_t stats;
+        double start = fixture_now();
+        theme_generate(config.theme_skeleton_path, theme_path, config.oomox_theme_name, colors_path,
+                       theme_manifest_path, &stats);
+        double middle = fixture_now();
+        theme_generate_icons(config.icon_source_path, icons_path, config.oomox_icon_theme_name, colors_path,
+                             config.icon_color_sources, config.icon_color_keys, config.icon_color_map_size,
+                             icons_manifest_path, &stats);
+        double end = fixture_now();
+
+        theme->wall[theme->size++] = middle - start;
+        icons->wall[icons->size++] = end - middle;
+    }
+
+    free(icons_manifest_path);
+    free(theme_manifest_path);
+    free(icons_path);
+    free(theme_path);
+    free(colors_path);
+    config_free(&config);
+}
+
+static void bench_reload(void)
+{
+    bench_result_t *result = bench_result("reload");
+    for (size_t round = 0; round < BENCH_ROUNDS; round++)
+    {
+        run_theming(result, "-r", NULL);
+    }
+}
+
+static int compare_double(const void *a, const void *b)
+{
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static void print_results(FILE *file)
+{
+    fprintf(file, "{\n  \"unit\": \"seconds\",\n  \"rounds\": %d,\n  \"results\": [\n", BENCH_ROUNDS);
+    for (size_t i = 0; i < results_size; i++)
+    {
+        bench_result_t *result = &results[i];
+        double wall[BENCH_ROUNDS], cpu[BENCH_ROUNDS];
+        memcpy(wall, result->wall, sizeof(wall));
+        memcpy(cpu, result->cpu, sizeof(cpu));
+        qsort(wall, result->size, sizeof(double), compare_double);
+        qsort(cpu, result->size, sizeof(double), compare_double);
+
+        fprintf(file, "    {\"name\": \"%s\", \"min\": %.6f, \"median\": %.6f, \"max\": %.6f", result->name, wall[0],
+                wall[result->size / 2], wall[result->size - 1]);
+        if (result->has_cpu)
+        {
+            fprintf(file, ", \"cpu_median\": %.6f", cpu[result->size / 2]);
+        }
+        fprintf(file, "}%s\n", i + 1 < results_size ? "," : "");
+    }
+    fprintf(file, "  ]\n}\n");
+}
+
+int main(int argc, char *argv[])
+{
+    work_path = fixture_create();
+
+    fprintf(stderr, "preparing %s\n", work_path);
+    for (size_t i = 0; i < sizeof(wallpapers) / sizeof(wallpapers[0]); i++)
+    {
+        char *image_path = format_string("%s/wallpaper-%ux%u.ppm", work_path, wallpapers[i].width, wallpapers[i].height);
+        fixture_write_wallpaper(image_path, wallpapers[i].width, wallpapers[i].height);
+        free(image_path);
+    }
+    char *skeleton_path = format_string("%s/skeleton", work_path);
+    char *icon_source_path = format_string("%s/icon-source", work_path);
+    fixture_write_skeleton(skeleton_path, BENCH_SKELETON_FILES);
+    fixture_write_icons(icon_source_path, BENCH_ICON_FILES);
+    fixture_write_config(work_path, false);
+
+    fprintf(stderr, "config_init\n");
+    bench_config_init();
+    fprintf(stderr, "generate_themes\n");
+    bench_generate();
+    fprintf(stderr, "extraction\n");
+    bench_extraction();
+    fprintf(stderr, "rendering\n");
+    bench_rendering();
+    fprintf(stderr, "reload\n");
+    bench_reload();
+
+    FILE *file = stdout;
+    if (argc > 1 && (file = fopen(argv[1], "w")) == NULL)
+    {
+        die("fopen failed for %s:", argv[1]);
+    }
+    print_results(file);
+    if (file != stdout)
+    {
+        fclose(file);
+        fprintf(stderr, "results written to %s\n", argv[1]);
+    }
+
+    rmrf(work_path);
+    for (size_t i = 0; i < results_size; i++)
+    {
+        free(results[i].name);
+    }
+    free(icon_source_path);
+    free(skeleton_path);
+    free(work_path);
+    return EXIT_SUCCESS;
+}
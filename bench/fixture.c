@@ -0,0 +1,171 @@
+#include "fixture.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "util.h"
+
+static void write_text(const char *, const char *);
+
+double fixture_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+// a fresh directory in /tmp that XDG_CONFIG_HOME points into, the stand-ins come first in PATH
+char *fixture_create(void)
+{
+    char *work_path = strdup("/tmp/theming-bench-XXXXXX");
+    if (mkdtemp(work_path) == NULL)
+    {
+        die("mkdtemp failed:");
+    }
+
+    char *path = format_string("%s:%s", BENCH_STUBS_PATH, getenv("PATH"));
+    char *config_home = format_string("%s/config", work_path);
+    setenv("PATH", path, 1);
+    setenv("XDG_CONFIG_HOME", config_home, 1);
+    unsetenv("DBUS_SESSION_BUS_ADDRESS");
+    free(config_home);
+    free(path);
+
+    return work_path;
+}
+
+static void write_text(const char *path, const char *text)
+{
+    FILE *file = fopen(path, "w");
+    if (file == NULL)
+    {
+        die("fopen failed for %s:", path);
+    }
+    fputs(text, file);
+    if (ferror(file) || fclose(file) != 0)
+    {
+        die("writing to %s failed:", path);
+    }
+}
+
+// gradients with noise, so the quantizer has something to do
+void fixture_write_wallpaper(const char *path, unsigned int width, unsigned int height)
+{
+    FILE *file = fopen(path, "w");
+    if (file == NULL)
+    {
+        die("fopen failed for %s:", path);
+    }
+    fprintf(file, "P6\n%u %u\n255\n", width, height);
+
+    uint8_t *row = safe_malloc(3 * (size_t)width);
+    uint32_t state = 2463534242u;
+    for (unsigned int y = 0; y < height; y++)
+    {
+        for (unsigned int x = 0; x < width; x++)
+        {
+            state ^= state << 13;
+            state ^= state >> 17;
+            state ^= state << 5;
+            row[3 * x] = (uint8_t)((x * 255 / width + (state & 31)) & 0xff);
+            row[3 * x + 1] = (uint8_t)((y * 255 / height + ((state >> 8) & 31)) & 0xff);
+            row[3 * x + 2] = (uint8_t)(((x + y) * 127 / (width + height) + ((state >> 16) & 63)) & 0xff);
+        }
+        fwrite(row, 3, width, file);
+    }
+    free(row);
+
+    if (ferror(file) || fclose(file) != 0)
+    {
+        die("writing to %s failed:", path);
+    }
+}
+
+void fixture_write_skeleton(const char *path, size_t files)
+{
+    mkdir_p(path);
+    for (size_t i = 0; i < files; i++)
+    {
+        char *dir = format_string("%s/gtk-%zu", path, i % 16);
+        mkdir_p(dir);
+        char *file_path = format_string("%s/widget-%zu.css", dir, i);
+        FILE *file = fopen(file_path, "w");
+        if (file == NULL)
+        {
+            die("fopen failed for %s:", file_path);
+        }
+        for (size_t line = 0; line < 64; line++)
+        {
+            fprintf(file, ".widget-%zu-%zu { color: #%%FG%%; background: #%%BG%%; border-color: #%%SEL_BG%%; }\n", i,
+                    line);
+        }
+        fclose(file);
+        free(file_path);
+        free(dir);
+    }
+}
+
+void fixture_write_icons(const char *path, size_t files)
+{
+    mkdir_p(path);
+    for (size_t i = 0; i < files; i++)
+    {
+        char *dir = format_string("%s/%s", path, i % 2 == 0 ? "places" : "apps");
+        mkdir_p(dir);
+        char *file_path = format_string("%s/icon-%zu.svg", dir, i);
+        char *svg = format_string("<svg xmlns=\"http://www.w3.org/2000/svg\" width=\"48\" height=\"48\">\n"
+                                  "<path fill=\"#5294e2\" d=\"M4 8h16l4 4h20v28H4z\"/>\n"
+                                  "<path fill=\"#4877b1\" d=\"M4 16h40v24H4z\"/>\n"
+                                  "<circle fill=\"#e4e4e4\" cx=\"24\" cy=\"28\" r=\"%zu\"/>\n"
+                                  "</svg>\n",
+                                  i % 8 + 2);
+        write_text(file_path, svg);
+        free(svg);
+        free(file_path);
+        free(dir);
+    }
+}
+
+// with supervised, a long running stand-in reloaded by SIGHUP is added for the daemon to keep alive
+void fixture_write_config(const char *work_path, bool supervised)
+{
+    char *config_dir = format_string("%s/config/theming", work_path);
+    mkdir_p(config_dir);
+    char *config_path = format_string("%s/config.json", config_dir);
+
+    char *text = format_string(
+        "{\n"
+        "    \"cache_path\": \"%s/cache\",\n"
+        "    \"theme_path\": \"%s/themes\",\n"
+        "    \"theme_skeleton_path\": \"%s/skeleton\",\n"
+        "    \"icon_theme_path\": \"%s/icons\",\n"
+        "    \"icon_source_path\": \"%s/icon-source\",\n"
+        "    \"icon_color_map\": {\"#5294e2\": \"ICONS_MEDIUM\", \"#4877b1\": \"ICONS_DARK\", \"#e4e4e4\": \"ICONS_LIGHT\"},\n"
+        "    \"oomox_icons_command\": \"generator\",\n"
+        "    \"oomox_theme_name\": \"bench\",\n"
+        "    \"oomox_icon_theme_name\": \"bench-icons\",\n"
+        "    \"hidpi\": false,\n"
+        "    \"send_notification\": false,\n"
+        "    \"image_cache_path\": \"%s/bg\",\n"
+        "    \"generating_commands\": [\n"
+        "        {\"command\": \"generator -u %%IMAGE_PATH%%\", \"async\": true},\n"
+        "        {\"command\": \"generator -o %%OOMOX_THEME_NAME%% %%CACHE_PATH%%/colors-oomox\", \"async\": true},\n"
+        "        {\"command\": \"generator %%CACHE_PATH%%/colors-oomox\", \"async\": true}\n"
+        "    ],\n"
+        "    \"reload_commands\": [\n"
+        "        {\"command\": \"reload %%CACHE_PATH%%/colors.Xresources\"},\n"
+        "        {\"command\": \"reload %%CACHE_PATH%%/colors-kitty.conf\"},\n"
+        "        {\"command\": \"reload %%CACHE_PATH%%/colors.json\"}%s\n"
+        "    ]\n"
+        "}\n",
+        work_path, work_path, work_path, work_path, work_path, work_path,
+        supervised ? ",\n        {\"command\": \"sleeper\", \"restart\": true, \"reload_signal\": \"SIGHUP\"}" : "");
+    write_text(config_path, text);
+
+    free(text);
+    free(config_path);
+    free(config_dir);
+}
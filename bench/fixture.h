@@ -0,0 +1,13 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// a scratch home for the benchmarks: synthetic wallpapers, theme and icons, a config and bench/stubs in PATH
+
+double fixture_now(void);
+char *fixture_create(void);
+void fixture_write_wallpaper(const char *, unsigned int, unsigned int);
+void fixture_write_skeleton(const char *, size_t);
+void fixture_write_icons(const char *, size_t);
+void fixture_write_config(const char *, bool);
@@ -0,0 +1,108 @@
+// pixels per second of the table driven OKLab conversion against a straightforward libm version
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "oklab.h"
+#include "util.h"
+
+#define BENCH_PIXELS (4u << 20)
+#define BENCH_ROUNDS 5
+
+static float srgb_to_linear_libm(uint8_t);
+static void pixels_to_oklab_libm(const uint8_t *, OKLab *, size_t);
+static double now(void);
+
+static float srgb_to_linear_libm(uint8_t value)
+{
+    float c = (float)value / 255.0f;
+    return c <= 0.04045f ? c / 12.92f : powf((c + 0.055f) / 1.055f, 2.4f);
+}
+
+static void pixels_to_oklab_libm(const uint8_t *pixels, OKLab *lab, size_t size)
+{
+    for (size_t i = 0; i < size; i++)
+    {
+        float r = srgb_to_linear_libm(pixels[3 * i]);
+        float g = srgb_to_linear_libm(pixels[3 * i + 1]);
+        float b = srgb_to_linear_libm(pixels[3 * i + 2]);
+
+        float l = cbrtf(0.4122214708f * r + 0.5363325363f * g + 0.0514459929f * b);
+        float m = cbrtf(0.2119034982f * r + 0.6806995451f * g + 0.1073969566f * b);
+        float s = cbrtf(0.0883024619f * r + 0.2817188376f * g + 0.6299787005f * b);
+
+        lab[i].l = 0.2104542553f * l + 0.7936177850f * m - 0.0040720468f * s;
+        lab[i].a = 1.9779984951f * l - 2.4285922050f * m + 0.4505937099f * s;
+        lab[i].b = 0.0259040371f * l + 0.7827717662f * m - 0.8086757660f * s;
+    }
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+int main(void)
+{
+    uint8_t *pixels = safe_malloc(3 * BENCH_PIXELS);
+    OKLab *lab = safe_calloc(BENCH_PIXELS, sizeof(OKLab));
+    OKLab *reference = safe_calloc(BENCH_PIXELS, sizeof(OKLab));
+
+    uint32_t state = 2463534242u;
+    for (size_t i = 0; i < 3 * BENCH_PIXELS; i++)
+    {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        pixels[i] = (uint8_t)state;
+    }
+
+    double best_libm = INFINITY, best_table = INFINITY;
+    for (int round = 0; round < BENCH_ROUNDS; round++)
+    {
+        double start = now();
+        pixels_to_oklab_libm(pixels, reference, BENCH_PIXELS);
+        double middle = now();
+        pixels_to_oklab(pixels, lab, BENCH_PIXELS);
+        double end = now();
+
+        best_libm = fmin(best_libm, middle - start);
+        best_table = fmin(best_table, end - middle);
+    }
+
+    float max_error = 0.0f;
+    for (size_t i = 0; i < BENCH_PIXELS; i++)
+    {
+        max_error = fmaxf(max_error, fabsf(lab[i].l - reference[i].l));
+        max_error = fmaxf(max_error, fabsf(lab[i].a - reference[i].a));
+        max_error = fmaxf(max_error, fabsf(lab[i].b - reference[i].b));
+    }
+
+    // every 8 bit color has to survive the trip through OKLab
+    unsigned int mismatches = 0;
+    double start = now();
+    for (unsigned int value = 0; value < (1u << 24); value++)
+    {
+        RGB color = {value >> 16, (value >> 8) & 0xff, value & 0xff}, back;
+        OKLab tmp;
+        rgb_to_oklab(&color, &tmp);
+        oklab_to_rgb(&tmp, &back);
+        mismatches += back.r != color.r || back.g != color.g || back.b != color.b;
+    }
+    double round_trip = now() - start;
+
+    printf("libm:        %8.2f Mpx/s\n", BENCH_PIXELS / best_libm / 1e6);
+    printf("tables:      %8.2f Mpx/s (%.2fx, max error %.2e)\n", BENCH_PIXELS / best_table / 1e6,
+           best_libm / best_table, (double)max_error);
+    printf("round trip:  %8.2f Mpx/s (%u of %u colors changed)\n", (1u << 24) / round_trip / 1e6, mismatches,
+           1u << 24);
+
+    free(reference);
+    free(lab);
+    free(pixels);
+    return EXIT_SUCCESS;
+}
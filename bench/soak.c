@@ -0,0 +1,395 @@
+// switches themes over and over against bench/stubs and fails when memory, fds or zombie children grow:
+//     theming_soak [switches]
+// first in this process (extraction, rendering, palette.bin, reload commands), then through the binary with the
+// daemon running, which is sampled the same way
+#include <dirent.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "capture.h"
+#include "color.h"
+#include "config.h"
+#include "fixture.h"
+#include "history.h"
+#include "palette_file.h"
+#include "quantize.h"
+#include "theme.h"
+#include "thumbnail.h"
+#include "util.h"
+
+#define SOAK_SWITCHES 2000
+#define SOAK_SKELETON_FILES 40
+#define SOAK_ICON_FILES 100
+// growth allowed after the warm up, allocator caches settle within a few switches
+#define SOAK_RSS_SLACK_KB 2048
+#define SOAK_DAEMON_START_TIMEOUT_MS 5000
+
+typedef struct
+{
+    long rss_kb;
+    size_t fds;
+    size_t zombies; // exited children nobody waited for
+} soak_sample_t;
+
+static char *work_path;
+// whatever way the soak ends, this process stops the daemon and removes work_path at exit
+static pid_t soak_owner;
+static pid_t daemon_pid = -1;
+
+static long sample_rss(pid_t);
+static size_t sample_fds(pid_t);
+static size_t sample_zombies(pid_t);
+static void sample(pid_t, soak_sample_t *);
+static bool report(const char *, size_t, double, const soak_sample_t *, const soak_sample_t *);
+static void run_theming(const char *, const char *);
+static void switch_in_process(size_t);
+static bool soak_in_process(size_t);
+static bool soak_daemon(size_t);
+static void soak_cleanup(void);
+
+static long sample_rss(pid_t pid)
+{
+    char *path = format_string("/proc/%d/status", pid);
+    FILE *file = fopen(path, "r");
+    free(path);
+    if (file == NULL)
+    {
+        return -1;
+    }
+
+    char line[256];
+    long rss = -1;
+    while (fgets(line, sizeof(line), file) != NULL)
+    {
+        if (sscanf(line, "VmRSS: %ld kB", &rss) == 1)
+        {
+            break;
+        }
+    }
+    fclose(file);
+    return rss;
+}
+
+static size_t sample_fds(pid_t pid)
+{
+    char *path = format_string("/proc/%d/fd", pid);
+    DIR *dir = opendir(path);
+    free(path);
+    if (dir == NULL)
+    {
+        return 0;
+    }
+
+    // the directory itself is open while it is listed
+    size_t fds = 0;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL)
+    {
+        if (entry->d_name[0] != '.' && (pid != getpid() || atoi(entry->d_name) != dirfd(dir)))
+        {
+            fds++;
+        }
+    }
+    closedir(dir);
+    return fds;
+}
+
+static size_t sample_zombies(pid_t parent)
+{
+    DIR *dir = opendir("/proc");
+    if (dir == NULL)
+    {
+        die("opendir failed for /proc:");
+    }
+
+    size_t zombies = 0;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL)
+    {
+        if (entry->d_name[0] < '0' || entry->d_name[0] > '9')
+        {
+            continue;
+        }
+
+        char *path = format_string("/proc/%s/stat", entry->d_name);
+        FILE *file = fopen(path, "r");
+        free(path);
+        if (file == NULL)
+        {
+            continue;
+        }
+        char line[512];
+        bool read = fgets(line, sizeof(line), file) != NULL;
+        fclose(file);
+
+        // "pid (comm) state ppid ...", comm may contain anything
+        char *end = read ? strrchr(line, ')') : NULL;
+        char state;
+        int ppid;
+        if (end != NULL && sscanf(end + 1, " %c %d", &state, &ppid) == 2 && ppid == parent && state == 'Z')
+        {
+            zombies++;
+        }
+    }
+    closedir(dir);
+    return zombies;
+}
+
+static void sample(pid_t pid, soak_sample_t *result)
+{
+    result->rss_kb = sample_rss(pid);
+    result->fds = sample_fds(pid);
+    result->zombies = sample_zombies(pid);
+}
+
+static bool report(const char *name, size_t switches, double seconds, const soak_sample_t *before,
+                   const soak_sample_t *after)
+{
+    printf("%s: %zu switches, %.0f ns/op, rss %ld -> %ld KiB, fds %zu -> %zu, zombies %zu\n", name, switches,
+           seconds / (double)switches * 1e9, before->rss_kb, after->rss_kb, before->fds, after->fds, after->zombies);
+
+    bool ok = true;
+    if (after->rss_kb - before->rss_kb > SOAK_RSS_SLACK_KB)
+    {
+        fprintf(stderr, "%s: rss grew by %ld KiB\n", name, after->rss_kb - before->rss_kb);
+        ok = false;
+    }
+    if (after->fds > before->fds)
+    {
+        fprintf(stderr, "%s: %zu fds leaked\n", name, after->fds - before->fds);
+        ok = false;
+    }
+    if (after->zombies > 0)
+    {
+        fprintf(stderr, "%s: %zu zombie children\n", name, after->zombies);
+        ok = false;
+    }
+    return ok;
+}
+
+static void run_theming(const char *option, const char *argument)
+{
+    // the child reopens stdout, pending output must not be written twice
+    fflush(NULL);
+    pid_t pid = fork();
+    if (pid == -1)
+    {
+        die("fork failed:");
+    }
+    if (pid == 0)
+    {
+        if (freopen("/dev/null", "w", stdout) == NULL)
+        {
+            die("freopen failed");
+        }
+        execl(THEMING_BINARY, "theming", option, argument, (char *)NULL);
+        die("execl failed:");
+    }
+
+    int status;
+    if (waitpid(pid, &status, 0) == -1)
+    {
+        die("waitpid failed:");
+    }
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+    {
+        die("Error: theming %s %s failed", option, argument != NULL ? argument : "");
+    }
+}
+
+// what one switch does, minus writing the cache files
+static void switch_in_process(size_t i)
+{
+    config_t config;
+    config_init(&config);
+
+    const char *variant = i % 2 == 0 ? "dark" : "light";
+    char *image_path = format_string("%s/wallpaper-%zu.ppm", work_path, i % 2);
+    thumbnail_t thumbnail;
+    thumbnail_get(config.cache_path, image_path, &thumbnail);
+    RGB palette[PALETTE_SIZE];
+    quantize_kmeans(thumbnail.pixels, (size_t)thumbnail.width * thumbnail.height, config.quantizer_color_space, palette,
+                    PALETTE_SIZE);
+    thumbnail_free(&thumbnail);
+
+    // the variants alternate, every file is rewritten
+    char *colors_path = format_string("%s/%s/colors-oomox", config.cache_path, variant);
+    char *theme_manifest_path = format_string("%s/theme.manifest", config.cache_path);
+    char *icons_manifest_path = format_string("%s/icons.manifest", config.cache_path);
+    theme_stats_t stats;
+    theme_generate(config.theme_skeleton_path, config.theme_path, config.oomox_theme_name, colors_path,
+                   theme_manifest_path, &stats);
+    theme_generate_icons(config.icon_source_path, config.icon_theme_path, config.oomox_icon_theme_name, colors_path,
+                         config.icon_color_sources, config.icon_color_keys, config.icon_color_map_size,
+                         icons_manifest_path, &stats);
+
+    char *palette_path = format_string("%s/palette.bin", config.cache_path);
+    palette_file_publish(palette_path, palette, i % 2 == 0);
+
+    for (size_t j = 0; j < config.reload_commands_size; j++)
+    {
+        const command_t *command = &config.reload_commands[j];
+        if (command->restart)
+        {
+            continue; // left to the daemon
+        }
+        command_usage_t usage;
+        exec_command_priority(command->command, command->ignore_error, &command->priority, &usage);
+        history_record(config.cache_path, command->command, &usage);
+    }
+
+    free(palette_path);
+    free(icons_manifest_path);
+    free(theme_manifest_path);
+    free(colors_path);
+    free(image_path);
+    config_free(&config);
+}
+
+static bool soak_in_process(size_t switches)
+{
+    size_t warmup = switches / 10 > 0 ? switches / 10 : 1;
+    for (size_t i = 0; i < warmup; i++)
+    {
+        switch_in_process(i);
+    }
+
+    soak_sample_t before, after;
+    sample(getpid(), &before);
+    double start = fixture_now();
+    for (size_t i = 0; i < switches; i++)
+    {
+        switch_in_process(i);
+    }
+    double seconds = fixture_now() - start;
+    sample(getpid(), &after);
+
+    return report("in-process", switches, seconds, &before, &after);
+}
+
+static bool soak_daemon(size_t switches)
+{
+    char *socket_path = format_string("%s/cache/theming.sock", work_path);
+    unlink(socket_path);
+
+    fflush(NULL);
+    pid_t daemon = fork();
+    if (daemon == -1)
+    {
+        die("fork failed:");
+    }
+    if (daemon == 0)
+    {
+        if (freopen("/dev/null", "w", stdout) == NULL || freopen("/dev/null", "w", stderr) == NULL)
+        {
+            die("freopen failed");
+        }
+        execl(THEMING_BINARY, "theming", "-d", (char *)NULL);
+        die("execl failed:");
+    }
+    daemon_pid = daemon;
+
+    struct stat st;
+    for (int waited = 0; stat(socket_path, &st) == -1; waited += 10)
+    {
+        if (waited >= SOAK_DAEMON_START_TIMEOUT_MS)
+        {
+            die("Error: the daemon did not create %s", socket_path);
+        }
+        usleep(10000);
+    }
+    free(socket_path);
+
+    size_t warmup = switches / 10 > 0 ? switches / 10 : 1;
+    for (size_t i = 0; i < warmup; i++)
+    {
+        run_theming("-r", NULL);
+    }
+
+    soak_sample_t before, after;
+    sample(daemon, &before);
+    double start = fixture_now();
+    for (size_t i = 0; i < switches; i++)
+    {
+        run_theming("-rt", i % 2 == 0 ? "light" : "dark");
+    }
+    double seconds = fixture_now() - start;
+    sample(daemon, &after);
+
+    kill(daemon, SIGTERM);
+    waitpid(daemon, NULL, 0);
+    daemon_pid = -1;
+
+    return report("daemon", switches, seconds, &before, &after);
+}
+
+static void soak_cleanup(void)
+{
+    // forked children that fail exit through here too
+    if (getpid() != soak_owner)
+    {
+        return;
+    }
+
+    if (daemon_pid != -1)
+    {
+        kill(daemon_pid, SIGTERM);
+        waitpid(daemon_pid, NULL, 0);
+        daemon_pid = -1;
+    }
+    if (work_path != NULL)
+    {
+        rmrf(work_path);
+        free(work_path);
+        work_path = NULL;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    size_t switches = argc > 1 ? strtoul(argv[1], NULL, 10) : SOAK_SWITCHES;
+    if (switches == 0)
+    {
+        die("Usage: %s [switches]", argv[0]);
+    }
+
+    work_path = fixture_create();
+    soak_owner = getpid();
+    atexit(soak_cleanup);
+    fprintf(stderr, "preparing %s\n", work_path);
+    for (size_t i = 0; i < 2; i++)
+    {
+        char *image_path = format_string("%s/wallpaper-%zu.ppm", work_path, i);
+        fixture_write_wallpaper(image_path, 320 + 160 * (unsigned int)i, 180 + 90 * (unsigned int)i);
+        free(image_path);
+    }
+    char *skeleton_path = format_string("%s/skeleton", work_path);
+    char *icon_source_path = format_string("%s/icon-source", work_path);
+    fixture_write_skeleton(skeleton_path, SOAK_SKELETON_FILES);
+    fixture_write_icons(icon_source_path, SOAK_ICON_FILES);
+    fixture_write_config(work_path, true);
+
+    // both variants and their cache files, the in-process switches render from them
+    char *image_path = format_string("%s/wallpaper-0.ppm", work_path);
+    run_theming("-i", image_path);
+    free(image_path);
+
+    // command output goes through the capture thread like in theming itself
+    char *log_dir = format_string("%s/cache/logs", work_path);
+    capture_start(log_dir);
+    free(log_dir);
+
+    bool ok = soak_in_process(switches);
+    // every daemon switch starts the binary, fewer of them take as long
+    ok &= soak_daemon(switches / 10 > 0 ? switches / 10 : 1);
+
+    free(icon_source_path);
+    free(skeleton_path);
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+// output kept per command, older output is dropped
+#define CAPTURE_RING_SIZE (64 * 1024)
+// commands.log is rotated to commands.log.1 ... once it would grow past this
+#define CAPTURE_LOG_MAX (1024 * 1024)
+#define CAPTURE_LOG_FILES 3
+
+// stdout and stderr of one command, drained by the capture thread
+typedef struct capture
+{
+    int fd; // read end of the pipe, -1 once it hit end of file
+    char *command;
+    uint8_t *ring;
+    size_t ring_head; // where the next byte goes
+    size_t ring_used;
+    size_t dropped; // bytes that did not fit
+    bool finished;  // the command exited, set by the thread that waited for it
+    int status;
+    bool logged;
+    struct capture *next;
+} capture_t;
+
+void capture_start(const char *);
+capture_t *capture_open(const char *, int *);
+void capture_close(capture_t *, int);
+void capture_stop(void);
@@ -1,5 +1,10 @@
 #pragma once
 
+#include <stddef.h>
+#include <stdint.h>
+
+#define PALETTE_SIZE 16
+
 typedef struct
 {
     unsigned int r;
@@ -14,6 +19,42 @@ typedef struct
     double s; // Saturation
 } HLS;
 
+// structure of arrays for whole palettes or pixel buffers, one allocation backs all planes
+typedef struct
+{
+    uint8_t *r;
+    uint8_t *g;
+    uint8_t *b;
+    size_t size;
+} rgb_planes_t;
+
+typedef enum
+{
+    COLOR_SPACE_RGB, // RGB and HLS math, what the palettes always used
+    COLOR_SPACE_OKLAB,
+} color_space_t;
+
+typedef enum
+{
+    COLOR_OP_COPY, // start over from another slot of the extracted palette
+    COLOR_OP_DARKEN,
+    COLOR_OP_LIGHTEN,
+    COLOR_OP_BLEND,
+    COLOR_OP_SATURATE,
+    COLOR_OP_LIGHTNESS, // set the HLS or OKLab lightness
+} color_op_type_t;
+
+typedef struct
+{
+    color_op_type_t type;
+    color_space_t space;
+    unsigned int first; // palette slots the operation applies to, inclusive
+    unsigned int last;
+    double amount;
+    RGB color;         // blend target
+    unsigned int from; // copy source
+} color_op_t;
+
 void darken_color(RGB *, double);
 void blend_color(RGB *, const RGB *);
 void lighten_color(RGB *, double);
@@ -22,3 +63,13 @@ RGB *from_hex_string_to_RGB(const char *);
 char *from_RGB_to_hex_string(const RGB *);
 void rgb_to_hls(const RGB *, HLS *);
 void hls_to_rgb(const HLS *, RGB *);
+void apply_color_ops(const RGB *, RGB *, size_t, const color_op_t *, size_t);
+
+void rgb_planes_init(rgb_planes_t *, size_t);
+void rgb_planes_free(rgb_planes_t *);
+void rgb_planes_from_interleaved(rgb_planes_t *, const uint8_t *);
+void rgb_planes_to_interleaved(const rgb_planes_t *, uint8_t *);
+void darken_colors(rgb_planes_t *, float);
+void blend_colors(rgb_planes_t *, const RGB *);
+void lighten_colors(rgb_planes_t *, float);
+void saturate_colors(rgb_planes_t *, float);
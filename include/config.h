@@ -2,30 +2,71 @@
 #include <stdbool.h>
 #include <stdio.h>
 
+#include "color.h"
+#include "priority.h"
+#include "quantize.h"
+#include "ready.h"
+#include "util.h"
+
 typedef struct
 {
     char *command;
+    char *name; // what reload commands refer to in depends_on, NULL if unnamed
+    char **depends_on; // generating commands or cache files a reload command waits for in pipeline mode
+    size_t depends_on_size;
+    bool has_depends_on; // without it the command waits for all generation
+    char **inputs;       // files or directories a generating command reads, it is memoized when given
+    size_t inputs_size;
+    bool has_inputs;
+    char **outputs; // what it writes, checked to be intact before skipping it
+    size_t outputs_size;
     bool ignore_error;
     bool async;
     bool restart;
     bool initial;
+    char *process_name; // matched against /proc/<pid>/comm when no tracked pid exists
+    int reload_signal;  // sent by the daemon instead of restarting, 0 if the program has none
+    ready_t ready;      // what shows the reload took effect
+    priority_t priority;
 } command_t;
 
+typedef struct
+{
+    color_op_t *ops;
+    size_t size;
+} color_ops_t;
+
 typedef struct
 {
     char *cache_path;
     char *theme_path;
+    char *theme_skeleton_path; // generate the theme natively from this directory, NULL to leave it to commands
     char *icon_theme_path;
+    char *icon_source_path;    // recolor this icon theme natively, NULL to leave it to commands
+    char **icon_color_sources; // hex colors used by the source icons
+    char **icon_color_keys;    // colors-oomox key (or #hex) each of them becomes
+    size_t icon_color_map_size;
     char *oomox_icons_command;
     char *oomox_theme_name;
     char *oomox_icon_theme_name;
     char *image_path;
+    copy_strategy_t image_copy_strategy;
+    char *variant; // palette variant linked into cache_path
+    quantizer_t quantizer;
+    color_space_t quantizer_color_space;
+    color_ops_t dark_palette;
+    color_ops_t light_palette;
     command_t *generating_commands;
     size_t generating_commands_size;
     command_t *reload_commands;
     size_t reload_commands_size;
     bool hidpi;
     bool send_notification;
+    bool pipeline; // run reload commands as soon as their inputs are generated
+    bool recolor_terminals; // send the palette to every terminal of the user when reloading
+    priority_t generating_priority; // for generating commands without their own and the built-in generators
+    size_t max_jobs; // async generating commands running at once
+    char *metrics_path; // prometheus textfile the counters are merged into, NULL to not export them
 } config_t;
 
 void config_init(config_t *);
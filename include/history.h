@@ -0,0 +1,28 @@
+#pragma once
+
+#include <stdio.h>
+
+#include "util.h"
+
+// runs kept per command
+#define HISTORY_RUNS 32
+
+typedef struct
+{
+    char *command;
+    command_usage_t runs[HISTORY_RUNS]; // a ring, the oldest run is overwritten
+    size_t runs_size;
+    size_t next;
+} history_command_t;
+
+typedef struct
+{
+    history_command_t *commands;
+    size_t size;
+} history_t;
+
+void history_record(const char *, const char *, const command_usage_t *);
+void history_load(const char *, history_t *);
+double history_expected(const history_t *, const char *);
+void history_print(const history_t *, FILE *);
+void history_free(history_t *);
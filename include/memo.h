@@ -0,0 +1,9 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "config.h"
+
+bool memo_fresh(const char *, const command_t *, uint64_t *);
+void memo_store(const char *, const command_t *, uint64_t);
@@ -0,0 +1,14 @@
+#pragma once
+
+#include <stdbool.h>
+
+// how often the daemon merges what it counted into metrics_path
+#define METRICS_FLUSH_INTERVAL 60
+
+void metrics_init(const char *);
+void metrics_add(const char *, const char *, double);
+void metrics_set(const char *, const char *, double);
+void metrics_observe(const char *, const char *, double);
+char *metrics_label(const char *, const char *);
+bool metrics_pending(void);
+void metrics_flush(void);
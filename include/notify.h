@@ -0,0 +1,16 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// a session bus connection that keeps replacing its own notification
+typedef struct
+{
+    int fd; // -1 without a bus, notify-send is used then
+    uint32_t serial;
+    uint32_t id; // of the last notification, replaced by the next one
+} notifier_t;
+
+bool notifier_open(notifier_t *);
+void notifier_send(notifier_t *, const char *, const char *, const char *);
+void notifier_close(notifier_t *);
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "color.h"
+
+typedef struct
+{
+    float l; // Lightness, 0 to 1
+    float a;
+    float b;
+} OKLab;
+
+typedef struct
+{
+    float l; // Lightness, 0 to 1
+    float c; // Chroma
+    float h; // Hue in radians
+} OKLCH;
+
+void rgb_to_oklab(const RGB *, OKLab *);
+void oklab_to_rgb(const OKLab *, RGB *);
+void oklab_to_oklch(const OKLab *, OKLCH *);
+void oklch_to_oklab(const OKLCH *, OKLab *);
+float oklab_distance(const OKLab *, const OKLab *);
+float oklch_max_chroma(float, float);
+void pixels_to_oklab(const uint8_t *, OKLab *, size_t);
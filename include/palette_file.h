@@ -0,0 +1,7 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include "color.h"
+
+void palette_file_publish(const char *, const RGB *, bool);
@@ -0,0 +1,7 @@
+#pragma once
+
+#include <stddef.h>
+
+size_t pool_threads(void);
+void parallel_for(size_t, void (*)(size_t, void *), void *);
+void parallel_for_workers(size_t, size_t, void (*)(size_t, void *), void *);
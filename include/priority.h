@@ -0,0 +1,35 @@
+#pragma once
+
+#include <stdbool.h>
+
+typedef enum
+{
+    IO_CLASS_DEFAULT,
+    IO_CLASS_BEST_EFFORT,
+    IO_CLASS_IDLE,
+} io_class_t;
+
+typedef enum
+{
+    SCHED_CLASS_DEFAULT,
+    SCHED_CLASS_BATCH,
+    SCHED_CLASS_IDLE,
+} sched_class_t;
+
+// how a command is run, everything left at its default is inherited from theming
+typedef struct
+{
+    bool has_nice;
+    int nice;
+    io_class_t io_class;
+    int io_level; // 0 (highest) to 7 for best-effort
+    sched_class_t sched_class;
+    char *cpus;       // affinity like taskset -c, e.g. "0-3,6"
+    double cpu_max;   // share of one cpu in a transient cgroup, 0 for no limit
+    char *memory_max; // memory.max of the transient cgroup, e.g. "512M"
+} priority_t;
+
+void priority_apply(const priority_t *, const char *);
+char *priority_cgroup_create(const priority_t *);
+void priority_cgroup_remove(char *);
+bool priority_valid_cpus(const char *);
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+// linux truncates /proc/<pid>/comm to TASK_COMM_LEN - 1 characters
+#define PROCESS_COMM_LEN 15
+
+typedef struct
+{
+    pid_t pid;
+    unsigned long long start_time; // clock ticks since boot, field 22 of /proc/<pid>/stat
+} tracked_process_t;
+
+unsigned long long process_start_time(pid_t);
+bool process_tracked_find(const char *, const char *, tracked_process_t *);
+void process_tracked_store(const char *, const char *, pid_t);
+bool process_terminate(const tracked_process_t *, int, bool);
+bool process_terminate_command(const char *, const char *, const char *);
+char *process_default_name(const char *);
+bool process_find_started_after(const char *, unsigned long long, tracked_process_t *);
+bool process_wait(pid_t, int, int *);
@@ -0,0 +1,14 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "color.h"
+
+typedef enum
+{
+    QUANTIZER_MAGICK,
+    QUANTIZER_KMEANS,
+} quantizer_t;
+
+size_t quantize_kmeans(const uint8_t *, size_t, color_space_t, RGB *, size_t);
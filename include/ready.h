@@ -0,0 +1,31 @@
+#pragma once
+
+#include <stdbool.h>
+#include <time.h>
+
+#define READY_DEFAULT_TIMEOUT_MS 5000
+
+typedef enum
+{
+    READY_NONE,
+    READY_PROCESS, // a process with this name started after the reload
+    READY_FILE,    // this file was written after the reload
+    READY_COMMAND, // this command exits 0
+} ready_type_t;
+
+typedef struct
+{
+    ready_type_t type;
+    char *target;
+    int timeout_ms;
+} ready_t;
+
+// when reloading started, conditions are only met by what happened since
+typedef struct
+{
+    struct timespec boottime;
+    struct timespec realtime;
+} ready_mark_t;
+
+void ready_mark(ready_mark_t *);
+bool ready_wait(const ready_t *, const ready_mark_t *);
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+
+// aho-corasick automaton replacing any number of patterns in one pass over the text, the leftmost and then
+// longest match wins, hex digits match in either case and never match inside a longer hex number
+typedef struct
+{
+    int32_t (*next)[256]; // complete transition table, every state has an edge for every byte
+    int32_t *match;       // pattern spelled by the state, -1 if none
+    int32_t *output;      // closest state on the failure chain with a match, 0 if none
+    int32_t *depth;       // length of what the state spells
+    size_t states_size;
+    char **replacements;
+    size_t *pattern_lengths;
+    size_t *replacement_lengths;
+    unsigned char *hex_edges; // REPLACER_HEX_START and REPLACER_HEX_END of every pattern
+    size_t size;
+} replacer_t;
+
+#define REPLACER_HEX_START 1 // the pattern starts with a hex digit
+#define REPLACER_HEX_END 2   // the pattern ends with a hex digit
+// words of the bitset replacer_apply marks the matched patterns in
+#define REPLACER_SLOT_WORDS(size) ((size) / 64 + 1)
+
+void replacer_init(replacer_t *, const char *const *, const char *const *, size_t);
+size_t replacer_apply(const replacer_t *, const char *, size_t, FILE *, uint64_t *);
+void replacer_free(replacer_t *);
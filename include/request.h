@@ -0,0 +1,7 @@
+#pragma once
+
+#include <stdbool.h>
+
+void request_handle_signals(void);
+bool request_begin(const char *);
+void request_checkpoint(void);
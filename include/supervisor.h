@@ -0,0 +1,10 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "config.h"
+
+char *supervisor_socket_path(config_t);
+void supervisor_run(config_t);
+bool supervisor_request(config_t, const char *, FILE *);
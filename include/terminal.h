@@ -0,0 +1,17 @@
+#pragma once
+
+#include <stddef.h>
+
+// how long terminals together get to take the sequences before they are skipped
+#define TERMINAL_WRITE_TIMEOUT_MS 100
+// how long one that is in the middle of a sequence then gets to finish just that sequence
+#define TERMINAL_FINISH_TIMEOUT_MS 50
+
+typedef struct
+{
+    size_t terminals;
+    size_t written;
+    size_t skipped; // did not take everything in time
+} terminal_stats_t;
+
+void terminal_broadcast(const void *, size_t, terminal_stats_t *);
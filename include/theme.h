@@ -0,0 +1,15 @@
+#pragma once
+
+#include <stddef.h>
+
+typedef struct
+{
+    size_t files;
+    size_t written; // files whose output changed
+    size_t bytes;   // written
+    double seconds;
+} theme_stats_t;
+
+void theme_generate(const char *, const char *, const char *, const char *, const char *, theme_stats_t *);
+void theme_generate_icons(const char *, const char *, const char *, const char *, char *const *, char *const *, size_t,
+                          const char *, theme_stats_t *);
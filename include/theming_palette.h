@@ -0,0 +1,190 @@
+#pragma once
+
+// header-only reader for cache_path/palette.bin, the palette theming publishes on every switch.
+// map it once, then read it whenever the sequence changed, no parsing involved:
+//
+//     theming_palette_map_t map;
+//     theming_palette_t palette;
+//     uint32_t seen;
+//     theming_palette_open("/home/me/.cache/theming/palette.bin", &map);
+//     theming_palette_read(&map, &palette, &seen);
+//     while (theming_palette_wait(&map, seen, NULL) == 0 && theming_palette_read(&map, &palette, &seen) == 0)
+//         ;
+//
+// the file is written in place and never replaced, so the mapping stays valid across switches.
+// C11 with the GNU or default feature set (-std=gnu11 or _DEFAULT_SOURCE), for O_CLOEXEC and syscall().
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#define THEMING_PALETTE_MAGIC 0x4c415054u // "TPAL"
+#define THEMING_PALETTE_VERSION 1
+// a write takes microseconds, a sequence that stays odd this long was left by a writer that died
+#define THEMING_PALETTE_READ_TIMEOUT_MS 100
+
+typedef struct
+{
+    uint8_t r;
+    uint8_t g;
+    uint8_t b;
+    uint8_t a;
+} theming_palette_color_t;
+
+typedef struct
+{
+    theming_palette_color_t colors[16];
+    theming_palette_color_t foreground;
+    theming_palette_color_t background;
+    theming_palette_color_t cursor;
+    uint8_t dark; // 1 for the dark variant, 0 for the light one
+    uint8_t reserved[3];
+    uint64_t generation; // counts the switches
+} theming_palette_t;
+
+// on disk layout
+typedef struct
+{
+    uint32_t magic;
+    uint32_t version;
+    _Atomic uint32_t sequence; // odd while the palette is being written, the futex waiters sleep on
+    uint32_t reserved;
+    theming_palette_t palette;
+} theming_palette_file_t;
+
+typedef struct
+{
+    theming_palette_file_t *file;
+} theming_palette_map_t;
+
+static inline int theming_palette_open(const char *path, theming_palette_map_t *map)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+    {
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == -1 || (size_t)st.st_size < sizeof(theming_palette_file_t))
+    {
+        close(fd);
+        errno = EINVAL;
+        return -1;
+    }
+
+    void *mapping = mmap(NULL, sizeof(theming_palette_file_t), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED)
+    {
+        return -1;
+    }
+
+    map->file = (theming_palette_file_t *)mapping;
+    if (map->file->magic != THEMING_PALETTE_MAGIC || map->file->version != THEMING_PALETTE_VERSION)
+    {
+        munmap(mapping, sizeof(theming_palette_file_t));
+        map->file = NULL;
+        errno = EINVAL;
+        return -1;
+    }
+    return 0;
+}
+
+// the absolute CLOCK_MONOTONIC time timeout from now ends at
+static inline void theming_palette_deadline(const struct timespec *timeout, struct timespec *deadline)
+{
+    clock_gettime(CLOCK_MONOTONIC, deadline);
+    deadline->tv_sec += timeout->tv_sec;
+    deadline->tv_nsec += timeout->tv_nsec;
+    if (deadline->tv_nsec >= 1000000000L)
+    {
+        deadline->tv_sec += deadline->tv_nsec / 1000000000L;
+        deadline->tv_nsec %= 1000000000L;
+    }
+}
+
+// sleeps while the sequence is value, until deadline (NULL waits forever). a shared futex, the writer is another
+// process. 0 once woken or the value changed, -1 with ETIMEDOUT at the deadline
+static inline int theming_palette_futex_wait(const theming_palette_map_t *map, uint32_t value,
+                                             const struct timespec *deadline)
+{
+    // the bitset variant takes an absolute time, an interrupted wait does not start the timeout over
+    if (syscall(SYS_futex, (uint32_t *)&map->file->sequence, FUTEX_WAIT_BITSET, value, deadline, NULL,
+                FUTEX_BITSET_MATCH_ANY) == -1 &&
+        errno != EAGAIN && errno != EINTR)
+    {
+        return -1;
+    }
+    return 0;
+}
+
+// copies a consistent palette and the sequence it belongs to, 0 on success. -1 with EBUSY when the sequence stayed
+// odd for THEMING_PALETTE_READ_TIMEOUT_MS, the palette is then incomplete until theming publishes the next one
+static inline int theming_palette_read(const theming_palette_map_t *map, theming_palette_t *palette,
+                                       uint32_t *sequence)
+{
+    struct timespec deadline;
+    theming_palette_deadline(&(struct timespec){0, THEMING_PALETTE_READ_TIMEOUT_MS * 1000000L}, &deadline);
+    for (;;)
+    {
+        uint32_t before = atomic_load_explicit(&map->file->sequence, memory_order_acquire);
+        if (before & 1)
+        {
+            // being written right now, the writer wakes the futex when it is done
+            if (theming_palette_futex_wait(map, before, &deadline) == -1)
+            {
+                if (errno == ETIMEDOUT)
+                {
+                    errno = EBUSY;
+                }
+                return -1;
+            }
+            continue;
+        }
+
+        memcpy(palette, (const void *)&map->file->palette, sizeof(*palette));
+
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&map->file->sequence, memory_order_relaxed) == before)
+        {
+            *sequence = before;
+            return 0;
+        }
+    }
+}
+
+// sleeps until the sequence differs from seen, 0 once it does, -1 with ETIMEDOUT after timeout (NULL waits forever)
+static inline int theming_palette_wait(const theming_palette_map_t *map, uint32_t seen, const struct timespec *timeout)
+{
+    struct timespec deadline;
+    if (timeout != NULL)
+    {
+        theming_palette_deadline(timeout, &deadline);
+    }
+    while (atomic_load_explicit(&map->file->sequence, memory_order_acquire) == seen)
+    {
+        if (theming_palette_futex_wait(map, seen, timeout != NULL ? &deadline : NULL) == -1)
+        {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static inline void theming_palette_close(theming_palette_map_t *map)
+{
+    if (map->file != NULL)
+    {
+        munmap((void *)map->file, sizeof(theming_palette_file_t));
+        map->file = NULL;
+    }
+}
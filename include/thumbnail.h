@@ -0,0 +1,33 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define THUMBNAIL_VERSION 1
+
+// on disk layout, followed by width * height RGB8 pixels
+typedef struct
+{
+    char magic[4]; // "THMB"
+    uint32_t version;
+    uint32_t width;
+    uint32_t height;
+    uint64_t source_key; // identifies the image the thumbnail was made from
+    uint64_t reserved;
+} thumbnail_header_t;
+
+typedef struct
+{
+    char *path;
+    uint32_t width;
+    uint32_t height;
+    const uint8_t *pixels; // interleaved RGB8, points into the mapping
+    void *map;
+    size_t map_size;
+} thumbnail_t;
+
+char *thumbnail_path(const char *, const char *);
+bool thumbnail_load(const char *, const char *, thumbnail_t *);
+bool thumbnail_get(const char *, const char *, thumbnail_t *);
+void thumbnail_free(thumbnail_t *);
@@ -2,10 +2,32 @@
 
 #include <stdarg.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <sys/types.h>
 
-void die(const char *, ...) __attribute__((format(printf, 1, 2)));
+#include "priority.h"
+
+// what exec_command returns once commands_cancel was called, the command was killed or never started
+#define COMMAND_CANCELLED -1
+
+typedef enum
+{
+    COPY_REFLINK,  // reflink, copy_file_range, sendfile, read/write, the copy is independent of the source
+    COPY_HARDLINK, // hardlink if possible, the copy then is the source, otherwise like reflink
+    COPY_PLAIN,    // always duplicate the data
+} copy_strategy_t;
+
+// what a command cost, from wait4
+typedef struct
+{
+    double wall; // seconds
+    double cpu;  // user and system seconds, its children included
+    long max_rss; // peak resident set of its largest process in KiB
+} command_usage_t;
+
+void die(const char *, ...) __attribute__((format(printf, 1, 2), noreturn));
 void *safe_malloc(size_t);
 void *safe_realloc(void *, size_t);
 void *safe_calloc(size_t, size_t);
@@ -13,8 +35,9 @@ char *format_string(const char *, ...) __attribute__((format(printf, 1, 2)));
 char *expand_tilde(const char *);
 void mkdir_p(const char *);
 void read_file(FILE *, char *, size_t);
-void exec_command(const char *, bool, char *, size_t);
-void exec_command_format(bool, char *, size_t, const char *, ...) __attribute__((format(printf, 4, 5)));
+int exec_command(const char *, bool, char *, size_t);
+int exec_command_priority(const char *, bool, const priority_t *, command_usage_t *);
+int exec_command_format(bool, char *, size_t, const char *, ...) __attribute__((format(printf, 4, 5)));
 char *resolve_absolute_path(const char *);
 int rmrf(char *);
 int check_directory(const char *);
@@ -22,5 +45,10 @@ int check_file(const char *);
 void make_symlink(const char *, const char *);
 char *replace_substring(const char *, const char *, const char *);
 pid_t find_pid_by_name(const char *);
-void exec_command_and_disown(const char *);
-int cp(const char *, const char *);
+pid_t exec_command_and_disown(const char *, const priority_t *);
+int cp(const char *, const char *, copy_strategy_t);
+uint64_t hash_bytes(const void *, size_t, uint64_t);
+int hash_file(const char *, uint64_t *);
+void commands_cancel(void);
+bool commands_cancelled(void);
+void replace_directory(const char *, const char *);
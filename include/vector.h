@@ -22,7 +22,7 @@ void vector_free(vector_t *);
 vector_t *vector_init(size_t item_size)
 {
     vector_t *vector = safe_malloc(sizeof(vector_t));
-    vector->items = safe_calloc(0, item_size);
+    vector->items = NULL; // allocated by the first insert
     vector->size = 0;
     vector->capacity = 0;
 
@@ -0,0 +1,461 @@
+#define _GNU_SOURCE
+#include "capture.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "util.h"
+
+static void *capture_loop(void *);
+static void capture_drain(capture_t *);
+static void capture_log(const capture_t *);
+static void capture_rotate(const char *);
+static void capture_free(capture_t *);
+static void capture_detach(void);
+
+// one thread drains every pipe, commands never block on a full pipe and never wait for the log
+static struct
+{
+    bool started;
+    pid_t owner; // forked children inherit the atexit handler, only this process stops the thread
+    char *log_dir;
+    int epoll_fd;
+    int wake_fd;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    capture_t *captures; // guarded by lock
+    bool stopping;       // guarded by lock
+    int *detached_fds;   // pipes still held open by processes commands left behind, at stop
+    size_t detached_fds_size;
+} capture_state = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+void capture_start(const char *log_dir)
+{
+    capture_state.log_dir = strdup(log_dir);
+    capture_state.owner = getpid();
+    capture_state.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (capture_state.epoll_fd == -1)
+    {
+        die("epoll_create1 failed:");
+    }
+    capture_state.wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (capture_state.wake_fd == -1)
+    {
+        die("eventfd failed:");
+    }
+    struct epoll_event event = {.events = EPOLLIN, .data.ptr = NULL};
+    if (epoll_ctl(capture_state.epoll_fd, EPOLL_CTL_ADD, capture_state.wake_fd, &event) == -1)
+    {
+        die("epoll_ctl failed:");
+    }
+
+    // signals are handled by the threads running commands
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    if (pthread_create(&capture_state.thread, NULL, capture_loop, NULL) != 0)
+    {
+        die("pthread_create failed");
+    }
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    capture_state.started = true;
+    atexit(capture_stop);
+}
+
+// returns NULL when output is not captured, the child writes to *write_fd otherwise and the parent closes it
+capture_t *capture_open(const char *command, int *write_fd)
+{
+    if (!capture_state.started)
+    {
+        return NULL;
+    }
+
+    int pfd[2];
+    if (pipe2(pfd, O_CLOEXEC) == -1)
+    {
+        die("pipe2 failed:");
+    }
+    fcntl(pfd[0], F_SETFL, O_NONBLOCK);
+
+    capture_t *capture = safe_calloc(1, sizeof(capture_t));
+    capture->fd = pfd[0];
+    capture->command = strdup(command);
+    capture->ring = safe_malloc(CAPTURE_RING_SIZE);
+
+    pthread_mutex_lock(&capture_state.lock);
+    capture->next = capture_state.captures;
+    capture_state.captures = capture;
+    pthread_mutex_unlock(&capture_state.lock);
+
+    struct epoll_event event = {.events = EPOLLIN, .data.ptr = capture};
+    if (epoll_ctl(capture_state.epoll_fd, EPOLL_CTL_ADD, capture->fd, &event) == -1)
+    {
+        die("epoll_ctl failed:");
+    }
+
+    *write_fd = pfd[1];
+    return capture;
+}
+
+// hands the exited command over to the capture thread, which logs and frees it
+void capture_close(capture_t *capture, int status)
+{
+    if (capture == NULL)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&capture_state.lock);
+    capture->finished = true;
+    capture->status = status;
+    pthread_mutex_unlock(&capture_state.lock);
+
+    uint64_t one = 1;
+    if (write(capture_state.wake_fd, &one, sizeof(one)) == -1 && errno != EAGAIN)
+    {
+        perror("write failed");
+    }
+}
+
+// writes out what is still pending, at exit
+void capture_stop(void)
+{
+    if (!capture_state.started || getpid() != capture_state.owner)
+    {
+        return;
+    }
+    capture_state.started = false;
+
+    pthread_mutex_lock(&capture_state.lock);
+    capture_state.stopping = true;
+    pthread_mutex_unlock(&capture_state.lock);
+
+    uint64_t one = 1;
+    if (write(capture_state.wake_fd, &one, sizeof(one)) == -1 && errno != EAGAIN)
+    {
+        perror("write failed");
+    }
+    pthread_join(capture_state.thread, NULL);
+    capture_detach();
+}
+
+static void *capture_loop(void *arg)
+{
+    (void)arg;
+
+    struct epoll_event events[16];
+    for (;;)
+    {
+        int events_size = epoll_wait(capture_state.epoll_fd, events, sizeof(events) / sizeof(events[0]), -1);
+        if (events_size == -1 && errno != EINTR)
+        {
+            perror("epoll_wait failed");
+            return NULL;
+        }
+
+        for (int i = 0; i < events_size; i++)
+        {
+            if (events[i].data.ptr == NULL)
+            {
+                uint64_t count;
+                if (read(capture_state.wake_fd, &count, sizeof(count)) == -1 && errno != EAGAIN)
+                {
+                    perror("read failed");
+                }
+            }
+            else
+            {
+                capture_drain(events[i].data.ptr);
+            }
+        }
+
+        // log commands that exited. their pipe can stay open in processes they left behind, it is still
+        // drained but that output is dropped
+        pthread_mutex_lock(&capture_state.lock);
+        bool stopping = capture_state.stopping;
+        capture_t **link = &capture_state.captures;
+        while (*link != NULL)
+        {
+            capture_t *capture = *link;
+            if ((capture->finished || stopping) && !capture->logged)
+            {
+                capture_drain(capture);
+                capture_log(capture);
+                capture->logged = true;
+            }
+            if (capture->logged && (capture->fd == -1 || stopping))
+            {
+                if (capture->fd != -1)
+                {
+                    capture_state.detached_fds = safe_realloc(
+                        capture_state.detached_fds, (capture_state.detached_fds_size + 1) * sizeof(int));
+                    capture_state.detached_fds[capture_state.detached_fds_size++] = capture->fd;
+                    capture->fd = -1;
+                }
+                *link = capture->next;
+                capture_free(capture);
+                continue;
+            }
+            link = &capture->next;
+        }
+        pthread_mutex_unlock(&capture_state.lock);
+
+        if (stopping)
+        {
+            return NULL;
+        }
+    }
+}
+
+static void capture_drain(capture_t *capture)
+{
+    if (capture->fd == -1)
+    {
+        return;
+    }
+
+    uint8_t buffer[4096];
+    for (;;)
+    {
+        ssize_t size = read(capture->fd, buffer, sizeof(buffer));
+        if (size == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            if (errno != EAGAIN)
+            {
+                perror("read failed");
+            }
+            return;
+        }
+        if (size == 0)
+        {
+            epoll_ctl(capture_state.epoll_fd, EPOLL_CTL_DEL, capture->fd, NULL);
+            close(capture->fd);
+            capture->fd = -1;
+            return;
+        }
+        if (capture->logged)
+        {
+            continue;
+        }
+
+        for (ssize_t i = 0; i < size; i++)
+        {
+            capture->ring[capture->ring_head] = buffer[i];
+            capture->ring_head = (capture->ring_head + 1) % CAPTURE_RING_SIZE;
+        }
+        size_t total = capture->ring_used + (size_t)size;
+        if (total > CAPTURE_RING_SIZE)
+        {
+            capture->dropped += total - CAPTURE_RING_SIZE;
+            total = CAPTURE_RING_SIZE;
+        }
+        capture->ring_used = total;
+    }
+}
+
+static void capture_log(const capture_t *capture)
+{
+    // nothing worth keeping from a quiet command that succeeded
+    if (capture->finished && capture->status == 0 && capture->ring_used == 0)
+    {
+        return;
+    }
+
+    char *status;
+    if (!capture->finished)
+        status = strdup("still running");
+    else if (WIFSIGNALED(capture->status))
+        status = format_string("terminated by signal %d", WTERMSIG(capture->status));
+    else
+        status = format_string("exit status %d", WEXITSTATUS(capture->status));
+
+    char date[32];
+    time_t now = time(NULL);
+    struct tm tm;
+    strftime(date, sizeof(date), "%Y-%m-%d %H:%M:%S", localtime_r(&now, &tm));
+
+    char *header = capture->dropped > 0
+                       ? format_string("==> %s %s (%s, first %zu bytes dropped)\n", date, capture->command, status,
+                                       capture->dropped)
+                       : format_string("==> %s %s (%s)\n", date, capture->command, status);
+    free(status);
+
+    // the ring from its oldest byte, in at most two pieces
+    size_t start = (capture->ring_head + CAPTURE_RING_SIZE - capture->ring_used) % CAPTURE_RING_SIZE;
+    size_t first = capture->ring_used < CAPTURE_RING_SIZE - start ? capture->ring_used : CAPTURE_RING_SIZE - start;
+    bool newline = capture->ring_used > 0 &&
+                   capture->ring[(capture->ring_head + CAPTURE_RING_SIZE - 1) % CAPTURE_RING_SIZE] != '\n';
+    struct iovec iov[] = {
+        {.iov_base = header, .iov_len = strlen(header)},
+        {.iov_base = capture->ring + start, .iov_len = first},
+        {.iov_base = capture->ring, .iov_len = capture->ring_used - first},
+        {.iov_base = "\n", .iov_len = newline ? 1 : 0},
+    };
+    size_t record_size = 0;
+    for (size_t i = 0; i < sizeof(iov) / sizeof(iov[0]); i++)
+    {
+        record_size += iov[i].iov_len;
+    }
+
+    mkdir(capture_state.log_dir, 0755);
+    char *path = format_string("%s/commands.log", capture_state.log_dir);
+    struct stat st;
+    if (stat(path, &st) == 0 && (size_t)st.st_size + record_size > CAPTURE_LOG_MAX)
+    {
+        capture_rotate(path);
+    }
+
+    // a single append, records of overlapping runs do not interleave
+    int fd = open(path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+    if (fd == -1 || writev(fd, iov, sizeof(iov) / sizeof(iov[0])) == -1)
+    {
+        fprintf(stderr, "Warning: could not log the output of %s to %s: %s\n", capture->command, path,
+                strerror(errno));
+    }
+    if (fd != -1)
+    {
+        close(fd);
+    }
+
+    free(path);
+    free(header);
+}
+
+// commands.log becomes commands.log.1, the oldest file is dropped
+static void capture_rotate(const char *path)
+{
+    for (int i = CAPTURE_LOG_FILES - 1; i > 0; i--)
+    {
+        char *from = i > 1 ? format_string("%s.%d", path, i - 1) : strdup(path);
+        char *to = format_string("%s.%d", path, i);
+        rename(from, to);
+        free(from);
+        free(to);
+    }
+}
+
+// background processes started by commands still write to their pipes. closing the read ends would kill them
+// with SIGPIPE, a detached process keeps draining them until the last writer is gone
+static void capture_detach(void)
+{
+    size_t size = capture_state.detached_fds_size;
+    if (size == 0)
+    {
+        return;
+    }
+
+    fflush(NULL);
+    pid_t pid = fork();
+    if (pid == -1)
+    {
+        perror("fork failed");
+    }
+    else if (pid == 0)
+    {
+        // the intermediate child, the drainer is reparented once it exits
+        setsid();
+        if (fork() != 0)
+        {
+            _exit(EXIT_SUCCESS);
+        }
+
+        // nothing but the pipes is kept, a held lock or terminal must not outlive theming
+        struct pollfd fds[size];
+        int next = 0;
+        for (size_t i = 0; i < size; i++)
+        {
+            fds[i] = (struct pollfd){.fd = capture_state.detached_fds[i], .events = POLLIN};
+        }
+        for (size_t i = 0; i < size; i++)
+        {
+            int lowest = -1;
+            for (size_t j = 0; j < size; j++)
+            {
+                if (fds[j].fd >= next && (lowest == -1 || fds[j].fd < lowest))
+                {
+                    lowest = fds[j].fd;
+                }
+            }
+            if (lowest > next)
+            {
+                close_range((unsigned int)next, (unsigned int)lowest - 1, 0);
+            }
+            next = lowest + 1;
+        }
+        close_range((unsigned int)next, ~0U, 0);
+
+        // the handlers of theming do not apply to it
+        struct sigaction action = {.sa_handler = SIG_DFL};
+        sigemptyset(&action.sa_mask);
+        for (int sig = 1; sig < NSIG; sig++)
+        {
+            sigaction(sig, &action, NULL);
+        }
+
+        size_t open_fds = size;
+        char buffer[4096];
+        while (open_fds > 0)
+        {
+            if (poll(fds, size, -1) == -1)
+            {
+                continue;
+            }
+            for (size_t i = 0; i < size; i++)
+            {
+                if (fds[i].fd == -1 || fds[i].revents == 0)
+                {
+                    continue;
+                }
+                ssize_t len = read(fds[i].fd, buffer, sizeof(buffer));
+                if (len == 0 || (len == -1 && errno != EAGAIN && errno != EINTR))
+                {
+                    close(fds[i].fd);
+                    fds[i].fd = -1; // ignored by poll from now on
+                    open_fds--;
+                }
+            }
+        }
+        _exit(EXIT_SUCCESS);
+    }
+    else
+    {
+        waitpid(pid, NULL, 0);
+    }
+
+    for (size_t i = 0; i < size; i++)
+    {
+        close(capture_state.detached_fds[i]);
+    }
+    free(capture_state.detached_fds);
+    capture_state.detached_fds = NULL;
+    capture_state.detached_fds_size = 0;
+}
+
+static void capture_free(capture_t *capture)
+{
+    if (capture->fd != -1)
+    {
+        close(capture->fd);
+    }
+    free(capture->command);
+    free(capture->ring);
+    free(capture);
+}
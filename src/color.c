@@ -2,10 +2,41 @@
 
 #include <math.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
+#include "oklab.h"
 #include "util.h"
 
+// the batched kernels process this many pixels per step. The default build splits the vectors into SSE
+// registers, the avx2 clone picked at load time on capable cpus into AVX registers.
+#define COLOR_LANES 16
+
+typedef uint8_t u8xN __attribute__((vector_size(COLOR_LANES)));
+typedef uint16_t u16xN __attribute__((vector_size(COLOR_LANES * 2)));
+typedef int16_t i16xN __attribute__((vector_size(COLOR_LANES * 2)));
+typedef int32_t i32xN __attribute__((vector_size(COLOR_LANES * 4)));
+typedef float f32xN __attribute__((vector_size(COLOR_LANES * 4)));
+typedef int32_t i32x4 __attribute__((vector_size(16)));
+typedef float f32x4 __attribute__((vector_size(16)));
+
+#if defined(__x86_64__) && defined(__has_attribute)
+#if __has_attribute(target_clones)
+#define COLOR_KERNEL __attribute__((target_clones("avx2", "default")))
+#endif
+#endif
+#ifndef COLOR_KERNEL
+#define COLOR_KERNEL
+#endif
+
+// bitwise lane select, vectors are kept out of function signatures because of their psabi
+#define SELECT_LANES(mask, a, b) ((f32x4)(((i32x4)(a) & (mask)) | ((i32x4)(b) & ~(mask))))
+
 static double hue_to_rgb(double, double, double);
+static void apply_color_op_oklab(RGB *, const color_op_t *);
+static inline void load_plane(f32xN *, const uint8_t *);
+static inline void store_plane(uint8_t *, const f32xN *);
+static inline void saturate_lanes(f32x4 *, f32x4 *, f32x4 *, float);
 
 void darken_color(RGB *color, double amount)
 {
@@ -45,6 +76,99 @@ void saturate_color(RGB *color, double amount)
     hls_to_rgb(&hls, color);
 }
 
+void apply_color_ops(const RGB *in, RGB *out, size_t size, const color_op_t *ops, size_t ops_size)
+{
+    // every slot runs through the whole operation list at once, reading only from in
+    for (size_t i = 0; i < size; i++)
+    {
+        RGB color = in[i];
+
+        for (size_t j = 0; j < ops_size; j++)
+        {
+            const color_op_t *op = &ops[j];
+            if (i < op->first || i > op->last)
+            {
+                continue;
+            }
+
+            if (op->space == COLOR_SPACE_OKLAB && op->type != COLOR_OP_COPY)
+            {
+                apply_color_op_oklab(&color, op);
+                continue;
+            }
+
+            switch (op->type)
+            {
+            case COLOR_OP_COPY:
+                if (op->from < size)
+                    color = in[op->from];
+                break;
+            case COLOR_OP_DARKEN:
+                darken_color(&color, op->amount);
+                break;
+            case COLOR_OP_LIGHTEN:
+                lighten_color(&color, op->amount);
+                break;
+            case COLOR_OP_BLEND:
+                blend_color(&color, &op->color);
+                break;
+            case COLOR_OP_SATURATE:
+                saturate_color(&color, op->amount);
+                break;
+            case COLOR_OP_LIGHTNESS: {
+                HLS hls;
+                rgb_to_hls(&color, &hls);
+                hls.l = op->amount;
+                hls_to_rgb(&hls, &color);
+                break;
+            }
+            }
+        }
+
+        out[i] = color;
+    }
+}
+
+static void apply_color_op_oklab(RGB *color, const color_op_t *op)
+{
+    OKLab lab;
+    rgb_to_oklab(color, &lab);
+    float amount = (float)op->amount;
+
+    switch (op->type)
+    {
+    case COLOR_OP_DARKEN:
+        lab.l *= 1.0f - amount;
+        break;
+    case COLOR_OP_LIGHTEN:
+        lab.l += (1.0f - lab.l) * amount;
+        break;
+    case COLOR_OP_LIGHTNESS:
+        lab.l = amount;
+        break;
+    case COLOR_OP_BLEND: {
+        OKLab target;
+        rgb_to_oklab(&op->color, &target);
+        lab.l = (lab.l + target.l) * 0.5f;
+        lab.a = (lab.a + target.a) * 0.5f;
+        lab.b = (lab.b + target.b) * 0.5f;
+        break;
+    }
+    case COLOR_OP_SATURATE: {
+        // like the HLS saturation, amount is the fraction of the most colorful in gamut chroma
+        OKLCH lch;
+        oklab_to_oklch(&lab, &lch);
+        lch.c = amount * oklch_max_chroma(lch.l, lch.h);
+        oklch_to_oklab(&lch, &lab);
+        break;
+    }
+    case COLOR_OP_COPY:
+        return;
+    }
+
+    oklab_to_rgb(&lab, color);
+}
+
 RGB *from_hex_string_to_RGB(const char *color)
 {
     RGB *rgb = safe_malloc(sizeof(RGB));
@@ -135,3 +259,223 @@ static double hue_to_rgb(double p, double q, double t)
         return p + (q - p) * (2.0 / 3 - t) * 6;
     return p;
 }
+
+void rgb_planes_init(rgb_planes_t *planes, size_t size)
+{
+    uint8_t *data = safe_malloc(size > 0 ? size * 3 : 1);
+    planes->r = data;
+    planes->g = data + size;
+    planes->b = data + size * 2;
+    planes->size = size;
+}
+
+void rgb_planes_free(rgb_planes_t *planes)
+{
+    free(planes->r);
+    planes->r = planes->g = planes->b = NULL;
+    planes->size = 0;
+}
+
+void rgb_planes_from_interleaved(rgb_planes_t *planes, const uint8_t *pixels)
+{
+    for (size_t i = 0; i < planes->size; i++)
+    {
+        planes->r[i] = pixels[i * 3];
+        planes->g[i] = pixels[i * 3 + 1];
+        planes->b[i] = pixels[i * 3 + 2];
+    }
+}
+
+void rgb_planes_to_interleaved(const rgb_planes_t *planes, uint8_t *pixels)
+{
+    for (size_t i = 0; i < planes->size; i++)
+    {
+        pixels[i * 3] = planes->r[i];
+        pixels[i * 3 + 1] = planes->g[i];
+        pixels[i * 3 + 2] = planes->b[i];
+    }
+}
+
+// widen and narrow in steps, direct conversions between u8 and f32 lanes end up scalarized
+static inline void load_plane(f32xN *v, const uint8_t *p)
+{
+    u8xN in;
+    memcpy(&in, p, sizeof(in));
+    i16xN wide = __builtin_convertvector(in, i16xN);
+    *v = __builtin_convertvector(__builtin_convertvector(wide, i32xN), f32xN);
+}
+
+static inline void store_plane(uint8_t *p, const f32xN *v)
+{
+    i16xN narrow = __builtin_convertvector(__builtin_convertvector(*v, i32xN), i16xN);
+    u8xN out = __builtin_convertvector(narrow, u8xN);
+    memcpy(p, &out, sizeof(out));
+}
+
+COLOR_KERNEL void darken_colors(rgb_planes_t *planes, float amount)
+{
+    if (amount > 1.0f || amount < 0.0f)
+        amount = 0;
+
+    float factor = 1.0f - amount;
+    uint8_t *channels[] = {planes->r, planes->g, planes->b};
+
+    for (size_t c = 0; c < 3; c++)
+    {
+        uint8_t *p = channels[c];
+        size_t i = 0;
+        for (; i + COLOR_LANES <= planes->size; i += COLOR_LANES)
+        {
+            f32xN v;
+            load_plane(&v, p + i);
+            v *= factor;
+            store_plane(p + i, &v);
+        }
+        for (; i < planes->size; i++)
+        {
+            p[i] = (uint8_t)(p[i] * factor);
+        }
+    }
+}
+
+COLOR_KERNEL void blend_colors(rgb_planes_t *planes, const RGB *color)
+{
+    uint8_t *channels[] = {planes->r, planes->g, planes->b};
+    const unsigned int targets[] = {color->r, color->g, color->b};
+
+    for (size_t c = 0; c < 3; c++)
+    {
+        uint8_t *p = channels[c];
+        uint16_t target = (uint16_t)targets[c];
+        size_t i = 0;
+        for (; i + COLOR_LANES <= planes->size; i += COLOR_LANES)
+        {
+            u8xN v;
+            memcpy(&v, p + i, sizeof(v));
+            u16xN sum = __builtin_convertvector(v, u16xN) + target;
+            v = __builtin_convertvector(sum >> 1, u8xN);
+            memcpy(p + i, &v, sizeof(v));
+        }
+        for (; i < planes->size; i++)
+        {
+            p[i] = (uint8_t)((p[i] + target) >> 1);
+        }
+    }
+}
+
+COLOR_KERNEL void lighten_colors(rgb_planes_t *planes, float amount)
+{
+    if (amount > 1.0f || amount < 0.0f)
+        amount = 0;
+
+    uint8_t *channels[] = {planes->r, planes->g, planes->b};
+
+    for (size_t c = 0; c < 3; c++)
+    {
+        uint8_t *p = channels[c];
+        size_t i = 0;
+        for (; i + COLOR_LANES <= planes->size; i += COLOR_LANES)
+        {
+            f32xN v;
+            load_plane(&v, p + i);
+            v += (255.0f - v) * amount;
+            store_plane(p + i, &v);
+        }
+        for (; i < planes->size; i++)
+        {
+            p[i] = (uint8_t)(p[i] + (255 - p[i]) * amount);
+        }
+    }
+}
+
+// same result as rgb_to_hls, replacing s and hls_to_rgb: with hue and lightness fixed every channel's distance to
+// the lightness scales with the saturation, so no hue has to be computed. Takes and returns 0-255.
+static inline void saturate_lanes(f32x4 *r, f32x4 *g, f32x4 *b, float amount)
+{
+    const f32x4 zero = {0};
+    const f32x4 half = zero + 0.5f;
+    const f32x4 one = zero + 1.0f;
+    const f32x4 full = zero + 255.0f;
+
+    *r /= full;
+    *g /= full;
+    *b /= full;
+
+    i32x4 mask = *r > *g;
+    f32x4 max = SELECT_LANES(mask, *r, *g);
+    f32x4 min = SELECT_LANES(mask, *g, *r);
+    mask = *b > max;
+    max = SELECT_LANES(mask, *b, max);
+    mask = *b < min;
+    min = SELECT_LANES(mask, *b, min);
+
+    f32x4 l = (max + min) * half;
+    f32x4 d = max - min;
+    i32x4 dark = l < half;
+    i32x4 gray = d == zero;
+
+    // gray lanes divide by zero here, they are replaced below
+    f32x4 s = SELECT_LANES(dark, d / (max + min), d / (one + one - max - min));
+    f32x4 ratio = amount / s;
+
+    // achromatic colors get hue 0 (red) in rgb_to_hls
+    f32x4 q = SELECT_LANES(dark, l * (one + amount), l + amount - l * amount);
+    f32x4 p = l + l - q;
+
+    f32x4 channels[] = {
+        SELECT_LANES(gray, q, l + (*r - l) * ratio),
+        SELECT_LANES(gray, p, l + (*g - l) * ratio),
+        SELECT_LANES(gray, p, l + (*b - l) * ratio),
+    };
+    for (size_t c = 0; c < 3; c++)
+    {
+        f32x4 v = channels[c] * full;
+        v = SELECT_LANES(v < zero, zero, v);
+        channels[c] = SELECT_LANES(v > full, full, v);
+    }
+
+    *r = channels[0];
+    *g = channels[1];
+    *b = channels[2];
+}
+
+COLOR_KERNEL void saturate_colors(rgb_planes_t *planes, float amount)
+{
+    if (amount > 1.0f || amount < 0.0f)
+        amount = 0;
+
+    for (size_t i = 0; i < planes->size; i += COLOR_LANES)
+    {
+        // the tail runs through a padded copy, so there is only one implementation of the math
+        size_t n = planes->size - i < COLOR_LANES ? planes->size - i : COLOR_LANES;
+        uint8_t r_block[COLOR_LANES] = {0}, g_block[COLOR_LANES] = {0}, b_block[COLOR_LANES] = {0};
+        memcpy(r_block, planes->r + i, n);
+        memcpy(g_block, planes->g + i, n);
+        memcpy(b_block, planes->b + i, n);
+
+        f32xN r, g, b;
+        load_plane(&r, r_block);
+        load_plane(&g, g_block);
+        load_plane(&b, b_block);
+
+        // the math runs on native sse width, wider compares are scalarized by the compiler
+        f32x4 r4[COLOR_LANES / 4], g4[COLOR_LANES / 4], b4[COLOR_LANES / 4];
+        memcpy(r4, &r, sizeof(r));
+        memcpy(g4, &g, sizeof(g));
+        memcpy(b4, &b, sizeof(b));
+        for (size_t k = 0; k < COLOR_LANES / 4; k++)
+        {
+            saturate_lanes(&r4[k], &g4[k], &b4[k], amount);
+        }
+        memcpy(&r, r4, sizeof(r));
+        memcpy(&g, g4, sizeof(g));
+        memcpy(&b, b4, sizeof(b));
+
+        store_plane(r_block, &r);
+        store_plane(g_block, &g);
+        store_plane(b_block, &b);
+        memcpy(planes->r + i, r_block, n);
+        memcpy(planes->g + i, g_block, n);
+        memcpy(planes->b + i, b_block, n);
+    }
+}
@@ -1,15 +1,51 @@
 #include "config.h"
 
 #include <json-c/json.h>
+#include <limits.h>
+#include <signal.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
 
+#include "pool.h"
+#include "process.h"
 #include "util.h"
 
 static void config_resolve_variables(config_t, command_t *, size_t);
+static char *config_resolve_string(config_t, char *);
+static bool config_parse_string_list(struct json_object *, const char *, const char *, char ***, size_t *);
+static void config_parse_command_pipeline(struct json_object *, command_t *);
+static void config_parse_command_memo(struct json_object *, command_t *);
+static void config_parse_ready(struct json_object *, command_t *);
+static void config_parse_priority(struct json_object *, const char *, priority_t *);
+static void config_copy_priority(const priority_t *, priority_t *);
+static void config_free_priority(priority_t *);
+static void config_free_command(command_t *);
+static int config_parse_signal(const char *);
+static color_space_t config_parse_color_space(const char *);
+static void config_parse_palette(struct json_object *, const char *, color_ops_t *, const color_op_t *, size_t);
+static void config_parse_color_op(struct json_object *, color_op_t *);
 static struct json_object *json_find_by_name_safe(struct json_object *, json_type, const char *);
 static struct json_object *json_find_by_name(struct json_object *, json_type, const char *);
 
+// the adjustments the palettes always got, used when the config has no palette entry
+static const color_op_t default_dark_palette[] = {
+    {.type = COLOR_OP_DARKEN, .first = 0, .last = 0, .amount = 0.4},
+    {.type = COLOR_OP_BLEND, .first = 7, .last = 7, .color = {0xEE, 0xEE, 0xEE}},
+    {.type = COLOR_OP_DARKEN, .first = 8, .last = 8, .amount = 0.3},
+    {.type = COLOR_OP_BLEND, .first = 15, .last = 15, .color = {0xEE, 0xEE, 0xEE}},
+};
+
+static const color_op_t default_light_palette[] = {
+    {.type = COLOR_OP_COPY, .first = 0, .last = 0, .from = 15},
+    {.type = COLOR_OP_COPY, .first = 7, .last = 7, .from = 0},
+    {.type = COLOR_OP_COPY, .first = 8, .last = 8, .from = 15},
+    {.type = COLOR_OP_COPY, .first = 15, .last = 15, .from = 0},
+    {.type = COLOR_OP_LIGHTEN, .first = 0, .last = PALETTE_SIZE - 1, .amount = 0.5},
+    {.type = COLOR_OP_LIGHTEN, .first = 0, .last = 0, .amount = 0.85},
+    {.type = COLOR_OP_DARKEN, .first = 8, .last = 8, .amount = 0.4},
+};
+
 static struct json_object *json_find_by_name_safe(struct json_object *jobj, json_type jtype, const char *name)
 {
     struct json_object *tmp;
@@ -86,8 +122,14 @@ void config_init(config_t *config)
         die("fopen failed:");
     }
     free(config_file_path);
-    char *output = safe_malloc(BUFSIZ);
-    read_file(file, output, BUFSIZ);
+    struct stat st;
+    if (fstat(fileno(file), &st) == -1)
+    {
+        die("fstat failed:");
+    }
+    size_t output_size = (size_t)st.st_size + 1;
+    char *output = safe_malloc(output_size);
+    read_file(file, output, output_size);
     fclose(file);
 
     json_object *jobj = json_tokener_parse(output);
@@ -101,8 +143,42 @@ void config_init(config_t *config)
         expand_tilde(json_object_get_string(json_find_by_name_safe(jobj, json_type_string, "cache_path")));
     config->theme_path =
         expand_tilde(json_object_get_string(json_find_by_name_safe(jobj, json_type_string, "theme_path")));
+    json_object *json_theme_skeleton_path = json_find_by_name(jobj, json_type_string, "theme_skeleton_path");
+    config->theme_skeleton_path =
+        json_theme_skeleton_path != NULL ? expand_tilde(json_object_get_string(json_theme_skeleton_path)) : NULL;
     config->icon_theme_path =
         expand_tilde(json_object_get_string(json_find_by_name_safe(jobj, json_type_string, "icon_theme_path")));
+    json_object *json_icon_source_path = json_find_by_name(jobj, json_type_string, "icon_source_path");
+    config->icon_source_path =
+        json_icon_source_path != NULL ? expand_tilde(json_object_get_string(json_icon_source_path)) : NULL;
+    json_object *json_icon_color_map = json_find_by_name(jobj, json_type_object, "icon_color_map");
+    if (config->icon_source_path != NULL && json_icon_color_map == NULL)
+    {
+        die("config: icon_source_path needs an icon_color_map");
+    }
+    config->icon_color_map_size = 0;
+    config->icon_color_sources = NULL;
+    config->icon_color_keys = NULL;
+    if (json_icon_color_map != NULL)
+    {
+        struct json_object_iterator it = json_object_iter_begin(json_icon_color_map);
+        struct json_object_iterator end = json_object_iter_end(json_icon_color_map);
+        for (; !json_object_iter_equal(&it, &end); json_object_iter_next(&it))
+        {
+            json_object *json_key = json_object_iter_peek_value(&it);
+            if (!json_object_is_type(json_key, json_type_string))
+            {
+                die("config: icon_color_map %s is not a string", json_object_iter_peek_name(&it));
+            }
+
+            size_t i = config->icon_color_map_size++;
+            config->icon_color_sources =
+                safe_realloc(config->icon_color_sources, config->icon_color_map_size * sizeof(char *));
+            config->icon_color_keys = safe_realloc(config->icon_color_keys, config->icon_color_map_size * sizeof(char *));
+            config->icon_color_sources[i] = strdup(json_object_iter_peek_name(&it));
+            config->icon_color_keys[i] = strdup(json_object_get_string(json_key));
+        }
+    }
     config->oomox_icons_command =
         expand_tilde(json_object_get_string(json_find_by_name_safe(jobj, json_type_string, "oomox_icons_command")));
     config->oomox_theme_name =
@@ -111,9 +187,59 @@ void config_init(config_t *config)
         strdup(json_object_get_string(json_find_by_name_safe(jobj, json_type_string, "oomox_icon_theme_name")));
     config->image_path =
         expand_tilde(json_object_get_string(json_find_by_name_safe(jobj, json_type_string, "image_cache_path")));
+    config->image_copy_strategy = COPY_REFLINK;
+    json_object *json_copy_strategy = json_find_by_name(jobj, json_type_string, "image_copy_strategy");
+    if (json_copy_strategy != NULL)
+    {
+        const char *strategy = json_object_get_string(json_copy_strategy);
+        if (strcmp(strategy, "auto") == 0 || strcmp(strategy, "reflink") == 0)
+            config->image_copy_strategy = COPY_REFLINK;
+        else if (strcmp(strategy, "hardlink") == 0)
+            config->image_copy_strategy = COPY_HARDLINK;
+        else if (strcmp(strategy, "copy") == 0)
+            config->image_copy_strategy = COPY_PLAIN;
+        else
+            die("config: unknown image_copy_strategy %s", strategy);
+    }
+    json_object *json_variant = json_find_by_name(jobj, json_type_string, "variant");
+    config->variant = strdup(json_variant != NULL ? json_object_get_string(json_variant) : "dark");
+    config->quantizer = QUANTIZER_MAGICK;
+    json_object *json_quantizer = json_find_by_name(jobj, json_type_string, "quantizer");
+    if (json_quantizer != NULL)
+    {
+        const char *quantizer = json_object_get_string(json_quantizer);
+        if (strcmp(quantizer, "magick") == 0)
+            config->quantizer = QUANTIZER_MAGICK;
+        else if (strcmp(quantizer, "kmeans") == 0)
+            config->quantizer = QUANTIZER_KMEANS;
+        else
+            die("config: unknown quantizer %s", quantizer);
+    }
+    json_object *json_quantizer_color_space = json_find_by_name(jobj, json_type_string, "quantizer_color_space");
+    config->quantizer_color_space = json_quantizer_color_space != NULL
+                                        ? config_parse_color_space(json_object_get_string(json_quantizer_color_space))
+                                        : COLOR_SPACE_OKLAB;
+    json_object *json_palette = json_find_by_name(jobj, json_type_object, "palette");
+    config_parse_palette(json_palette, "dark", &config->dark_palette, default_dark_palette,
+                         sizeof(default_dark_palette) / sizeof(default_dark_palette[0]));
+    config_parse_palette(json_palette, "light", &config->light_palette, default_light_palette,
+                         sizeof(default_light_palette) / sizeof(default_light_palette[0]));
     config->hidpi = json_object_get_boolean(json_find_by_name_safe(jobj, json_type_boolean, "hidpi"));
     config->send_notification =
         json_object_get_boolean(json_find_by_name_safe(jobj, json_type_boolean, "send_notification"));
+    config->pipeline = json_object_get_boolean(json_find_by_name(jobj, json_type_boolean, "pipeline"));
+    config->recolor_terminals =
+        json_object_get_boolean(json_find_by_name(jobj, json_type_boolean, "recolor_terminals"));
+    config_parse_priority(json_find_by_name(jobj, json_type_object, "generating_priority"), "generating_priority",
+                          &config->generating_priority);
+    json_object *json_max_jobs = json_find_by_name(jobj, json_type_int, "max_jobs");
+    if (json_max_jobs != NULL && json_object_get_int(json_max_jobs) < 1)
+    {
+        die("Error: max_jobs has to be at least 1");
+    }
+    config->max_jobs = json_max_jobs != NULL ? (size_t)json_object_get_int(json_max_jobs) : pool_threads();
+    json_object *json_metrics_path = json_find_by_name(jobj, json_type_string, "metrics_path");
+    config->metrics_path = json_metrics_path != NULL ? expand_tilde(json_object_get_string(json_metrics_path)) : NULL;
 
     // generating commands
     json_object *json_generating_commands = json_find_by_name_safe(jobj, json_type_array, "generating_commands");
@@ -130,6 +256,16 @@ void config_init(config_t *config)
             .ignore_error = json_object_get_boolean(json_find_by_name(json_command, json_type_boolean, "ignore_error")),
             .restart = false,
         };
+        config_parse_command_pipeline(json_command, &config->generating_commands[i]);
+        config_parse_command_memo(json_command, &config->generating_commands[i]);
+
+        // heavy generators run in the background, unless the command says otherwise
+        json_object *json_priority = json_find_by_name(json_command, json_type_object, "priority");
+        if (json_priority != NULL)
+            config_parse_priority(json_priority, config->generating_commands[i].command,
+                                  &config->generating_commands[i].priority);
+        else
+            config_copy_priority(&config->generating_priority, &config->generating_commands[i].priority);
     }
 
     // reload commands
@@ -148,6 +284,23 @@ void config_init(config_t *config)
             .restart = json_object_get_boolean(json_find_by_name(json_command, json_type_boolean, "restart")),
             .initial = json_object_get_boolean(json_find_by_name(json_command, json_type_boolean, "initial")),
         };
+
+        config_parse_command_pipeline(json_command, &config->reload_commands[i]);
+
+        json_object *json_process_name = json_find_by_name(json_command, json_type_string, "process_name");
+        config->reload_commands[i].process_name =
+            json_process_name != NULL ? strdup(json_object_get_string(json_process_name))
+                                      : process_default_name(config->reload_commands[i].command);
+
+        json_object *json_reload_signal = json_find_by_name(json_command, json_type_string, "reload_signal");
+        if (json_reload_signal != NULL)
+        {
+            config->reload_commands[i].reload_signal = config_parse_signal(json_object_get_string(json_reload_signal));
+        }
+
+        config_parse_ready(json_command, &config->reload_commands[i]);
+        config_parse_priority(json_find_by_name(json_command, json_type_object, "priority"),
+                              config->reload_commands[i].command, &config->reload_commands[i].priority);
     }
 
     json_object_put(jobj);
@@ -156,7 +309,340 @@ void config_init(config_t *config)
     config_resolve_variables(*config, config->reload_commands, config->reload_commands_size);
 }
 
+static void config_parse_palette(struct json_object *json_palette, const char *name, color_ops_t *palette,
+                                 const color_op_t *defaults, size_t defaults_size)
+{
+    json_object *json_ops = json_palette != NULL ? json_find_by_name(json_palette, json_type_array, name) : NULL;
+    if (json_ops == NULL)
+    {
+        palette->size = defaults_size;
+        palette->ops = safe_calloc(defaults_size, sizeof(color_op_t));
+        memcpy(palette->ops, defaults, defaults_size * sizeof(color_op_t));
+        return;
+    }
+
+    palette->size = json_object_array_length(json_ops);
+    palette->ops = safe_calloc(palette->size, sizeof(color_op_t));
+    for (size_t i = 0; i < palette->size; i++)
+    {
+        json_object *json_op = json_object_array_get_idx(json_ops, i);
+        if (!json_object_is_type(json_op, json_type_object))
+        {
+            die("config: palette %s entry %zu is not an object", name, i);
+        }
+        config_parse_color_op(json_op, &palette->ops[i]);
+    }
+}
+
+static void config_parse_color_op(struct json_object *json_op, color_op_t *op)
+{
+    static const struct
+    {
+        const char *name;
+        color_op_type_t type;
+    } types[] = {
+        {"copy", COLOR_OP_COPY},         {"darken", COLOR_OP_DARKEN},     {"lighten", COLOR_OP_LIGHTEN},
+        {"blend", COLOR_OP_BLEND},       {"saturate", COLOR_OP_SATURATE}, {"lightness", COLOR_OP_LIGHTNESS},
+    };
+
+    const char *type = json_object_get_string(json_find_by_name_safe(json_op, json_type_string, "op"));
+    size_t i = 0;
+    while (i < sizeof(types) / sizeof(types[0]) && strcmp(type, types[i].name) != 0)
+    {
+        i++;
+    }
+    if (i == sizeof(types) / sizeof(types[0]))
+    {
+        die("config: unknown palette op %s", type);
+    }
+    *op = (color_op_t){.type = types[i].type, .first = 0, .last = PALETTE_SIZE - 1};
+
+    json_object *json_space = json_find_by_name(json_op, json_type_string, "space");
+    if (json_space != NULL)
+    {
+        op->space = config_parse_color_space(json_object_get_string(json_space));
+    }
+
+    // an op without index or range applies to the whole palette
+    json_object *json_index = json_find_by_name(json_op, json_type_int, "index");
+    json_object *json_range = json_find_by_name(json_op, json_type_array, "range");
+    if (json_index != NULL)
+    {
+        op->first = op->last = (unsigned int)json_object_get_int(json_index);
+    }
+    else if (json_range != NULL)
+    {
+        if (json_object_array_length(json_range) != 2)
+        {
+            die("config: palette op range must be [first, last]");
+        }
+        op->first = (unsigned int)json_object_get_int(json_object_array_get_idx(json_range, 0));
+        op->last = (unsigned int)json_object_get_int(json_object_array_get_idx(json_range, 1));
+    }
+    if (op->first > op->last || op->last >= PALETTE_SIZE)
+    {
+        die("config: palette op %s applies to slots outside 0-%d", type, PALETTE_SIZE - 1);
+    }
+
+    if (op->type == COLOR_OP_COPY)
+    {
+        op->from = (unsigned int)json_object_get_int(json_find_by_name_safe(json_op, json_type_int, "from"));
+        if (op->from >= PALETTE_SIZE)
+        {
+            die("config: palette op copy from %u is outside 0-%d", op->from, PALETTE_SIZE - 1);
+        }
+    }
+    else if (op->type == COLOR_OP_BLEND)
+    {
+        const char *color = json_object_get_string(json_find_by_name_safe(json_op, json_type_string, "color"));
+        RGB *rgb = from_hex_string_to_RGB(color);
+        op->color = *rgb;
+        free(rgb);
+    }
+    else
+    {
+        // amounts are fractions, accept integers like 0 or 1 as well
+        json_object *json_amount;
+        if (!json_object_object_get_ex(json_op, "amount", &json_amount) ||
+            !(json_object_is_type(json_amount, json_type_double) || json_object_is_type(json_amount, json_type_int)))
+        {
+            die("config: palette op %s needs a numeric amount", type);
+        }
+        op->amount = json_object_get_double(json_amount);
+    }
+}
+
+static void config_parse_command_pipeline(struct json_object *json_command, command_t *command)
+{
+    json_object *json_name = json_find_by_name(json_command, json_type_string, "name");
+    command->name = json_name != NULL ? strdup(json_object_get_string(json_name)) : NULL;
+
+    command->has_depends_on = config_parse_string_list(json_command, "depends_on", command->command,
+                                                       &command->depends_on, &command->depends_on_size);
+}
+
+static void config_parse_command_memo(struct json_object *json_command, command_t *command)
+{
+    command->has_inputs =
+        config_parse_string_list(json_command, "inputs", command->command, &command->inputs, &command->inputs_size);
+    config_parse_string_list(json_command, "outputs", command->command, &command->outputs, &command->outputs_size);
+}
+
+static void config_parse_ready(struct json_object *json_command, command_t *command)
+{
+    json_object *json_ready = json_find_by_name(json_command, json_type_object, "ready");
+    if (json_ready == NULL)
+    {
+        return;
+    }
+
+    static const struct
+    {
+        const char *name;
+        ready_type_t type;
+    } types[] = {{"process", READY_PROCESS}, {"file", READY_FILE}, {"command", READY_COMMAND}};
+
+    for (size_t i = 0; i < sizeof(types) / sizeof(types[0]); i++)
+    {
+        json_object *json_target = json_find_by_name(json_ready, json_type_string, types[i].name);
+        if (json_target != NULL)
+        {
+            if (command->ready.type != READY_NONE)
+            {
+                die("config: ready of %s takes only one of process, file or command", command->command);
+            }
+            command->ready.type = types[i].type;
+            command->ready.target = strdup(json_object_get_string(json_target));
+        }
+    }
+    if (command->ready.type == READY_NONE)
+    {
+        die("config: ready of %s needs a process, file or command", command->command);
+    }
+
+    // seconds, integers are fine too
+    command->ready.timeout_ms = READY_DEFAULT_TIMEOUT_MS;
+    json_object *json_timeout;
+    if (json_object_object_get_ex(json_ready, "timeout", &json_timeout))
+    {
+        if (!json_object_is_type(json_timeout, json_type_double) && !json_object_is_type(json_timeout, json_type_int))
+        {
+            die("config: ready timeout of %s is not a number", command->command);
+        }
+        double seconds = json_object_get_double(json_timeout);
+        if (!(seconds >= 0.001) || seconds * 1000 >= INT_MAX)
+        {
+            die("config: ready timeout of %s has to be between 0.001 and %d seconds", command->command,
+                INT_MAX / 1000);
+        }
+        command->ready.timeout_ms = (int)(seconds * 1000);
+    }
+}
+
+static void config_parse_priority(struct json_object *json_priority, const char *what, priority_t *priority)
+{
+    *priority = (priority_t){0};
+    if (json_priority == NULL)
+    {
+        return;
+    }
+
+    json_object *json_nice = json_find_by_name(json_priority, json_type_int, "nice");
+    if (json_nice != NULL)
+    {
+        priority->has_nice = true;
+        priority->nice = json_object_get_int(json_nice);
+    }
+
+    json_object *json_io = json_find_by_name(json_priority, json_type_string, "io");
+    if (json_io != NULL)
+    {
+        const char *io = json_object_get_string(json_io);
+        if (strcmp(io, "idle") == 0)
+            priority->io_class = IO_CLASS_IDLE;
+        else if (strcmp(io, "best-effort") == 0)
+            priority->io_class = IO_CLASS_BEST_EFFORT;
+        else
+            die("config: unknown io class %s for %s", io, what);
+    }
+    json_object *json_io_level = json_find_by_name(json_priority, json_type_int, "io_level");
+    priority->io_level = json_io_level != NULL ? json_object_get_int(json_io_level) : 4;
+    if (priority->io_level < 0 || priority->io_level > 7)
+    {
+        die("config: io_level of %s is not between 0 and 7", what);
+    }
+
+    json_object *json_sched = json_find_by_name(json_priority, json_type_string, "sched");
+    if (json_sched != NULL)
+    {
+        const char *sched = json_object_get_string(json_sched);
+        if (strcmp(sched, "idle") == 0)
+            priority->sched_class = SCHED_CLASS_IDLE;
+        else if (strcmp(sched, "batch") == 0)
+            priority->sched_class = SCHED_CLASS_BATCH;
+        else
+            die("config: unknown sched class %s for %s", sched, what);
+    }
+
+    json_object *json_cpus = json_find_by_name(json_priority, json_type_string, "cpus");
+    if (json_cpus != NULL)
+    {
+        if (!priority_valid_cpus(json_object_get_string(json_cpus)))
+        {
+            die("config: cpus of %s is not a list like 0-3,6", what);
+        }
+        priority->cpus = strdup(json_object_get_string(json_cpus));
+    }
+
+    // fraction of one cpu, e.g. 0.5 or 2
+    json_object *json_cpu_max;
+    if (json_object_object_get_ex(json_priority, "cpu_max", &json_cpu_max))
+    {
+        if (!json_object_is_type(json_cpu_max, json_type_double) && !json_object_is_type(json_cpu_max, json_type_int))
+        {
+            die("config: cpu_max of %s is not a number", what);
+        }
+        priority->cpu_max = json_object_get_double(json_cpu_max);
+    }
+
+    json_object *json_memory_max = json_find_by_name(json_priority, json_type_string, "memory_max");
+    priority->memory_max = json_memory_max != NULL ? strdup(json_object_get_string(json_memory_max)) : NULL;
+}
+
+static void config_copy_priority(const priority_t *from, priority_t *to)
+{
+    *to = *from;
+    to->cpus = from->cpus != NULL ? strdup(from->cpus) : NULL;
+    to->memory_max = from->memory_max != NULL ? strdup(from->memory_max) : NULL;
+}
+
+static void config_free_priority(priority_t *priority)
+{
+    free(priority->cpus);
+    free(priority->memory_max);
+}
+
+static bool config_parse_string_list(struct json_object *json_command, const char *name, const char *command,
+                                     char ***list, size_t *size)
+{
+    json_object *json_list = json_find_by_name(json_command, json_type_array, name);
+    if (json_list == NULL)
+    {
+        return false;
+    }
+
+    *size = json_object_array_length(json_list);
+    *list = safe_calloc(*size, sizeof(char *));
+    for (size_t i = 0; i < *size; i++)
+    {
+        json_object *json_item = json_object_array_get_idx(json_list, i);
+        if (!json_object_is_type(json_item, json_type_string))
+        {
+            die("config: %s of %s is not a list of strings", name, command);
+        }
+        (*list)[i] = strdup(json_object_get_string(json_item));
+    }
+    return true;
+}
+
+static color_space_t config_parse_color_space(const char *name)
+{
+    if (strcmp(name, "rgb") == 0)
+        return COLOR_SPACE_RGB;
+    if (strcmp(name, "oklab") == 0)
+        return COLOR_SPACE_OKLAB;
+
+    die("config: unknown color space %s", name);
+}
+
+static int config_parse_signal(const char *name)
+{
+    static const struct
+    {
+        const char *name;
+        int sig;
+    } signals[] = {
+        {"HUP", SIGHUP},   {"INT", SIGINT},   {"QUIT", SIGQUIT}, {"USR1", SIGUSR1},
+        {"USR2", SIGUSR2}, {"TERM", SIGTERM}, {"CONT", SIGCONT}, {"WINCH", SIGWINCH},
+    };
+
+    if (strncmp(name, "SIG", 3) == 0)
+    {
+        name += 3;
+    }
+
+    for (size_t i = 0; i < sizeof(signals) / sizeof(signals[0]); i++)
+    {
+        if (strcmp(name, signals[i].name) == 0)
+        {
+            return signals[i].sig;
+        }
+    }
+
+    die("config: unknown reload_signal %s", name);
+}
+
 static void config_resolve_variables(config_t config, command_t *commands, size_t commands_size)
+{
+    for (size_t i = 0; i < commands_size; i++)
+    {
+        commands[i].command = config_resolve_string(config, commands[i].command);
+        for (size_t j = 0; j < commands[i].inputs_size; j++)
+        {
+            commands[i].inputs[j] = config_resolve_string(config, commands[i].inputs[j]);
+        }
+        for (size_t j = 0; j < commands[i].outputs_size; j++)
+        {
+            commands[i].outputs[j] = config_resolve_string(config, commands[i].outputs[j]);
+        }
+        if (commands[i].ready.target != NULL)
+        {
+            commands[i].ready.target = config_resolve_string(config, commands[i].ready.target);
+        }
+    }
+}
+
+static char *config_resolve_string(config_t config, char *string)
 {
     const char *variables[] = {"%CACHE_PATH%",       "%THEME_PATH%",
                                "%ICON_THEME_PATH%",  "%OOMOX_ICONS_COMMAND%",
@@ -167,35 +653,69 @@ static void config_resolve_variables(config_t config, command_t *commands, size_
                             config.oomox_theme_name, config.oomox_icon_theme_name,
                             config.image_path,       config.hidpi ? "true" : "false"};
 
-    for (size_t i = 0; i < commands_size; i++)
+    for (size_t i = 0; i < sizeof(variables) / sizeof(variables[0]); i++)
     {
-        char *new_command = commands[i].command;
-        for (size_t j = 0; j < sizeof(variables) / sizeof(variables[0]); j++)
-        {
-            char *replaced_command = replace_substring(new_command, variables[j], values[j]);
-            free(new_command);
-            new_command = replaced_command;
-        }
-        commands[i].command = new_command;
+        char *replaced = replace_substring(string, variables[i], values[i]);
+        free(string);
+        string = replaced;
     }
+    return string;
+}
+
+static void config_free_command(command_t *command)
+{
+    free(command->command);
+    free(command->name);
+    free(command->process_name);
+    for (size_t i = 0; i < command->depends_on_size; i++)
+    {
+        free(command->depends_on[i]);
+    }
+    free(command->depends_on);
+    for (size_t i = 0; i < command->inputs_size; i++)
+    {
+        free(command->inputs[i]);
+    }
+    free(command->inputs);
+    for (size_t i = 0; i < command->outputs_size; i++)
+    {
+        free(command->outputs[i]);
+    }
+    free(command->outputs);
+    free(command->ready.target);
+    config_free_priority(&command->priority);
 }
 
 void config_free(config_t *config)
 {
     free(config->cache_path);
     free(config->theme_path);
+    free(config->theme_skeleton_path);
+    free(config->icon_source_path);
+    free(config->metrics_path);
+    for (size_t i = 0; i < config->icon_color_map_size; i++)
+    {
+        free(config->icon_color_sources[i]);
+        free(config->icon_color_keys[i]);
+    }
+    free(config->icon_color_sources);
+    free(config->icon_color_keys);
     free(config->icon_theme_path);
     free(config->oomox_icons_command);
     free(config->oomox_theme_name);
     free(config->oomox_icon_theme_name);
     free(config->image_path);
+    free(config->variant);
+    config_free_priority(&config->generating_priority);
+    free(config->dark_palette.ops);
+    free(config->light_palette.ops);
     for (size_t i = 0; i < config->generating_commands_size; i++)
     {
-        free(config->generating_commands[i].command);
+        config_free_command(&config->generating_commands[i]);
     }
     for (size_t i = 0; i < config->reload_commands_size; i++)
     {
-        free(config->reload_commands[i].command);
+        config_free_command(&config->reload_commands[i]);
     }
     free(config->generating_commands);
     free(config->reload_commands);
@@ -0,0 +1,221 @@
+#include "history.h"
+
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static history_command_t *history_find(const history_t *, const char *);
+static void history_add(history_t *, const char *, const command_usage_t *);
+static void history_compact(const char *, const history_t *);
+static int compare_double(const void *, const void *);
+static double percentile(const double *, size_t, unsigned int);
+
+static history_command_t *history_find(const history_t *history, const char *command)
+{
+    for (size_t i = 0; i < history->size; i++)
+    {
+        if (strcmp(history->commands[i].command, command) == 0)
+        {
+            return &history->commands[i];
+        }
+    }
+
+    return NULL;
+}
+
+static void history_add(history_t *history, const char *command, const command_usage_t *usage)
+{
+    history_command_t *entry = history_find(history, command);
+    if (entry == NULL)
+    {
+        history->commands = safe_realloc(history->commands, (history->size + 1) * sizeof(history_command_t));
+        entry = &history->commands[history->size++];
+        *entry = (history_command_t){.command = strdup(command)};
+    }
+
+    entry->runs[entry->next] = *usage;
+    entry->next = (entry->next + 1) % HISTORY_RUNS;
+    if (entry->runs_size < HISTORY_RUNS)
+    {
+        entry->runs_size++;
+    }
+}
+
+// one line per run: "wall cpu max_rss\tcommand"
+void history_record(const char *cache_path, const char *command, const command_usage_t *usage)
+{
+    char *line = format_string("%.3f %.3f %ld\t%s\n", usage->wall, usage->cpu, usage->max_rss, command);
+    // multi line scripts are kept to one line, only the last newline ends the record
+    for (char *c = strchr(line, '\t') + 1; c[1] != '\0'; c++)
+    {
+        if (*c == '\n')
+        {
+            *c = ' ';
+        }
+    }
+
+    // appended with a single write, records of commands finishing at the same time do not interleave.
+    // the history only guides scheduling, losing a record is harmless
+    char *path = format_string("%s/history", cache_path);
+    int fd = open(path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+    if (fd != -1)
+    {
+        if (write(fd, line, strlen(line)) == -1)
+        {
+            fprintf(stderr, "Warning: could not record %s in %s\n", command, path);
+        }
+        close(fd);
+    }
+
+    free(path);
+    free(line);
+}
+
+void history_load(const char *cache_path, history_t *history)
+{
+    *history = (history_t){0};
+
+    char *path = format_string("%s/history", cache_path);
+    FILE *file = fopen(path, "r");
+    if (file == NULL)
+    {
+        free(path);
+        return;
+    }
+
+    char *line = NULL;
+    size_t line_size = 0;
+    ssize_t length;
+    size_t lines = 0;
+    while ((length = getline(&line, &line_size, file)) != -1)
+    {
+        char *command = strchr(line, '\t');
+        command_usage_t usage;
+        if (command == NULL || line[length - 1] != '\n' ||
+            sscanf(line, "%lf %lf %ld", &usage.wall, &usage.cpu, &usage.max_rss) != 3)
+        {
+            continue; // a torn record
+        }
+        line[length - 1] = '\0';
+        history_add(history, command + 1, &usage);
+        lines++;
+    }
+    free(line);
+    fclose(file);
+
+    // the file only grows, rewrite it with the kept runs once most of it is stale
+    size_t kept = 0;
+    for (size_t i = 0; i < history->size; i++)
+    {
+        kept += history->commands[i].runs_size;
+    }
+    if (lines > 2 * kept)
+    {
+        history_compact(path, history);
+    }
+
+    free(path);
+}
+
+static void history_compact(const char *path, const history_t *history)
+{
+    char *tmp_path = format_string("%s.tmp", path);
+    FILE *file = fopen(tmp_path, "w");
+    if (file == NULL)
+    {
+        free(tmp_path);
+        return;
+    }
+
+    for (size_t i = 0; i < history->size; i++)
+    {
+        const history_command_t *entry = &history->commands[i];
+        for (size_t j = 0; j < entry->runs_size; j++)
+        {
+            // oldest first
+            const command_usage_t *usage =
+                &entry->runs[(entry->next + HISTORY_RUNS - entry->runs_size + j) % HISTORY_RUNS];
+            fprintf(file, "%.3f %.3f %ld\t%s\n", usage->wall, usage->cpu, usage->max_rss, entry->command);
+        }
+    }
+
+    bool failed = ferror(file) != 0;
+    failed |= fclose(file) != 0;
+    if (failed || rename(tmp_path, path) != 0)
+    {
+        unlink(tmp_path);
+    }
+    free(tmp_path);
+}
+
+static int compare_double(const void *a, const void *b)
+{
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+// nearest rank of sorted values
+static double percentile(const double *sorted, size_t size, unsigned int percent)
+{
+    size_t rank = (percent * size + 99) / 100;
+    return sorted[rank > 0 ? rank - 1 : 0];
+}
+
+// median wall time of the recent runs, -1 for a command that never ran
+double history_expected(const history_t *history, const char *command)
+{
+    const history_command_t *entry = history_find(history, command);
+    if (entry == NULL || entry->runs_size == 0)
+    {
+        return -1;
+    }
+
+    double wall[HISTORY_RUNS];
+    for (size_t i = 0; i < entry->runs_size; i++)
+    {
+        wall[i] = entry->runs[i].wall;
+    }
+    qsort(wall, entry->runs_size, sizeof(double), compare_double);
+    return percentile(wall, entry->runs_size, 50);
+}
+
+void history_print(const history_t *history, FILE *file)
+{
+    fprintf(file, "%4s %8s %8s %8s %8s %8s %8s  %s\n", "runs", "wall p50", "p95", "max", "cpu p50", "p95",
+            "max rss", "command");
+    for (size_t i = 0; i < history->size; i++)
+    {
+        const history_command_t *entry = &history->commands[i];
+        size_t size = entry->runs_size;
+        double wall[HISTORY_RUNS], cpu[HISTORY_RUNS];
+        long max_rss = 0;
+        for (size_t j = 0; j < size; j++)
+        {
+            wall[j] = entry->runs[j].wall;
+            cpu[j] = entry->runs[j].cpu;
+            if (entry->runs[j].max_rss > max_rss)
+            {
+                max_rss = entry->runs[j].max_rss;
+            }
+        }
+        qsort(wall, size, sizeof(double), compare_double);
+        qsort(cpu, size, sizeof(double), compare_double);
+
+        fprintf(file, "%4zu %7.2fs %7.2fs %7.2fs %7.2fs %7.2fs %6.1fM  %s\n", size, percentile(wall, size, 50),
+                percentile(wall, size, 95), wall[size - 1], percentile(cpu, size, 50), percentile(cpu, size, 95),
+                (double)max_rss / 1024, entry->command);
+    }
+}
+
+void history_free(history_t *history)
+{
+    for (size_t i = 0; i < history->size; i++)
+    {
+        free(history->commands[i].command);
+    }
+    free(history->commands);
+    *history = (history_t){0};
+}
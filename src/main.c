@@ -1,8 +1,10 @@
 #include <fcntl.h>
+#include <float.h>
 #include <getopt.h>
 #include <libgen.h>
 #include <pthread.h>
 #include <regex.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -10,35 +12,185 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <time.h>
 #include <unistd.h>
 
+#include "capture.h"
 #include "color.h"
 #include "config.h"
+#include "history.h"
+#include "memo.h"
+#include "metrics.h"
+#include "notify.h"
+#include "palette_file.h"
+#include "pool.h"
+#include "process.h"
 #include "project_vars.h"
+#include "quantize.h"
+#include "request.h"
+#include "supervisor.h"
+#include "terminal.h"
+#include "theme.h"
+#include "thumbnail.h"
 #include "util.h"
 #include "vector.h"
 
+// everything run_pipeline generates, reload commands wait on these by name
+typedef struct
+{
+    const char *name;
+    void (*native)(config_t); // either a built-in generator or a generating command
+    const command_t *command;
+    bool done;
+} generator_t;
+
+typedef struct
+{
+    config_t config;
+    generator_t *generators;
+    size_t generators_size;
+    pthread_mutex_t lock;
+    pthread_cond_t finished;
+} pipeline_t;
+
+typedef struct
+{
+    size_t index; // into generating_commands
+    double expected; // median seconds of its recent runs, DBL_MAX when it never ran
+} scheduled_command_t;
+
+// async generating commands, the longest expected first so no long one starts last
+typedef struct
+{
+    config_t config;
+    scheduled_command_t *commands;
+    size_t size;
+    pipeline_t *pipeline;   // told about every finished command, NULL outside the pipeline
+    size_t pipeline_offset; // where the generating commands start in pipeline->generators
+} schedule_t;
+
+typedef struct
+{
+    config_t config;
+    void (*native)(config_t);
+} native_job_t;
+
+typedef struct
+{
+    pipeline_t *pipeline;
+    size_t index;
+} pipeline_job_t;
+
 static vector_t *parse_colors(const char *);
-static vector_t *get_colors(const char *, bool);
+static vector_t *get_colors(config_t);
+static vector_t *adjust_colors(const vector_t *, const color_ops_t *);
 static void create_cache_file(const char *, vector_t *, const char *, void (*)(FILE *, vector_t *, void *), void *);
 static void generate_colors_oomox(FILE *, vector_t *, void *);
 static void generate_colors_xresources(FILE *, vector_t *, void *);
 static void generate_colors(FILE *, vector_t *, void *);
 static void generate_colors_json(FILE *, vector_t *, void *);
-static void *pthread_generate_wrapper(void *);
+static void generate_colors_scss(FILE *, vector_t *, void *);
+static void generate_colors_kitty_conf(FILE *, vector_t *, void *);
+static void generate_colors_sequences(FILE *, vector_t *, void *);
+static void run_generating_command(const char *, const command_t *);
+static void record_command_run(const char *, const char *, const command_t *, int, const command_usage_t *);
+static void exit_on_command_failure(void);
+static int compare_scheduled_commands(const void *, const void *);
+static void schedule_async_commands(config_t, schedule_t *);
+static void schedule_worker(size_t, void *);
+static void write_cache_files(const char *, vector_t *, const char *);
+static void activate_variant(config_t, const char *);
+static void publish_palette(config_t, const char *, bool);
+static void generate_native_theme(config_t);
+static void generate_native_icons(config_t);
+static void report_theme_stats(const char *, const theme_stats_t *);
+static void *native_worker(void *);
+static void run_native_generator(config_t, void (*)(config_t));
+static void generate_palettes(config_t);
+static void run_generating_commands(config_t);
 static void generate_themes(config_t config);
+static bool pipeline_ready(pipeline_t *, const command_t *);
+static void pipeline_finish(pipeline_t *, size_t);
+static void *pipeline_native_worker(void *);
+static void *pipeline_chain_worker(void *);
+static void run_pipeline(config_t, ready_mark_t *);
+static void run_reload_command(config_t, const command_t *, ready_mark_t *);
+static void wait_until_ready(config_t, const ready_mark_t *);
+static void recolor_terminals(config_t);
 static void wal_compatibility_helper(config_t, const char *, const char *);
+static void restart_command(config_t, const command_t *);
 static void print_usage(const char *);
 
-static vector_t *get_colors(const char *image_path, bool dark)
+static const struct
+{
+    const char *name;
+    void (*callback)(FILE *, vector_t *, void *);
+    bool needs_image;
+} cache_files[] = {
+    {"colors-oomox", generate_colors_oomox, false},
+    {"colors.Xresources", generate_colors_xresources, false},
+    {"colors", generate_colors, false},
+    {"colors.json", generate_colors_json, true},
+    {"colors.scss", generate_colors_scss, true},
+    {"colors-kitty.conf", generate_colors_kitty_conf, false},
+    {"sequences", generate_colors_sequences, false},
+};
+
+// every variant is written to cache_path/<name>, the active one is linked into cache_path
+static const struct
 {
-    // call imagemagick
-    char *output = safe_malloc(BUFSIZ);
-    exec_command_format(false, output, BUFSIZ, "magick %s -resize 25%% -colors 16 -unique-colors txt:-", image_path);
+    const char *name;
+    bool dark;
+} variants[] = {
+    {"dark", true},
+    {"light", false},
+};
 
-    // get colors array
-    vector_t *parsed_colors = parse_colors(output);
-    free(output);
+// set by whichever thread ran a failed command that does not ignore errors, only the main thread exits on it
+static atomic_bool command_failed;
+
+static vector_t *get_colors(config_t config)
+{
+    // the image is decoded only once, later extractions start from the raw thumbnail pixels
+    thumbnail_t thumbnail;
+    if (!thumbnail_get(config.cache_path, config.image_path, &thumbnail))
+    {
+        request_checkpoint();
+    }
+
+    vector_t *parsed_colors;
+    if (config.quantizer == QUANTIZER_KMEANS)
+    {
+        RGB palette[PALETTE_SIZE];
+        size_t palette_size = quantize_kmeans(thumbnail.pixels, (size_t)thumbnail.width * thumbnail.height,
+                                              config.quantizer_color_space, palette, PALETTE_SIZE);
+        parsed_colors = vector_init(sizeof(RGB));
+        for (size_t i = 0; i < palette_size; i++)
+        {
+            RGB *color = safe_malloc(sizeof(RGB));
+            *color = palette[i];
+            vector_insert(parsed_colors, color);
+        }
+    }
+    else
+    {
+        // call imagemagick
+        char *output = safe_malloc(BUFSIZ);
+        exec_command_format(false, output, BUFSIZ,
+                            "magick -size %ux%u+%zu -depth 8 rgb:%s -colors 16 -unique-colors txt:-", thumbnail.width,
+                            thumbnail.height, sizeof(thumbnail_header_t), thumbnail.path);
+        request_checkpoint();
+
+        // get colors array
+        parsed_colors = parse_colors(output);
+        free(output);
+    }
+    thumbnail_free(&thumbnail);
+
+    if (parsed_colors->size != PALETTE_SIZE)
+    {
+        die("Error: expected %d colors, the image only has %zu", PALETTE_SIZE, parsed_colors->size);
+    }
 
     // fuckery to rearrange the colors
     for (size_t i = 1; i < parsed_colors->size; i++)
@@ -53,43 +205,28 @@ static vector_t *get_colors(const char *image_path, bool dark)
         vector_set(parsed_colors, i, tmp_color);
     }
 
-    // adjut colors
-    if (!dark)
-    {
-        for (size_t i = 0; i < parsed_colors->size; i++)
-        {
-            lighten_color((RGB *)(parsed_colors->items[i]), 0.5);
-        }
-
-        // TODO: make better
-        RGB *tmp_color_last_1 = safe_malloc(sizeof(RGB));
-        RGB *tmp_color_last_2 = safe_malloc(sizeof(RGB));
-        memcpy(tmp_color_last_1, parsed_colors->items[parsed_colors->size - 1], sizeof(RGB));
-        memcpy(tmp_color_last_2, parsed_colors->items[parsed_colors->size - 1], sizeof(RGB));
-        lighten_color(tmp_color_last_1, 0.85);
-        darken_color(tmp_color_last_2, 0.4);
-
-        RGB *tmp_color_0_1 = safe_malloc(sizeof(RGB));
-        RGB *tmp_color_0_2 = safe_malloc(sizeof(RGB));
-        memcpy(tmp_color_0_1, parsed_colors->items[0], sizeof(RGB));
-        memcpy(tmp_color_0_2, parsed_colors->items[0], sizeof(RGB));
-
-        vector_set(parsed_colors, 0, tmp_color_last_1);
-        vector_set(parsed_colors, 7, tmp_color_0_1);
-        vector_set(parsed_colors, 8, tmp_color_last_2);
-        vector_set(parsed_colors, 15, tmp_color_0_2);
+    return parsed_colors;
+}
 
-        return parsed_colors;
+static vector_t *adjust_colors(const vector_t *colors, const color_ops_t *palette)
+{
+    // the extracted palette is shared by all variants, every slot is adjusted in one pass on the stack
+    RGB base[PALETTE_SIZE];
+    RGB adjusted[PALETTE_SIZE];
+    for (size_t i = 0; i < PALETTE_SIZE; i++)
+    {
+        base[i] = *(RGB *)colors->items[i];
     }
 
-    RGB *blend = from_hex_string_to_RGB("#EEEEEE");
-
-    darken_color((RGB *)(parsed_colors->items[0]), 0.4);
-    blend_color((RGB *)(parsed_colors->items[7]), blend);
-    darken_color((RGB *)(parsed_colors->items[8]), 0.3);
-    blend_color((RGB *)(parsed_colors->items[15]), blend);
+    apply_color_ops(base, adjusted, PALETTE_SIZE, palette->ops, palette->size);
 
-    free(blend);
+    vector_t *parsed_colors = vector_init(sizeof(RGB));
+    for (size_t i = 0; i < PALETTE_SIZE; i++)
+    {
+        RGB *color = safe_malloc(sizeof(RGB));
+        *color = adjusted[i];
+        vector_insert(parsed_colors, color);
+    }
 
     return parsed_colors;
 }
@@ -434,55 +571,618 @@ static void generate_colors_kitty_conf(FILE *file, vector_t *colors, void *userd
             color4, color5, color6, color7);
 }
 
-static void *pthread_generate_wrapper(void *arg)
+static void generate_colors_sequences(FILE *file, vector_t *colors, void *userdata)
+{
+    // OSC 4 for the 16 colors like in the kitty config, then OSC 10/11/12 for foreground, background and cursor
+    for (int i = 0; i < 16; i++)
+    {
+        fprintf(file, "\033]4;%d;%s\033\\", i, (char *)colors->items[i < 9 ? i : i - 8]);
+    }
+    fprintf(file, "\033]10;%s\033\\", (char *)colors->items[7]);
+    fprintf(file, "\033]11;%s\033\\", (char *)colors->items[0]);
+    fprintf(file, "\033]12;%s\033\\", (char *)colors->items[7]);
+}
+
+static void run_generating_command(const char *cache_path, const command_t *command)
+{
+    // after a failure the run only waits for the commands already started
+    if (atomic_load(&command_failed))
+    {
+        return;
+    }
+
+    // like make: skip it while its inputs are unchanged and its outputs intact
+    uint64_t key;
+    if (command->has_inputs)
+    {
+        char *label = metrics_label("cache", "memo");
+        bool fresh = memo_fresh(cache_path, command, &key);
+        metrics_add(fresh ? "theming_cache_hits_total" : "theming_cache_misses_total", label, 1);
+        free(label);
+        if (fresh)
+        {
+            printf("%s: up to date\n", command->command);
+            return;
+        }
+    }
+
+    command_usage_t usage;
+    int status = exec_command_priority(command->command, true, &command->priority, &usage);
+    if (status == COMMAND_CANCELLED)
+    {
+        // its outputs may be half written, it is neither counted nor remembered
+        return;
+    }
+    record_command_run(cache_path, "generate", command, status, &usage);
+    if (command->has_inputs && status == 0)
+    {
+        memo_store(cache_path, command, key);
+    }
+}
+
+// a failure is counted before it ends the run, exec_command already said what failed
+static void record_command_run(const char *cache_path, const char *kind, const command_t *command, int status,
+                               const command_usage_t *usage)
+{
+    history_record(cache_path, command->command, usage);
+
+    char *kind_label = metrics_label("kind", kind);
+    char *command_label = metrics_label("command", command->name != NULL ? command->name : command->command);
+    char *labels = format_string("%s,%s", kind_label, command_label);
+    metrics_observe("theming_command_duration_seconds", labels, usage->wall);
+    if (status != 0)
+    {
+        metrics_add("theming_command_failures_total", labels, 1);
+    }
+    free(labels);
+    free(command_label);
+    free(kind_label);
+
+    if (status != 0 && !command->ignore_error)
+    {
+        atomic_store(&command_failed, true);
+    }
+}
+
+static void exit_on_command_failure(void)
+{
+    if (atomic_load(&command_failed))
+    {
+        exit(EXIT_FAILURE);
+    }
+}
+
+static int compare_scheduled_commands(const void *a, const void *b)
+{
+    const scheduled_command_t *x = a;
+    const scheduled_command_t *y = b;
+    if (x->expected != y->expected)
+    {
+        return x->expected < y->expected ? 1 : -1;
+    }
+    return (x->index > y->index) - (x->index < y->index);
+}
+
+static void schedule_async_commands(config_t config, schedule_t *schedule)
 {
-    command_t *command = (command_t *)arg;
+    history_t history;
+    history_load(config.cache_path, &history);
 
-    exec_command(command->command, command->ignore_error, NULL, 0);
+    schedule->config = config;
+    schedule->commands = safe_calloc(config.generating_commands_size + 1, sizeof(scheduled_command_t));
+    schedule->size = 0;
+    for (size_t i = 0; i < config.generating_commands_size; i++)
+    {
+        if (config.generating_commands[i].async)
+        {
+            // nothing known about it, it could be the long one
+            double expected = history_expected(&history, config.generating_commands[i].command);
+            schedule->commands[schedule->size++] =
+                (scheduled_command_t){.index = i, .expected = expected < 0 ? DBL_MAX : expected};
+        }
+    }
+    qsort(schedule->commands, schedule->size, sizeof(scheduled_command_t), compare_scheduled_commands);
+
+    history_free(&history);
+}
+
+static void schedule_worker(size_t i, void *userdata)
+{
+    schedule_t *schedule = userdata;
+    size_t index = schedule->commands[i].index;
+
+    run_generating_command(schedule->config.cache_path, &schedule->config.generating_commands[index]);
+    if (schedule->pipeline != NULL)
+    {
+        pipeline_finish(schedule->pipeline, schedule->pipeline_offset + index);
+    }
+}
+
+static void write_cache_files(const char *path, vector_t *colors, const char *image_path)
+{
+    mkdir_p(path);
+
+    for (size_t i = 0; i < sizeof(cache_files) / sizeof(cache_files[0]); i++)
+    {
+        create_cache_file(cache_files[i].name, colors, path, cache_files[i].callback,
+                          cache_files[i].needs_image ? (void *)image_path : NULL);
+    }
+}
+
+static void activate_variant(config_t config, const char *variant)
+{
+    bool known = false;
+    for (size_t i = 0; i < sizeof(variants) / sizeof(variants[0]); i++)
+    {
+        known |= strcmp(variants[i].name, variant) == 0;
+    }
+    if (!known)
+    {
+        die("Error: unknown variant %s", variant);
+    }
+
+    char *variant_path = format_string("%s/%s", config.cache_path, variant);
+    if (check_directory(variant_path) != 0)
+    {
+        die("Error: variant %s has not been generated. Generate theme first.", variant);
+    }
+    free(variant_path);
+
+    // point the files in cache_path to the variant, replacing each atomically
+    for (size_t i = 0; i < sizeof(cache_files) / sizeof(cache_files[0]); i++)
+    {
+        char *target = format_string("%s/%s", variant, cache_files[i].name);
+        char *link_path = format_string("%s/%s", config.cache_path, cache_files[i].name);
+        char *tmp_path = format_string("%s.tmp", link_path);
+
+        unlink(tmp_path);
+        if (symlink(target, tmp_path) == -1)
+        {
+            die("symlink failed:");
+        }
+        if (rename(tmp_path, link_path) == -1)
+        {
+            die("rename failed:");
+        }
+
+        free(target);
+        free(link_path);
+        free(tmp_path);
+    }
+
+    bool dark = false;
+    for (size_t i = 0; i < sizeof(variants) / sizeof(variants[0]); i++)
+    {
+        dark |= strcmp(variants[i].name, variant) == 0 && variants[i].dark;
+    }
+    publish_palette(config, variant, dark);
+}
+
+static void publish_palette(config_t config, const char *variant, bool dark)
+{
+    char *colors_path = format_string("%s/%s/colors", config.cache_path, variant);
+    FILE *file = fopen(colors_path, "r");
+    if (file == NULL)
+    {
+        die("fopen failed for %s:", colors_path);
+    }
+    char text[BUFSIZ];
+    text[fread(text, 1, sizeof(text) - 1, file)] = '\0';
+    fclose(file);
+    free(colors_path);
+
+    vector_t *colors = parse_colors(text);
+    if (colors->size != PALETTE_SIZE)
+    {
+        die("Error: expected %d colors in variant %s, found %zu", PALETTE_SIZE, variant, colors->size);
+    }
+    RGB palette[PALETTE_SIZE];
+    for (size_t i = 0; i < PALETTE_SIZE; i++)
+    {
+        palette[i] = *(RGB *)colors->items[i];
+    }
+    vector_free(colors);
+
+    // programs mapping palette.bin see the switch without parsing or a reload command
+    char *palette_path = format_string("%s/palette.bin", config.cache_path);
+    palette_file_publish(palette_path, palette, dark);
+    free(palette_path);
+
+    // and the daemon pushes it to its subscribers
+    supervisor_request(config, "palette", NULL);
+}
+
+static void generate_native_theme(config_t config)
+{
+    if (config.theme_skeleton_path == NULL)
+    {
+        return;
+    }
+
+    // the skeleton gets the same colors oomox would read
+    char *colors_path = format_string("%s/colors-oomox", config.cache_path);
+    char *manifest_path = format_string("%s/theme.manifest", config.cache_path);
+    theme_stats_t stats;
+    theme_generate(config.theme_skeleton_path, config.theme_path, config.oomox_theme_name, colors_path, manifest_path,
+                   &stats);
+    report_theme_stats("theme", &stats);
+    free(manifest_path);
+    free(colors_path);
+}
+
+static void generate_native_icons(config_t config)
+{
+    if (config.icon_source_path == NULL)
+    {
+        return;
+    }
+
+    char *colors_path = format_string("%s/colors-oomox", config.cache_path);
+    char *manifest_path = format_string("%s/icons.manifest", config.cache_path);
+    theme_stats_t stats;
+    theme_generate_icons(config.icon_source_path, config.icon_theme_path, config.oomox_icon_theme_name, colors_path,
+                         config.icon_color_sources, config.icon_color_keys, config.icon_color_map_size, manifest_path,
+                         &stats);
+    report_theme_stats("icons", &stats);
+    free(manifest_path);
+    free(colors_path);
+}
+
+static void report_theme_stats(const char *name, const theme_stats_t *stats)
+{
+    double seconds = stats->seconds > 0 ? stats->seconds : 1e-9;
+    printf("%s: %zu files, %zu rewritten in %.3fs (%.0f files/s, %.1f MB/s)\n", name, stats->files, stats->written,
+           stats->seconds, (double)stats->files / seconds, (double)stats->bytes / seconds / 1e6);
+
+    // files the manifest showed to be up to date are hits
+    char *label = metrics_label("cache", name);
+    metrics_add("theming_cache_hits_total", label, (double)(stats->files - stats->written));
+    metrics_add("theming_cache_misses_total", label, (double)stats->written);
+    free(label);
+    label = metrics_label("target", name);
+    metrics_add("theming_bytes_written_total", label, (double)stats->bytes);
+    free(label);
+}
+
+static void *native_worker(void *arg)
+{
+    native_job_t *job = arg;
+
+    // the priority stays with this thread and the pool threads it starts
+    priority_apply(&job->config.generating_priority, NULL);
+    job->native(job->config);
 
     return NULL;
 }
 
-static void generate_themes(config_t config)
+static void run_native_generator(config_t config, void (*native)(config_t))
 {
-    vector_t *vec = get_colors(config.image_path, true);
+    // in a thread of its own, so the main thread keeps its priority for reloading
+    native_job_t job = {.config = config, .native = native};
+    pthread_t thread;
+    pthread_create(&thread, NULL, native_worker, &job);
+    pthread_join(thread, NULL);
+}
+
+static void generate_palettes(config_t config)
+{
+    // extract once, every variant is derived from the same palette
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    vector_t *colors = get_colors(config);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    char *label = metrics_label("quantizer", config.quantizer == QUANTIZER_KMEANS ? "kmeans" : "magick");
+    metrics_observe("theming_extraction_seconds", label,
+                    (double)(end.tv_sec - start.tv_sec) + (double)(end.tv_nsec - start.tv_nsec) / 1e9);
+    free(label);
+
+    // staged first, so a cancelled run never leaves a half written palette behind
+    char *staging_path = format_string("%s/staging", config.cache_path);
+    rmrf(staging_path);
+
+    for (size_t i = 0; i < sizeof(variants) / sizeof(variants[0]); i++)
+    {
+        vector_t *vec = adjust_colors(colors, variants[i].dark ? &config.dark_palette : &config.light_palette);
+        char *variant_path = format_string("%s/%s", staging_path, variants[i].name);
+
+        // generate needed files
+        write_cache_files(variant_path, vec, config.image_path);
 
-    // generate needed files
-    create_cache_file("colors-oomox", vec, config.cache_path, generate_colors_oomox, NULL);
-    create_cache_file("colors.Xresources", vec, config.cache_path, generate_colors_xresources, NULL);
-    create_cache_file("colors", vec, config.cache_path, generate_colors, NULL);
-    create_cache_file("colors.json", vec, config.cache_path, generate_colors_json, config.image_path);
-    create_cache_file("colors.scss", vec, config.cache_path, generate_colors_scss, config.image_path);
-    create_cache_file("colors-kitty.conf", vec, config.cache_path, generate_colors_kitty_conf, NULL);
+        free(variant_path);
+        vector_free(vec);
+    }
+
+    vector_free(colors);
+
+    request_checkpoint();
+    for (size_t i = 0; i < sizeof(variants) / sizeof(variants[0]); i++)
+    {
+        char *tmp_path = format_string("%s/%s", staging_path, variants[i].name);
+        char *variant_path = format_string("%s/%s", config.cache_path, variants[i].name);
+        replace_directory(tmp_path, variant_path);
+        free(variant_path);
+        free(tmp_path);
+    }
+    rmrf(staging_path);
+    free(staging_path);
 
-    vector_free(vec);
+    activate_variant(config, config.variant);
+}
+
+static void generate_themes(config_t config)
+{
+    generate_palettes(config);
 
     // generate theme stuff
+    request_checkpoint();
+    run_native_generator(config, generate_native_theme);
+    request_checkpoint();
+    run_native_generator(config, generate_native_icons);
+
+    run_generating_commands(config);
+}
 
+static void run_generating_commands(config_t config)
+{
     // exec sync commands
     for (size_t i = 0; i < config.generating_commands_size; i++)
     {
         if (!config.generating_commands[i].async)
         {
-            exec_command(config.generating_commands[i].command, config.generating_commands[i].ignore_error, NULL, 0);
+            run_generating_command(config.cache_path, &config.generating_commands[i]);
+            exit_on_command_failure();
         }
     }
 
-    // exec async commands
-    size_t thread_count = config.generating_commands_size;
-    pthread_t t[thread_count];
+    // exec async commands, max_jobs at a time
+    schedule_t schedule = {0};
+    schedule_async_commands(config, &schedule);
+    parallel_for_workers(config.max_jobs, schedule.size, schedule_worker, &schedule);
+    free(schedule.commands);
+    request_checkpoint();
+    exit_on_command_failure();
+}
 
-    for (size_t i = 0; i < thread_count; i++)
+static bool pipeline_ready(pipeline_t *pipeline, const command_t *command)
+{
+    for (size_t i = 0; i < pipeline->generators_size; i++)
     {
-        if (config.generating_commands[i].async)
+        const generator_t *generator = &pipeline->generators[i];
+        if (generator->done)
+        {
+            continue;
+        }
+        if (!command->has_depends_on)
+        {
+            return false;
+        }
+        for (size_t j = 0; j < command->depends_on_size; j++)
+        {
+            if (generator->name != NULL && strcmp(generator->name, command->depends_on[j]) == 0)
+            {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+static void pipeline_finish(pipeline_t *pipeline, size_t index)
+{
+    pthread_mutex_lock(&pipeline->lock);
+    pipeline->generators[index].done = true;
+    pthread_cond_broadcast(&pipeline->finished);
+    pthread_mutex_unlock(&pipeline->lock);
+}
+
+static void *pipeline_native_worker(void *arg)
+{
+    pipeline_job_t *job = arg;
+    priority_apply(&job->pipeline->config.generating_priority, NULL);
+    job->pipeline->generators[job->index].native(job->pipeline->config);
+    pipeline_finish(job->pipeline, job->index);
+    return NULL;
+}
+
+static void *pipeline_chain_worker(void *arg)
+{
+    pipeline_t *pipeline = arg;
+
+    // like without the pipeline: sync commands one after another, then the async ones max_jobs at a time
+    for (size_t i = 0; i < pipeline->generators_size; i++)
+    {
+        const command_t *command = pipeline->generators[i].command;
+        if (command != NULL && !command->async)
+        {
+            run_generating_command(pipeline->config.cache_path, command);
+            pipeline_finish(pipeline, i);
+        }
+    }
+
+    schedule_t schedule = {
+        .pipeline = pipeline,
+        .pipeline_offset = pipeline->generators_size - pipeline->config.generating_commands_size,
+    };
+    schedule_async_commands(pipeline->config, &schedule);
+    parallel_for_workers(pipeline->config.max_jobs, schedule.size, schedule_worker, &schedule);
+    free(schedule.commands);
+
+    return NULL;
+}
+
+static void run_pipeline(config_t config, ready_mark_t *reload_marks)
+{
+    pipeline_t pipeline = {
+        .config = config,
+        .generators = safe_calloc(config.generating_commands_size + 2, sizeof(generator_t)),
+    };
+    pthread_mutex_init(&pipeline.lock, NULL);
+    pthread_cond_init(&pipeline.finished, NULL);
+
+    if (config.theme_skeleton_path != NULL)
+    {
+        pipeline.generators[pipeline.generators_size++] = (generator_t){.name = "theme", .native = generate_native_theme};
+    }
+    if (config.icon_source_path != NULL)
+    {
+        pipeline.generators[pipeline.generators_size++] = (generator_t){.name = "icons", .native = generate_native_icons};
+    }
+    for (size_t i = 0; i < config.generating_commands_size; i++)
+    {
+        pipeline.generators[pipeline.generators_size++] =
+            (generator_t){.name = config.generating_commands[i].name, .command = &config.generating_commands[i]};
+    }
+
+    // dependencies have to name something that is generated, cache files count as always ready
+    for (size_t i = 0; i < config.reload_commands_size; i++)
+    {
+        const command_t *command = &config.reload_commands[i];
+        for (size_t j = 0; j < command->depends_on_size; j++)
+        {
+            bool known = false;
+            for (size_t k = 0; k < sizeof(cache_files) / sizeof(cache_files[0]); k++)
+                known |= strcmp(cache_files[k].name, command->depends_on[j]) == 0;
+            for (size_t k = 0; k < pipeline.generators_size; k++)
+                known |= pipeline.generators[k].name != NULL &&
+                         strcmp(pipeline.generators[k].name, command->depends_on[j]) == 0;
+            if (!known)
+            {
+                die("Error: %s depends on unknown %s", command->command, command->depends_on[j]);
+            }
+        }
+    }
+
+    // the cache files are the cheap part, they are ready before anything else starts
+    generate_palettes(config);
+    recolor_terminals(config);
+
+    pthread_t native_threads[2];
+    pipeline_job_t native_jobs[2];
+    size_t native_threads_size = 0;
+    for (size_t i = 0; i < pipeline.generators_size; i++)
+    {
+        if (pipeline.generators[i].native != NULL)
+        {
+            native_jobs[native_threads_size] = (pipeline_job_t){.pipeline = &pipeline, .index = i};
+            pthread_create(&native_threads[native_threads_size], NULL, pipeline_native_worker,
+                           &native_jobs[native_threads_size]);
+            native_threads_size++;
+        }
+    }
+    pthread_t chain_thread;
+    pthread_create(&chain_thread, NULL, pipeline_chain_worker, &pipeline);
+
+    // reload commands keep their order, except that one waiting for its inputs lets later ready ones pass
+    size_t remaining = config.reload_commands_size;
+    bool ran[config.reload_commands_size + 1];
+    memset(ran, 0, sizeof(ran));
+    pthread_mutex_lock(&pipeline.lock);
+    while (remaining > 0 && !commands_cancelled() && !atomic_load(&command_failed))
+    {
+        size_t next = 0;
+        while (next < config.reload_commands_size &&
+               (ran[next] || !pipeline_ready(&pipeline, &config.reload_commands[next])))
+        {
+            next++;
+        }
+        if (next == config.reload_commands_size)
+        {
+            pthread_cond_wait(&pipeline.finished, &pipeline.lock);
+            continue;
+        }
+
+        ran[next] = true;
+        remaining--;
+        pthread_mutex_unlock(&pipeline.lock);
+        run_reload_command(config, &config.reload_commands[next], &reload_marks[next]);
+        pthread_mutex_lock(&pipeline.lock);
+    }
+    pthread_mutex_unlock(&pipeline.lock);
+
+    pthread_join(chain_thread, NULL);
+    for (size_t i = 0; i < native_threads_size; i++)
+    {
+        pthread_join(native_threads[i], NULL);
+    }
+
+    pthread_cond_destroy(&pipeline.finished);
+    pthread_mutex_destroy(&pipeline.lock);
+    free(pipeline.generators);
+
+    // a cancelled or failed run ends once the generators stopped
+    request_checkpoint();
+    exit_on_command_failure();
+}
+
+static void run_reload_command(config_t config, const command_t *command, ready_mark_t *mark)
+{
+    // a newer run reloads with its own colors
+    if (commands_cancelled())
+    {
+        return;
+    }
+
+    // its ready condition is only met by what happened since now, in pipeline mode that may be long after the start
+    ready_mark(mark);
+
+    if (command->restart)
+    {
+        // only this one, in pipeline mode the others may still wait for their inputs
+        char *request = format_string("reload %s", command->command);
+        bool supervised = supervisor_request(config, request, NULL);
+        free(request);
+        if (!supervised)
         {
-            pthread_create(&t[i], NULL, pthread_generate_wrapper, &config.generating_commands[i]);
+            restart_command(config, command);
         }
+        return;
     }
 
-    for (size_t i = 0; i < thread_count; i++)
+    command_usage_t usage;
+    int status = exec_command_priority(command->command, true, &command->priority, &usage);
+    if (status != COMMAND_CANCELLED)
     {
-        pthread_join(t[i], NULL);
+        record_command_run(config.cache_path, "reload", command, status, &usage);
+    }
+}
+
+static void wait_until_ready(config_t config, const ready_mark_t *marks)
+{
+    // every timeout counts from the reload of its command, waiting one after another does not add them up
+    for (size_t i = 0; i < config.reload_commands_size; i++)
+    {
+        const command_t *command = &config.reload_commands[i];
+        if (command->ready.type != READY_NONE && !ready_wait(&command->ready, &marks[i]))
+        {
+            fprintf(stderr, "%s: not ready after %.1fs\n", command->command, command->ready.timeout_ms / 1000.0);
+        }
+    }
+}
+
+static void recolor_terminals(config_t config)
+{
+    if (!config.recolor_terminals)
+    {
+        return;
+    }
+
+    char *path = format_string("%s/sequences", config.cache_path);
+    FILE *file = fopen(path, "r");
+    if (file == NULL)
+    {
+        die("fopen failed for %s:", path);
+    }
+    char sequences[4096];
+    size_t size = fread(sequences, 1, sizeof(sequences), file);
+    fclose(file);
+    free(path);
+
+    terminal_stats_t stats;
+    terminal_broadcast(sequences, size, &stats);
+    if (stats.skipped > 0)
+    {
+        fprintf(stderr, "terminals: %zu of %zu did not take the colors in time\n", stats.skipped, stats.terminals);
     }
 }
 
@@ -495,9 +1195,20 @@ static void wal_compatibility_helper(config_t config, const char *wal_cache_path
     free(colors_path_to);
 }
 
+static void restart_command(config_t config, const command_t *command)
+{
+    char *state_path = format_string("%s/pids", config.cache_path);
+
+    process_terminate_command(state_path, command->command, command->process_name);
+
+    pid_t pid = exec_command_and_disown(command->command, &command->priority);
+    process_tracked_store(state_path, command->command, pid);
+    free(state_path);
+}
+
 static void print_usage(const char *program_name)
 {
-    printf("Usage: %s [-vhi:rwf] [<image_path>]\n", program_name);
+    printf("Usage: %s [-vhi:rwfdst:S] [<image_path>]\n", program_name);
     printf("Options:\n");
     printf("  -v, --version\t\t\tShow version\n");
     printf("  -h, --help\t\t\tShow this help message\n");
@@ -505,17 +1216,25 @@ static void print_usage(const char *program_name)
     printf("  -r, --reload\t\t\tReload theme\n");
     printf("  -w, --wal\t\t\tGenerate pywal .cache file to make generated theme compatible.\n");
     printf("  -f, --initial\t\t\tRun reload_commands marked initial\n");
+    printf("  -d, --daemon\t\t\tSupervise restart reload_commands in the foreground\n");
+    printf("  -s, --status\t\t\tShow the state of commands supervised by the daemon\n");
+    printf("  -t, --variant <variant>\tUse the dark or light palette (switches without -i)\n");
+    printf("  -S, --stats\t\t\tShow how long commands took in recent runs\n");
 }
 
 int main(int argc, char *argv[])
 {
     static struct option long_options[] = {
-        {"version", no_argument, 0, 0},
-        {"help", no_argument, 0, 0},
-        {"image", required_argument, 0, 0},
-        {"reload", no_argument, 0, 0},
-        {"wal", no_argument, 0, 0},
-        {"initial", no_argument, 0, 0},
+        {"version", no_argument, 0, 'v'},
+        {"help", no_argument, 0, 'h'},
+        {"image", required_argument, 0, 'i'},
+        {"reload", no_argument, 0, 'r'},
+        {"wal", no_argument, 0, 'w'},
+        {"initial", no_argument, 0, 'f'},
+        {"daemon", no_argument, 0, 'd'},
+        {"status", no_argument, 0, 's'},
+        {"variant", required_argument, 0, 't'},
+        {"stats", no_argument, 0, 'S'},
         {0, 0, 0, 0},
     };
 
@@ -524,9 +1243,14 @@ int main(int argc, char *argv[])
     bool reload = false;
     bool wal_comp = false;
     bool initial = false;
+    bool daemon = false;
+    bool status = false;
+    bool stats = false;
+    bool pipelined = false;
+    char *variant = NULL;
 
     int c;
-    while ((c = getopt_long(argc, argv, "vhi:rwf", long_options, NULL)) != -1)
+    while ((c = getopt_long(argc, argv, "vhi:rwfdst:S", long_options, NULL)) != -1)
     {
         switch (c)
         {
@@ -549,6 +1273,18 @@ int main(int argc, char *argv[])
         case 'f':
             initial = true;
             break;
+        case 'd':
+            daemon = true;
+            break;
+        case 's':
+            status = true;
+            break;
+        case 't':
+            variant = optarg;
+            break;
+        case 'S':
+            stats = true;
+            break;
         default:
             return EXIT_FAILURE;
         }
@@ -573,16 +1309,49 @@ int main(int argc, char *argv[])
 
     config_t config;
     config_init(&config);
+    ready_mark_t reload_marks[config.reload_commands_size + 1];
 
-    // notification
+    char *log_dir = format_string("%s/logs", config.cache_path);
+    capture_start(log_dir);
+    free(log_dir);
+
+    // merged into the textfile when theming exits, whichever way
+    if (config.metrics_path != NULL)
+    {
+        metrics_init(config.metrics_path);
+    }
+
+    if (variant != NULL)
+    {
+        free(config.variant);
+        config.variant = strdup(variant);
+    }
+
+    // commands live in their own process groups, a signal to theming has to take them along
+    if (generate || reload || initial || variant != NULL)
+    {
+        request_handle_signals();
+    }
+
+    // notification, the second one replaces it
+    notifier_t notifier = {.fd = -1};
     if (generate && reload && config.send_notification)
     {
-        exec_command_format(false, NULL, 0, "notify-send -i %s \"Wallpaper Changed\" \"Changing theme...\"", image);
+        notifier_open(&notifier);
+        notifier_send(&notifier, image, "Wallpaper Changed", "Changing theme...");
     }
 
     if (generate)
     {
         mkdir_p(config.cache_path);
+
+        // only the newest of overlapping runs generates, older ones are cancelled
+        if (!request_begin(config.cache_path))
+        {
+            config_free(&config);
+            return EXIT_SUCCESS;
+        }
+
         mkdir_p(config.theme_path);
         mkdir_p(config.icon_theme_path);
 
@@ -594,46 +1363,52 @@ int main(int argc, char *argv[])
         {
             die("Error: image_cache_path is are directory.");
         }
-        if (check_file(config.image_path) == 0)
-        {
-            if (remove(config.image_path) != 0)
-            {
-                die("remove failed:");
-            }
-        }
-        if (cp(config.image_path, image) != 0)
+        if (cp(config.image_path, image, config.image_copy_strategy) < 0)
         {
             die("cp failed:");
         }
 
-        generate_themes(config);
+        // with the pipeline reloading overlaps with generation
+        pipelined = reload && config.pipeline;
+        if (pipelined)
+        {
+            run_pipeline(config, reload_marks);
+        }
+        else
+            generate_themes(config);
     }
-    if (reload)
+    else if (variant != NULL)
+    {
+        // both variants exist already, the cache files are only relinked. whatever is generated from them is
+        // redone, memoized commands whose inputs did not change stay as they are
+        activate_variant(config, config.variant);
+        run_native_generator(config, generate_native_theme);
+        run_native_generator(config, generate_native_icons);
+        run_generating_commands(config);
+    }
+    if (reload && !pipelined)
     {
         if (check_directory(config.cache_path) != 0)
         {
             die("Error: Cache directory does not exist. Generate theme first.");
         }
 
+        recolor_terminals(config);
         for (size_t i = 0; i < config.reload_commands_size; i++)
         {
-            if (config.reload_commands[i].restart)
-            {
-                pid_t pid = find_pid_by_name(config.reload_commands[i].command);
-                if (pid != -1)
-                {
-                    if (kill(pid, SIGTERM) == -1)
-                    {
-                        die("kill failed:");
-                    }
-                }
-
-                exec_command_and_disown(config.reload_commands[i].command);
-                continue;
-            }
-
-            exec_command(config.reload_commands[i].command, config.reload_commands[i].ignore_error, NULL, 0);
+            run_reload_command(config, &config.reload_commands[i], &reload_marks[i]);
+            exit_on_command_failure();
         }
+        request_checkpoint();
+    }
+    if (reload)
+    {
+        wait_until_ready(config, reload_marks);
+    }
+    if (generate || variant != NULL)
+    {
+        metrics_add("theming_switches_total", "", 1);
+        metrics_set("theming_last_switch_timestamp_seconds", "", (double)time(NULL));
     }
     if (wal_comp)
     {
@@ -656,6 +1431,7 @@ int main(int argc, char *argv[])
         wal_compatibility_helper(config, wal_cache_path, "colors-oomox");
         wal_compatibility_helper(config, wal_cache_path, "colors.Xresources");
         wal_compatibility_helper(config, wal_cache_path, "colors.scss");
+        wal_compatibility_helper(config, wal_cache_path, "sequences");
 
         free(wal_cache_path);
     }
@@ -665,17 +1441,39 @@ int main(int argc, char *argv[])
         {
             if (config.reload_commands[i].initial)
             {
-                exec_command(config.reload_commands[i].command, config.reload_commands[i].ignore_error, NULL, 0);
+                exec_command_priority(config.reload_commands[i].command, config.reload_commands[i].ignore_error,
+                                      &config.reload_commands[i].priority, NULL);
             }
         }
+        request_checkpoint();
+    }
+
+    if (status)
+    {
+        if (!supervisor_request(config, "status", stdout))
+        {
+            die("Error: theming daemon is not running");
+        }
+    }
+    if (stats)
+    {
+        history_t history;
+        history_load(config.cache_path, &history);
+        history_print(&history, stdout);
+        history_free(&history);
+    }
+    if (daemon)
+    {
+        mkdir_p(config.cache_path);
+        supervisor_run(config);
     }
 
     // notification
     if (generate && reload && config.send_notification)
     {
-        // tactical sleep to wait for wm to restart. Eternal TODO: remove sleep
-        exec_command_format(false, NULL, 0, "sleep 1 && notify-send -i %s \"Wallpaper Changed\" \"Theme changed\"",
-                            image);
+        // sent once the reload commands report ready
+        notifier_send(&notifier, image, "Wallpaper Changed", "Theme changed");
+        notifier_close(&notifier);
     }
 
     config_free(&config);
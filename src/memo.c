@@ -0,0 +1,176 @@
+#include "memo.h"
+
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "util.h"
+
+static bool memo_fingerprint(const char *, uint64_t *);
+static int memo_compare_entries(const struct dirent **, const struct dirent **);
+static uint64_t memo_fingerprint_tree(const char *, size_t, uint64_t);
+static char *memo_record_path(const char *, const command_t *);
+static uint64_t memo_key(const command_t *);
+
+// hashes a file by content, a directory by the names, sizes and mtimes of everything in it
+static bool memo_fingerprint(const char *path, uint64_t *hash)
+{
+    // the path itself may be a link to the directory, e.g. a theme dir kept elsewhere
+    struct stat st;
+    if (stat(path, &st) == -1)
+    {
+        return false;
+    }
+
+    if (S_ISDIR(st.st_mode))
+    {
+        *hash = memo_fingerprint_tree(path, strlen(path), 0);
+        return true;
+    }
+
+    return hash_file(path, hash) == 0;
+}
+
+static int memo_compare_entries(const struct dirent **a, const struct dirent **b)
+{
+    return strcmp((*a)->d_name, (*b)->d_name);
+}
+
+// folds every entry into seed, depth first in name order, so the same tree always gives the same hash
+static uint64_t memo_fingerprint_tree(const char *path, size_t root_length, uint64_t seed)
+{
+    struct dirent **entries;
+    int entries_size = scandir(path, &entries, NULL, memo_compare_entries);
+    if (entries_size == -1)
+    {
+        return seed;
+    }
+
+    uint64_t hash = seed;
+    for (int i = 0; i < entries_size; i++)
+    {
+        const char *name = entries[i]->d_name;
+        if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0)
+        {
+            free(entries[i]);
+            continue;
+        }
+
+        // links inside the tree are taken as they are, not followed
+        char *entry_path = format_string("%s/%s", path, name);
+        struct stat st;
+        if (lstat(entry_path, &st) == 0)
+        {
+            uint64_t meta[4] = {(uint64_t)st.st_size, (uint64_t)st.st_mtim.tv_sec, (uint64_t)st.st_mtim.tv_nsec,
+                                (uint64_t)st.st_mode};
+            const char *relative_path = entry_path + root_length;
+            hash = hash_bytes(meta, sizeof(meta), hash_bytes(relative_path, strlen(relative_path), hash));
+            if (S_ISDIR(st.st_mode))
+            {
+                hash = memo_fingerprint_tree(entry_path, root_length, hash);
+            }
+        }
+        free(entry_path);
+        free(entries[i]);
+    }
+
+    free(entries);
+    return hash;
+}
+
+static char *memo_record_path(const char *cache_path, const command_t *command)
+{
+    uint64_t id = hash_bytes(command->command, strlen(command->command), 0);
+    return format_string("%s/memo/%016llx", cache_path, (unsigned long long)id);
+}
+
+static uint64_t memo_key(const command_t *command)
+{
+    uint64_t key = hash_bytes(command->command, strlen(command->command), 0);
+    for (size_t i = 0; i < command->inputs_size; i++)
+    {
+        // a missing input is part of the key too, it differs from every existing one
+        uint64_t input = UINT64_MAX;
+        memo_fingerprint(command->inputs[i], &input);
+        key = hash_bytes(&input, sizeof(input), hash_bytes(command->inputs[i], strlen(command->inputs[i]), key));
+    }
+    for (size_t i = 0; i < command->outputs_size; i++)
+    {
+        key = hash_bytes(command->outputs[i], strlen(command->outputs[i]), key);
+    }
+    return key;
+}
+
+bool memo_fresh(const char *cache_path, const command_t *command, uint64_t *key)
+{
+    *key = memo_key(command);
+
+    char *record_path = memo_record_path(cache_path, command);
+    FILE *file = fopen(record_path, "r");
+    free(record_path);
+    if (file == NULL)
+    {
+        return false;
+    }
+
+    // the key of the last successful run, then the hash each output had after it
+    unsigned long long recorded_key;
+    bool fresh = fscanf(file, "key %llx\n", &recorded_key) == 1 && recorded_key == *key;
+    for (size_t i = 0; fresh && i < command->outputs_size; i++)
+    {
+        unsigned long long recorded_hash;
+        uint64_t hash;
+        fresh = fscanf(file, "%llx %*[^\n]\n", &recorded_hash) == 1 && memo_fingerprint(command->outputs[i], &hash) &&
+                hash == recorded_hash;
+    }
+
+    fclose(file);
+    return fresh;
+}
+
+void memo_store(const char *cache_path, const command_t *command, uint64_t key)
+{
+    char *dir = format_string("%s/memo", cache_path);
+    mkdir_p(dir);
+    free(dir);
+
+    char *record_path = memo_record_path(cache_path, command);
+    char *tmp_path = format_string("%s.tmp", record_path);
+    FILE *file = fopen(tmp_path, "w");
+    if (file == NULL)
+    {
+        die("fopen failed for %s:", tmp_path);
+    }
+
+    fprintf(file, "key %016llx\n", (unsigned long long)key);
+    for (size_t i = 0; i < command->outputs_size; i++)
+    {
+        // an output the command did not write is never intact
+        uint64_t hash;
+        if (!memo_fingerprint(command->outputs[i], &hash))
+        {
+            fclose(file);
+            unlink(tmp_path);
+            unlink(record_path);
+            free(tmp_path);
+            free(record_path);
+            return;
+        }
+        fprintf(file, "%016llx %s\n", (unsigned long long)hash, command->outputs[i]);
+    }
+
+    if (ferror(file) || fclose(file) != 0)
+    {
+        die("writing to file %s failed:", tmp_path);
+    }
+    if (rename(tmp_path, record_path) != 0)
+    {
+        die("rename failed:");
+    }
+
+    free(tmp_path);
+    free(record_path);
+}
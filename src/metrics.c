@@ -0,0 +1,333 @@
+#include "metrics.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <unistd.h>
+
+#include "util.h"
+
+typedef enum
+{
+    METRIC_COUNTER,
+    METRIC_GAUGE,
+    METRIC_HISTOGRAM,
+} metric_type_t;
+
+// a line of the textfile, "name{labels} value"
+typedef struct
+{
+    char *key;
+    double value;
+    bool set; // a gauge replaces the value in the file, everything else is added to it
+} metric_series_t;
+
+typedef struct
+{
+    metric_series_t *items;
+    size_t size;
+} metric_table_t;
+
+static void metrics_at_exit(void);
+static metric_series_t *table_find(metric_table_t *, const char *);
+static void table_update(metric_table_t *, const char *, double, bool);
+static void table_free(metric_table_t *);
+static void table_load(metric_table_t *, const char *);
+static bool series_in_family(const char *, const char *, metric_type_t);
+
+static const struct
+{
+    const char *name;
+    metric_type_t type;
+    const char *help;
+} families[] = {
+    {"theming_switches_total", METRIC_COUNTER, "Theme switches, from a new image or to the other variant."},
+    {"theming_last_switch_timestamp_seconds", METRIC_GAUGE, "Unix time of the last theme switch."},
+    {"theming_extraction_seconds", METRIC_HISTOGRAM, "Time to extract the palette from the image."},
+    {"theming_command_duration_seconds", METRIC_HISTOGRAM, "Wall time of generating and reload commands."},
+    {"theming_command_failures_total", METRIC_COUNTER, "Generating and reload commands that exited non-zero."},
+    {"theming_cache_hits_total", METRIC_COUNTER, "Work skipped because its cached result was still valid."},
+    {"theming_cache_misses_total", METRIC_COUNTER, "Work done because nothing valid was cached."},
+    {"theming_bytes_written_total", METRIC_COUNTER, "Bytes written by the built-in theme and icon generators."},
+    {"theming_supervised_crashes_total", METRIC_COUNTER, "Exits of commands supervised by the daemon."},
+    {"theming_subscribers", METRIC_GAUGE, "Programs subscribed to the daemon for palette changes."},
+};
+
+// seconds, from a cache file write to a full oomox run
+static const double buckets[] = {0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10, 30, 60};
+
+// everything counted since the last flush, from any thread
+static struct
+{
+    char *path; // NULL when metrics are off
+    pid_t owner;
+    metric_table_t pending;
+    pthread_mutex_t lock;
+} metrics_state = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+void metrics_init(const char *path)
+{
+    metrics_state.path = strdup(path);
+    metrics_state.owner = getpid();
+    atexit(metrics_at_exit);
+}
+
+// runs that end early, even through die(), still count
+static void metrics_at_exit(void)
+{
+    if (getpid() == metrics_state.owner)
+    {
+        metrics_flush();
+    }
+}
+
+static metric_series_t *table_find(metric_table_t *table, const char *key)
+{
+    for (size_t i = 0; i < table->size; i++)
+    {
+        if (strcmp(table->items[i].key, key) == 0)
+        {
+            return &table->items[i];
+        }
+    }
+
+    return NULL;
+}
+
+static void table_update(metric_table_t *table, const char *key, double value, bool set)
+{
+    metric_series_t *series = table_find(table, key);
+    if (series == NULL)
+    {
+        table->items = safe_realloc(table->items, (table->size + 1) * sizeof(metric_series_t));
+        series = &table->items[table->size++];
+        *series = (metric_series_t){.key = strdup(key), .set = set};
+    }
+
+    series->value = set ? value : series->value + value;
+}
+
+static void table_free(metric_table_t *table)
+{
+    for (size_t i = 0; i < table->size; i++)
+    {
+        free(table->items[i].key);
+    }
+    free(table->items);
+    *table = (metric_table_t){0};
+}
+
+static void table_load(metric_table_t *table, const char *path)
+{
+    FILE *file = fopen(path, "r");
+    if (file == NULL)
+    {
+        return;
+    }
+
+    char *line = NULL;
+    size_t line_size = 0;
+    ssize_t length;
+    while ((length = getline(&line, &line_size, file)) != -1)
+    {
+        if (line[0] == '#' || line[0] == '\n')
+        {
+            continue;
+        }
+
+        // label values may contain spaces, the value never does
+        char *separator = strrchr(line, ' ');
+        if (separator == NULL)
+        {
+            continue;
+        }
+        *separator = '\0';
+        table_update(table, line, strtod(separator + 1, NULL), true);
+    }
+    free(line);
+    fclose(file);
+}
+
+// all of these do nothing until metrics_init
+void metrics_add(const char *name, const char *labels, double delta)
+{
+    char *key = labels[0] != '\0' ? format_string("%s{%s}", name, labels) : strdup(name);
+    pthread_mutex_lock(&metrics_state.lock);
+    if (metrics_state.path != NULL)
+    {
+        table_update(&metrics_state.pending, key, delta, false);
+    }
+    pthread_mutex_unlock(&metrics_state.lock);
+    free(key);
+}
+
+void metrics_set(const char *name, const char *labels, double value)
+{
+    char *key = labels[0] != '\0' ? format_string("%s{%s}", name, labels) : strdup(name);
+    pthread_mutex_lock(&metrics_state.lock);
+    if (metrics_state.path != NULL)
+    {
+        table_update(&metrics_state.pending, key, value, true);
+    }
+    pthread_mutex_unlock(&metrics_state.lock);
+    free(key);
+}
+
+void metrics_observe(const char *name, const char *labels, double value)
+{
+    const char *separator = labels[0] != '\0' ? "," : "";
+
+    // every bucket is written from the first observation on, so they stay in order in the file
+    pthread_mutex_lock(&metrics_state.lock);
+    if (metrics_state.path == NULL)
+    {
+        pthread_mutex_unlock(&metrics_state.lock);
+        return;
+    }
+    for (size_t i = 0; i <= sizeof(buckets) / sizeof(buckets[0]); i++)
+    {
+        bool infinite = i == sizeof(buckets) / sizeof(buckets[0]);
+        char *key = infinite ? format_string("%s_bucket{%s%sle=\"+Inf\"}", name, labels, separator)
+                             : format_string("%s_bucket{%s%sle=\"%g\"}", name, labels, separator, buckets[i]);
+        table_update(&metrics_state.pending, key, infinite || value <= buckets[i] ? 1 : 0, false);
+        free(key);
+    }
+    char *sum_key = labels[0] != '\0' ? format_string("%s_sum{%s}", name, labels) : format_string("%s_sum", name);
+    char *count_key = labels[0] != '\0' ? format_string("%s_count{%s}", name, labels) : format_string("%s_count", name);
+    table_update(&metrics_state.pending, sum_key, value, false);
+    table_update(&metrics_state.pending, count_key, 1, false);
+    pthread_mutex_unlock(&metrics_state.lock);
+    free(count_key);
+    free(sum_key);
+}
+
+// name="value" with the value escaped for the exposition format
+char *metrics_label(const char *name, const char *value)
+{
+    char *escaped = safe_malloc(2 * strlen(value) + 1);
+    size_t size = 0;
+    for (const char *c = value; *c != '\0'; c++)
+    {
+        if (*c == '\\' || *c == '"')
+        {
+            escaped[size++] = '\\';
+            escaped[size++] = *c;
+        }
+        else if (*c == '\n')
+        {
+            escaped[size++] = '\\';
+            escaped[size++] = 'n';
+        }
+        else
+        {
+            escaped[size++] = *c;
+        }
+    }
+    escaped[size] = '\0';
+
+    char *label = format_string("%s=\"%s\"", name, escaped);
+    free(escaped);
+    return label;
+}
+
+bool metrics_pending(void)
+{
+    pthread_mutex_lock(&metrics_state.lock);
+    bool pending = metrics_state.pending.size > 0;
+    pthread_mutex_unlock(&metrics_state.lock);
+    return pending;
+}
+
+static bool series_in_family(const char *key, const char *family, metric_type_t type)
+{
+    size_t family_length = strlen(family);
+    if (strncmp(key, family, family_length) != 0)
+    {
+        return false;
+    }
+
+    const char *rest = key + family_length;
+    if (type == METRIC_HISTOGRAM)
+    {
+        const char *suffixes[] = {"_bucket", "_sum", "_count"};
+        for (size_t i = 0; i < sizeof(suffixes) / sizeof(suffixes[0]); i++)
+        {
+            if (strncmp(rest, suffixes[i], strlen(suffixes[i])) == 0)
+            {
+                rest += strlen(suffixes[i]);
+                break;
+            }
+        }
+    }
+    return *rest == '\0' || *rest == '{';
+}
+
+// merges the pending counts into the file, which is replaced atomically for the textfile collector
+void metrics_flush(void)
+{
+    pthread_mutex_lock(&metrics_state.lock);
+    if (metrics_state.path == NULL || metrics_state.pending.size == 0)
+    {
+        pthread_mutex_unlock(&metrics_state.lock);
+        return;
+    }
+
+    // overlapping runs merge one after another
+    char *lock_path = format_string("%s.lock", metrics_state.path);
+    int lock_fd = open(lock_path, O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+    while (lock_fd != -1 && flock(lock_fd, LOCK_EX) == -1 && errno == EINTR)
+    {
+    }
+
+    metric_table_t table = {0};
+    table_load(&table, metrics_state.path);
+    for (size_t i = 0; i < metrics_state.pending.size; i++)
+    {
+        const metric_series_t *series = &metrics_state.pending.items[i];
+        table_update(&table, series->key, series->value, series->set);
+    }
+
+    char *tmp_path = format_string("%s.tmp", metrics_state.path);
+    FILE *file = fopen(tmp_path, "w");
+    bool failed = file == NULL;
+    if (file != NULL)
+    {
+        for (size_t i = 0; i < sizeof(families) / sizeof(families[0]); i++)
+        {
+            static const char *types[] = {"counter", "gauge", "histogram"};
+            fprintf(file, "# HELP %s %s\n# TYPE %s %s\n", families[i].name, families[i].help, families[i].name,
+                    types[families[i].type]);
+            for (size_t j = 0; j < table.size; j++)
+            {
+                if (series_in_family(table.items[j].key, families[i].name, families[i].type))
+                {
+                    fprintf(file, "%s %.10g\n", table.items[j].key, table.items[j].value);
+                }
+            }
+        }
+        failed |= ferror(file) != 0;
+        failed |= fclose(file) != 0;
+    }
+    if (failed || rename(tmp_path, metrics_state.path) != 0)
+    {
+        fprintf(stderr, "Warning: could not write metrics to %s: %s\n", metrics_state.path, strerror(errno));
+        unlink(tmp_path);
+    }
+    else
+    {
+        table_free(&metrics_state.pending);
+    }
+
+    if (lock_fd != -1)
+    {
+        close(lock_fd);
+    }
+    free(tmp_path);
+    free(lock_path);
+    table_free(&table);
+    pthread_mutex_unlock(&metrics_state.lock);
+}
@@ -0,0 +1,451 @@
+#include "notify.h"
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "util.h"
+
+// how long the bus (or a notification daemon it has to start) may take to answer
+#define NOTIFY_REPLY_TIMEOUT_SEC 2
+
+// just enough of the D-Bus wire format to call methods and read their replies
+#define DBUS_METHOD_CALL 1
+#define DBUS_METHOD_RETURN 2
+#define DBUS_ERROR 3
+
+#define DBUS_FIELD_PATH 1
+#define DBUS_FIELD_INTERFACE 2
+#define DBUS_FIELD_MEMBER 3
+#define DBUS_FIELD_REPLY_SERIAL 5
+#define DBUS_FIELD_DESTINATION 6
+#define DBUS_FIELD_SIGNATURE 8
+
+typedef struct
+{
+    uint8_t *data;
+    size_t size;
+    size_t capacity;
+} buffer_t;
+
+static void buffer_reserve(buffer_t *, size_t);
+static void buffer_align(buffer_t *, size_t);
+static void buffer_put(buffer_t *, const void *, size_t);
+static void buffer_put_u8(buffer_t *, uint8_t);
+static void buffer_put_u32(buffer_t *, uint32_t);
+static void buffer_put_string(buffer_t *, const char *);
+static void buffer_put_signature(buffer_t *, const char *);
+static void buffer_put_field(buffer_t *, uint8_t, const char *, const char *);
+static void write_u32(uint8_t *, uint32_t);
+static uint32_t read_u32(const uint8_t *);
+static int bus_connect(void);
+static int bus_connect_address(const char *);
+static bool bus_authenticate(int);
+static bool bus_write(int, const void *, size_t);
+static bool bus_read(int, void *, size_t);
+static bool bus_call(notifier_t *, const char *, const char *, const char *, const char *, const char *,
+                     const buffer_t *, uint8_t **, size_t *);
+static bool bus_read_reply(notifier_t *, uint32_t, uint8_t **, size_t *);
+
+static void buffer_reserve(buffer_t *buffer, size_t size)
+{
+    if (buffer->size + size > buffer->capacity)
+    {
+        buffer->capacity = (buffer->size + size) * 2;
+        buffer->data = safe_realloc(buffer->data, buffer->capacity);
+    }
+}
+
+static void buffer_align(buffer_t *buffer, size_t alignment)
+{
+    size_t padding = (alignment - buffer->size % alignment) % alignment;
+    buffer_reserve(buffer, padding);
+    memset(buffer->data + buffer->size, 0, padding);
+    buffer->size += padding;
+}
+
+static void buffer_put(buffer_t *buffer, const void *data, size_t size)
+{
+    buffer_reserve(buffer, size);
+    memcpy(buffer->data + buffer->size, data, size);
+    buffer->size += size;
+}
+
+static void buffer_put_u8(buffer_t *buffer, uint8_t value)
+{
+    buffer_put(buffer, &value, 1);
+}
+
+static void buffer_put_u32(buffer_t *buffer, uint32_t value)
+{
+    uint8_t bytes[4];
+    write_u32(bytes, value);
+    buffer_align(buffer, 4);
+    buffer_put(buffer, bytes, 4);
+}
+
+static void buffer_put_string(buffer_t *buffer, const char *string)
+{
+    size_t length = strlen(string);
+    buffer_put_u32(buffer, (uint32_t)length);
+    buffer_put(buffer, string, length + 1);
+}
+
+static void buffer_put_signature(buffer_t *buffer, const char *signature)
+{
+    size_t length = strlen(signature);
+    buffer_put_u8(buffer, (uint8_t)length);
+    buffer_put(buffer, signature, length + 1);
+}
+
+static void buffer_put_field(buffer_t *buffer, uint8_t code, const char *type, const char *value)
+{
+    // a (yv) struct, the variant holds a string, object path or signature
+    buffer_align(buffer, 8);
+    buffer_put_u8(buffer, code);
+    buffer_put_signature(buffer, type);
+    if (type[0] == 'g')
+        buffer_put_signature(buffer, value);
+    else
+        buffer_put_string(buffer, value);
+}
+
+static void write_u32(uint8_t *data, uint32_t value)
+{
+    // the messages are sent little endian, as the 'l' in their header says
+    data[0] = (uint8_t)value;
+    data[1] = (uint8_t)(value >> 8);
+    data[2] = (uint8_t)(value >> 16);
+    data[3] = (uint8_t)(value >> 24);
+}
+
+static uint32_t read_u32(const uint8_t *data)
+{
+    return (uint32_t)data[0] | (uint32_t)data[1] << 8 | (uint32_t)data[2] << 16 | (uint32_t)data[3] << 24;
+}
+
+static bool bus_write(int fd, const void *data, size_t size)
+{
+    const uint8_t *bytes = data;
+    while (size > 0)
+    {
+        ssize_t written = send(fd, bytes, size, MSG_NOSIGNAL);
+        if (written == -1 && errno == EINTR)
+            continue;
+        if (written <= 0)
+            return false;
+        bytes += written;
+        size -= (size_t)written;
+    }
+    return true;
+}
+
+static bool bus_read(int fd, void *data, size_t size)
+{
+    uint8_t *bytes = data;
+    while (size > 0)
+    {
+        ssize_t got = recv(fd, bytes, size, 0);
+        if (got == -1 && errno == EINTR)
+            continue;
+        if (got <= 0)
+            return false;
+        bytes += got;
+        size -= (size_t)got;
+    }
+    return true;
+}
+
+static int bus_connect_address(const char *address)
+{
+    // unix:path=/run/user/1000/bus or unix:abstract=/tmp/dbus-xyz,guid=...
+    if (strncmp(address, "unix:", 5) != 0)
+    {
+        return -1;
+    }
+
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    socklen_t addr_size = 0;
+    const char *key = address + 5;
+    while (*key != '\0')
+    {
+        size_t key_length = strcspn(key, "=");
+        const char *value = key + key_length + (key[key_length] == '=');
+        size_t value_length = strcspn(value, ",");
+        bool abstract = strncmp(key, "abstract=", 9) == 0;
+
+        if ((abstract || strncmp(key, "path=", 5) == 0) && value_length < sizeof(addr.sun_path) - 1)
+        {
+            // an abstract name starts with a NUL byte and is not terminated
+            memcpy(addr.sun_path + abstract, value, value_length);
+            addr_size = (socklen_t)(offsetof(struct sockaddr_un, sun_path) + abstract + value_length + !abstract);
+        }
+
+        key = value + value_length + (value[value_length] == ',');
+    }
+    if (addr_size == 0)
+    {
+        return -1;
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1)
+    {
+        return -1;
+    }
+    if (connect(fd, (struct sockaddr *)&addr, addr_size) == -1)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static int bus_connect(void)
+{
+    const char *addresses = getenv("DBUS_SESSION_BUS_ADDRESS");
+    if (addresses == NULL)
+    {
+        // where systemd puts the session bus
+        char *address = format_string("unix:path=/run/user/%u/bus", (unsigned int)getuid());
+        int fd = bus_connect_address(address);
+        free(address);
+        return fd;
+    }
+
+    // a list of alternatives separated by ';'
+    char *list = strdup(addresses);
+    int fd = -1;
+    for (char *save, *address = strtok_r(list, ";", &save); fd == -1 && address != NULL;
+         address = strtok_r(NULL, ";", &save))
+    {
+        fd = bus_connect_address(address);
+    }
+    free(list);
+    return fd;
+}
+
+static bool bus_authenticate(int fd)
+{
+    // the bus knows who we are from the socket credentials, EXTERNAL only names the uid in hex
+    char uid[16];
+    snprintf(uid, sizeof(uid), "%u", (unsigned int)getuid());
+    char request[64] = "AUTH EXTERNAL ";
+    for (size_t i = 0; uid[i] != '\0'; i++)
+    {
+        snprintf(request + strlen(request), 3, "%02x", (unsigned char)uid[i]);
+    }
+    strcat(request, "\r\n");
+
+    if (!bus_write(fd, "", 1) || !bus_write(fd, request, strlen(request)))
+    {
+        return false;
+    }
+
+    char line[256];
+    size_t length = 0;
+    while (length < sizeof(line) - 1)
+    {
+        if (!bus_read(fd, line + length, 1))
+        {
+            return false;
+        }
+        if (line[length++] == '\n')
+        {
+            break;
+        }
+    }
+    line[length] = '\0';
+
+    return strncmp(line, "OK ", 3) == 0 && bus_write(fd, "BEGIN\r\n", 7);
+}
+
+static bool bus_call(notifier_t *notifier, const char *destination, const char *path, const char *interface,
+                     const char *member, const char *signature, const buffer_t *body, uint8_t **reply,
+                     size_t *reply_size)
+{
+    uint32_t serial = ++notifier->serial;
+
+    buffer_t message = {0};
+    buffer_put(&message, (uint8_t[]){'l', DBUS_METHOD_CALL, 0, 1}, 4);
+    buffer_put_u32(&message, body != NULL ? (uint32_t)body->size : 0);
+    buffer_put_u32(&message, serial);
+
+    // the header fields array, its length is patched in once known
+    buffer_put_u32(&message, 0);
+    size_t fields_start = message.size;
+    buffer_put_field(&message, DBUS_FIELD_PATH, "o", path);
+    buffer_put_field(&message, DBUS_FIELD_INTERFACE, "s", interface);
+    buffer_put_field(&message, DBUS_FIELD_MEMBER, "s", member);
+    buffer_put_field(&message, DBUS_FIELD_DESTINATION, "s", destination);
+    if (signature != NULL)
+    {
+        buffer_put_field(&message, DBUS_FIELD_SIGNATURE, "g", signature);
+    }
+    uint32_t fields_size = (uint32_t)(message.size - fields_start);
+    write_u32(message.data + fields_start - 4, fields_size);
+
+    buffer_align(&message, 8);
+    if (body != NULL)
+    {
+        buffer_put(&message, body->data, body->size);
+    }
+
+    bool ok = bus_write(notifier->fd, message.data, message.size) &&
+              bus_read_reply(notifier, serial, reply, reply_size);
+    free(message.data);
+    return ok;
+}
+
+static bool bus_read_reply(notifier_t *notifier, uint32_t serial, uint8_t **reply, size_t *reply_size)
+{
+    // skip signals (like NameAcquired) until the answer to serial comes
+    for (;;)
+    {
+        uint8_t header[16];
+        if (!bus_read(notifier->fd, header, sizeof(header)) || header[0] != 'l')
+        {
+            return false;
+        }
+
+        uint32_t body_size = read_u32(header + 4);
+        uint32_t fields_size = read_u32(header + 12);
+        size_t fields_padded = (fields_size + 7) & ~(size_t)7;
+        if (fields_padded + body_size > (1 << 27))
+        {
+            return false;
+        }
+
+        uint8_t *rest = safe_malloc(fields_padded + body_size + 1);
+        if (!bus_read(notifier->fd, rest, fields_padded + body_size))
+        {
+            free(rest);
+            return false;
+        }
+
+        // walk the (yv) header fields for REPLY_SERIAL
+        uint32_t reply_serial = 0;
+        size_t offset = 0;
+        while (offset + 4 <= fields_size)
+        {
+            uint8_t code = rest[offset];
+            uint8_t signature_length = rest[offset + 1];
+            char type = (char)rest[offset + 2];
+            size_t value = offset + 2 + signature_length + 1;
+            size_t end;
+            if (type == 'u' || type == 's' || type == 'o')
+            {
+                value = (value + 3) & ~(size_t)3;
+                if (value + 4 > fields_size)
+                    break;
+                end = type == 'u' ? value + 4 : value + 4 + read_u32(rest + value) + 1;
+                if (code == DBUS_FIELD_REPLY_SERIAL && type == 'u')
+                    reply_serial = read_u32(rest + value);
+            }
+            else if (type == 'g')
+            {
+                end = value + 1 + rest[value] + 1;
+            }
+            else
+            {
+                break;
+            }
+            // fields start at offset 16 of the message, which is 8 aligned
+            offset = (end + 7) & ~(size_t)7;
+        }
+
+        uint8_t type = header[1];
+        if ((type == DBUS_METHOD_RETURN || type == DBUS_ERROR) && reply_serial == serial)
+        {
+            if (type == DBUS_ERROR)
+            {
+                free(rest);
+                return false;
+            }
+            if (reply != NULL)
+            {
+                *reply = safe_malloc(body_size + 1);
+                memcpy(*reply, rest + fields_padded, body_size);
+                *reply_size = body_size;
+            }
+            free(rest);
+            return true;
+        }
+        free(rest);
+    }
+}
+
+bool notifier_open(notifier_t *notifier)
+{
+    *notifier = (notifier_t){.fd = bus_connect()};
+    if (notifier->fd == -1)
+    {
+        return false;
+    }
+
+    // a bus that never answers must not hold up the theme switch
+    struct timeval timeout = {.tv_sec = NOTIFY_REPLY_TIMEOUT_SEC};
+    setsockopt(notifier->fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(notifier->fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    if (!bus_authenticate(notifier->fd) || !bus_call(notifier, "org.freedesktop.DBus", "/org/freedesktop/DBus",
+                                                     "org.freedesktop.DBus", "Hello", NULL, NULL, NULL, NULL))
+    {
+        notifier_close(notifier);
+        return false;
+    }
+    return true;
+}
+
+void notifier_send(notifier_t *notifier, const char *icon, const char *summary, const char *body)
+{
+    if (notifier->fd != -1)
+    {
+        // Notify(app_name, replaces_id, app_icon, summary, body, actions, hints, expire_timeout)
+        buffer_t args = {0};
+        buffer_put_string(&args, "theming");
+        buffer_put_u32(&args, notifier->id);
+        buffer_put_string(&args, icon);
+        buffer_put_string(&args, summary);
+        buffer_put_string(&args, body);
+        buffer_put_u32(&args, 0); // no actions
+        buffer_put_u32(&args, 0); // no hints, the array is still padded to its dict entries
+        buffer_align(&args, 8);
+        buffer_put_u32(&args, UINT32_MAX); // -1, the server's default timeout
+
+        uint8_t *reply = NULL;
+        size_t reply_size = 0;
+        bool sent = bus_call(notifier, "org.freedesktop.Notifications", "/org/freedesktop/Notifications",
+                             "org.freedesktop.Notifications", "Notify", "susssasa{sv}i", &args, &reply, &reply_size);
+        free(args.data);
+        if (sent && reply_size >= 4)
+        {
+            notifier->id = read_u32(reply);
+        }
+        free(reply);
+        if (sent)
+        {
+            return;
+        }
+
+        // no notification daemon on the bus, or it failed
+        notifier_close(notifier);
+    }
+
+    exec_command_format(false, NULL, 0, "notify-send -i %s \"%s\" \"%s\"", icon, summary, body);
+}
+
+void notifier_close(notifier_t *notifier)
+{
+    if (notifier->fd != -1)
+    {
+        close(notifier->fd);
+        notifier->fd = -1;
+    }
+}
@@ -0,0 +1,159 @@
+#include "oklab.h"
+
+#include <math.h>
+#include <stdbool.h>
+
+static void oklab_init_tables(void) __attribute__((constructor));
+static inline float fast_cbrtf(float);
+static inline uint8_t linear_to_srgb8(float);
+static inline void linear_to_oklab(float, float, float, OKLab *);
+static inline void oklab_to_linear(const OKLab *, float *, float *, float *);
+
+// sRGB decoding of every 8 bit value, and the linear values halfway between neighbouring codes
+static float srgb_to_linear_table[256];
+static float srgb_midpoint_table[255];
+
+static void oklab_init_tables(void)
+{
+    for (int i = 0; i < 256; i++)
+    {
+        double c = i / 255.0;
+        srgb_to_linear_table[i] = (float)(c <= 0.04045 ? c / 12.92 : pow((c + 0.055) / 1.055, 2.4));
+    }
+
+    for (int i = 0; i < 255; i++)
+    {
+        double c = (i + 0.5) / 255.0;
+        srgb_midpoint_table[i] = (float)(c <= 0.04045 ? c / 12.92 : pow((c + 0.055) / 1.055, 2.4));
+    }
+}
+
+static inline float fast_cbrtf(float x)
+{
+    if (x <= 0.0f)
+    {
+        return 0.0f;
+    }
+
+    // exponent divided by three as the first guess, two newton steps bring it to float precision
+    union
+    {
+        float f;
+        uint32_t u;
+    } v = {.f = x};
+    v.u = v.u / 3 + 709921077u;
+
+    float y = v.f;
+    y = (2.0f * y + x / (y * y)) * (1.0f / 3.0f);
+    y = (2.0f * y + x / (y * y)) * (1.0f / 3.0f);
+    return y;
+}
+
+static inline uint8_t linear_to_srgb8(float c)
+{
+    // the code whose midpoints enclose c is the correctly rounded encoding, found without pow
+    unsigned int lo = 0, hi = 255;
+    while (lo < hi)
+    {
+        unsigned int mid = (lo + hi) / 2;
+        if (c < srgb_midpoint_table[mid])
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+    return (uint8_t)lo;
+}
+
+static inline void linear_to_oklab(float r, float g, float b, OKLab *lab)
+{
+    float l = fast_cbrtf(0.4122214708f * r + 0.5363325363f * g + 0.0514459929f * b);
+    float m = fast_cbrtf(0.2119034982f * r + 0.6806995451f * g + 0.1073969566f * b);
+    float s = fast_cbrtf(0.0883024619f * r + 0.2817188376f * g + 0.6299787005f * b);
+
+    lab->l = 0.2104542553f * l + 0.7936177850f * m - 0.0040720468f * s;
+    lab->a = 1.9779984951f * l - 2.4285922050f * m + 0.4505937099f * s;
+    lab->b = 0.0259040371f * l + 0.7827717662f * m - 0.8086757660f * s;
+}
+
+static inline void oklab_to_linear(const OKLab *lab, float *r, float *g, float *b)
+{
+    float l = lab->l + 0.3963377774f * lab->a + 0.2158037573f * lab->b;
+    float m = lab->l - 0.1055613458f * lab->a - 0.0638541728f * lab->b;
+    float s = lab->l - 0.0894841775f * lab->a - 1.2914855480f * lab->b;
+    l = l * l * l;
+    m = m * m * m;
+    s = s * s * s;
+
+    *r = 4.0767416621f * l - 3.3077115913f * m + 0.2309699292f * s;
+    *g = -1.2684380046f * l + 2.6097574011f * m - 0.3413193965f * s;
+    *b = -0.0041960863f * l - 0.7034186147f * m + 1.7076147010f * s;
+}
+
+void rgb_to_oklab(const RGB *color, OKLab *lab)
+{
+    linear_to_oklab(srgb_to_linear_table[color->r & 0xff], srgb_to_linear_table[color->g & 0xff],
+                    srgb_to_linear_table[color->b & 0xff], lab);
+}
+
+void oklab_to_rgb(const OKLab *lab, RGB *color)
+{
+    float r, g, b;
+    oklab_to_linear(lab, &r, &g, &b);
+
+    // out of gamut colors are clipped per channel
+    color->r = linear_to_srgb8(r);
+    color->g = linear_to_srgb8(g);
+    color->b = linear_to_srgb8(b);
+}
+
+void oklab_to_oklch(const OKLab *lab, OKLCH *lch)
+{
+    lch->l = lab->l;
+    lch->c = sqrtf(lab->a * lab->a + lab->b * lab->b);
+    lch->h = atan2f(lab->b, lab->a);
+}
+
+void oklch_to_oklab(const OKLCH *lch, OKLab *lab)
+{
+    lab->l = lch->l;
+    lab->a = lch->c * cosf(lch->h);
+    lab->b = lch->c * sinf(lch->h);
+}
+
+float oklab_distance(const OKLab *lab1, const OKLab *lab2)
+{
+    // squared euclidean distance, perceptually uniform enough to compare against each other
+    float dl = lab1->l - lab2->l;
+    float da = lab1->a - lab2->a;
+    float db = lab1->b - lab2->b;
+    return dl * dl + da * da + db * db;
+}
+
+float oklch_max_chroma(float l, float h)
+{
+    // largest chroma that still maps into sRGB at this lightness and hue
+    float lo = 0.0f, hi = 0.5f;
+    for (int i = 0; i < 16; i++)
+    {
+        float c = (lo + hi) * 0.5f;
+        OKLab lab = {.l = l, .a = c * cosf(h), .b = c * sinf(h)};
+        float r, g, b;
+        oklab_to_linear(&lab, &r, &g, &b);
+
+        bool in_gamut = r >= -1e-4f && r <= 1.0001f && g >= -1e-4f && g <= 1.0001f && b >= -1e-4f && b <= 1.0001f;
+        if (in_gamut)
+            lo = c;
+        else
+            hi = c;
+    }
+    return lo;
+}
+
+void pixels_to_oklab(const uint8_t *pixels, OKLab *lab, size_t size)
+{
+    for (size_t i = 0; i < size; i++)
+    {
+        linear_to_oklab(srgb_to_linear_table[pixels[3 * i]], srgb_to_linear_table[pixels[3 * i + 1]],
+                        srgb_to_linear_table[pixels[3 * i + 2]], &lab[i]);
+    }
+}
@@ -0,0 +1,77 @@
+#include "palette_file.h"
+
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "theming_palette.h"
+#include "util.h"
+
+static theming_palette_color_t palette_file_color(const RGB *);
+
+static theming_palette_color_t palette_file_color(const RGB *color)
+{
+    return (theming_palette_color_t){(uint8_t)color->r, (uint8_t)color->g, (uint8_t)color->b, 0xff};
+}
+
+void palette_file_publish(const char *path, const RGB *colors, bool dark)
+{
+    // updated in place, readers keep their mapping across switches
+    int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd == -1)
+    {
+        die("open failed for %s:", path);
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == -1)
+    {
+        die("fstat failed:");
+    }
+    if ((size_t)st.st_size != sizeof(theming_palette_file_t) && ftruncate(fd, sizeof(theming_palette_file_t)) == -1)
+    {
+        die("ftruncate failed:");
+    }
+
+    theming_palette_file_t *file =
+        mmap(NULL, sizeof(theming_palette_file_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (file == MAP_FAILED)
+    {
+        die("mmap failed:");
+    }
+
+    // a new or foreign file starts over, the sequence must be even for readers
+    if (file->magic != THEMING_PALETTE_MAGIC || file->version != THEMING_PALETTE_VERSION)
+    {
+        memset(file, 0, sizeof(*file));
+        file->magic = THEMING_PALETTE_MAGIC;
+        file->version = THEMING_PALETTE_VERSION;
+    }
+    // a writer that died halfway left it odd
+    uint32_t sequence = atomic_load_explicit(&file->sequence, memory_order_relaxed) | 1;
+
+    atomic_store_explicit(&file->sequence, sequence, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    theming_palette_t *palette = &file->palette;
+    for (size_t i = 0; i < PALETTE_SIZE; i++)
+    {
+        palette->colors[i] = palette_file_color(&colors[i]);
+    }
+    // the same slots the terminal configs use
+    palette->foreground = palette_file_color(&colors[7]);
+    palette->background = palette_file_color(&colors[0]);
+    palette->cursor = palette_file_color(&colors[7]);
+    palette->dark = dark;
+    palette->generation++;
+
+    atomic_store_explicit(&file->sequence, sequence + 1, memory_order_release);
+    syscall(SYS_futex, (uint32_t *)&file->sequence, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+
+    munmap(file, sizeof(theming_palette_file_t));
+}
@@ -0,0 +1,75 @@
+#include "pool.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <unistd.h>
+
+#include "util.h"
+
+typedef struct
+{
+    atomic_size_t next;
+    size_t count;
+    void (*callback)(size_t, void *);
+    void *userdata;
+} pool_work_t;
+
+static void *pool_worker(void *);
+
+static void *pool_worker(void *arg)
+{
+    pool_work_t *work = arg;
+
+    // items are handed out one at a time, uneven item sizes balance themselves
+    size_t i;
+    while ((i = atomic_fetch_add(&work->next, 1)) < work->count)
+    {
+        work->callback(i, work->userdata);
+    }
+
+    return NULL;
+}
+
+size_t pool_threads(void)
+{
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    return cpus > 0 ? (size_t)cpus : 1;
+}
+
+void parallel_for(size_t count, void (*callback)(size_t, void *), void *userdata)
+{
+    parallel_for_workers(pool_threads(), count, callback, userdata);
+}
+
+// items start in index order, at most workers of them at once
+void parallel_for_workers(size_t workers, size_t count, void (*callback)(size_t, void *), void *userdata)
+{
+    pool_work_t work = {.count = count, .callback = callback, .userdata = userdata};
+    atomic_init(&work.next, 0);
+
+    size_t threads_size = workers;
+    if (threads_size > count)
+    {
+        threads_size = count;
+    }
+    if (threads_size <= 1)
+    {
+        pool_worker(&work);
+        return;
+    }
+
+    // the calling thread works as well
+    pthread_t threads[threads_size - 1];
+    for (size_t i = 0; i < threads_size - 1; i++)
+    {
+        if (pthread_create(&threads[i], NULL, pool_worker, &work) != 0)
+        {
+            die("pthread_create failed");
+        }
+    }
+    pool_worker(&work);
+    for (size_t i = 0; i < threads_size - 1; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+}
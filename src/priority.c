@@ -0,0 +1,221 @@
+#define _GNU_SOURCE
+#include "priority.h"
+
+#include <errno.h>
+#include <sched.h>
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "util.h"
+
+#define IOPRIO_WHO_PROCESS 1
+#define IOPRIO_CLASS_BE 2
+#define IOPRIO_CLASS_IDLE 3
+#define IOPRIO_CLASS_SHIFT 13
+#define CPU_MAX_PERIOD 100000 // microseconds
+
+static char *cgroup_own_path(void);
+static bool cgroup_write(const char *, const char *, const char *);
+static bool parse_cpus(const char *, cpu_set_t *);
+
+static atomic_uint cgroup_counter;
+
+void priority_apply(const priority_t *priority, const char *cgroup_path)
+{
+    // everything is best effort, a command runs at normal priority rather than not at all.
+    // pid 0 means the calling thread, so this also works for threads of theming itself
+    if (cgroup_path != NULL)
+    {
+        cgroup_write(cgroup_path, "cgroup.procs", "0");
+    }
+    if (priority->has_nice)
+    {
+        setpriority(PRIO_PROCESS, 0, priority->nice);
+    }
+    if (priority->io_class != IO_CLASS_DEFAULT)
+    {
+        int io_class = priority->io_class == IO_CLASS_IDLE ? IOPRIO_CLASS_IDLE : IOPRIO_CLASS_BE;
+        int level = priority->io_class == IO_CLASS_IDLE ? 0 : priority->io_level;
+        syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, io_class << IOPRIO_CLASS_SHIFT | level);
+    }
+    if (priority->sched_class != SCHED_CLASS_DEFAULT)
+    {
+        struct sched_param param = {.sched_priority = 0};
+        sched_setscheduler(0, priority->sched_class == SCHED_CLASS_IDLE ? SCHED_IDLE : SCHED_BATCH, &param);
+    }
+    cpu_set_t cpus;
+    if (priority->cpus != NULL && parse_cpus(priority->cpus, &cpus))
+    {
+        sched_setaffinity(0, sizeof(cpus), &cpus);
+    }
+}
+
+static char *cgroup_own_path(void)
+{
+    // the cgroup2 mount point, then where in it theming runs
+    FILE *mounts = fopen("/proc/self/mountinfo", "r");
+    if (mounts == NULL)
+    {
+        return NULL;
+    }
+    char line[1024];
+    char mount_point[512] = "";
+    while (fgets(line, sizeof(line), mounts) != NULL)
+    {
+        char point[512];
+        char *separator = strstr(line, " - ");
+        if (separator != NULL && strncmp(separator + 3, "cgroup2 ", 8) == 0 &&
+            sscanf(line, "%*s %*s %*s %*s %511s", point) == 1)
+        {
+            strcpy(mount_point, point);
+            break;
+        }
+    }
+    fclose(mounts);
+
+    FILE *cgroup = fopen("/proc/self/cgroup", "r");
+    if (cgroup == NULL || mount_point[0] == '\0')
+    {
+        if (cgroup != NULL)
+            fclose(cgroup);
+        return NULL;
+    }
+    char *path = NULL;
+    while (path == NULL && fgets(line, sizeof(line), cgroup) != NULL)
+    {
+        if (strncmp(line, "0::", 3) == 0)
+        {
+            line[strcspn(line, "\n")] = '\0';
+            path = format_string("%s%s", mount_point, strcmp(line + 3, "/") == 0 ? "" : line + 3);
+        }
+    }
+    fclose(cgroup);
+    return path;
+}
+
+static bool cgroup_write(const char *cgroup_path, const char *name, const char *value)
+{
+    char *path = format_string("%s/%s", cgroup_path, name);
+    int fd = open(path, O_WRONLY | O_CLOEXEC);
+    free(path);
+    if (fd == -1)
+    {
+        return false;
+    }
+    bool ok = write(fd, value, strlen(value)) == (ssize_t)strlen(value);
+    close(fd);
+    return ok;
+}
+
+char *priority_cgroup_create(const priority_t *priority)
+{
+    if (priority->cpu_max <= 0 && priority->memory_max == NULL)
+    {
+        return NULL;
+    }
+
+    // a sibling of the cgroup theming runs in, a cgroup with processes can not have limited children
+    char *own_path = cgroup_own_path();
+    if (own_path == NULL)
+    {
+        return NULL;
+    }
+    char *parent = strrchr(own_path, '/');
+    if (parent == NULL)
+    {
+        free(own_path);
+        return NULL;
+    }
+    *parent = '\0';
+
+    char *path = format_string("%s/theming-%d-%u", own_path, (int)getpid(), atomic_fetch_add(&cgroup_counter, 1));
+    free(own_path);
+    if (mkdir(path, 0755) == -1)
+    {
+        free(path);
+        return NULL;
+    }
+
+    bool ok = true;
+    if (priority->cpu_max > 0)
+    {
+        char value[64];
+        snprintf(value, sizeof(value), "%d %d", (int)(priority->cpu_max * CPU_MAX_PERIOD), CPU_MAX_PERIOD);
+        ok &= cgroup_write(path, "cpu.max", value);
+    }
+    if (priority->memory_max != NULL)
+    {
+        ok &= cgroup_write(path, "memory.max", priority->memory_max);
+    }
+
+    // without the controllers delegated there is nothing to gain from it
+    if (!ok)
+    {
+        rmdir(path);
+        free(path);
+        return NULL;
+    }
+    return path;
+}
+
+void priority_cgroup_remove(char *path)
+{
+    if (path != NULL)
+    {
+        rmdir(path);
+        free(path);
+    }
+}
+
+bool priority_valid_cpus(const char *list)
+{
+    cpu_set_t cpus;
+    return parse_cpus(list, &cpus);
+}
+
+static bool parse_cpus(const char *list, cpu_set_t *cpus)
+{
+    // like taskset -c: "0-3,6"
+    CPU_ZERO(cpus);
+    const char *p = list;
+    while (*p != '\0')
+    {
+        char *end;
+        long first = strtol(p, &end, 10);
+        long last = first;
+        if (end == p || first < 0)
+        {
+            return false;
+        }
+        if (*end == '-')
+        {
+            p = end + 1;
+            last = strtol(p, &end, 10);
+            if (end == p || last < first)
+            {
+                return false;
+            }
+        }
+        for (long cpu = first; cpu <= last && cpu < CPU_SETSIZE; cpu++)
+        {
+            CPU_SET((size_t)cpu, cpus);
+        }
+        if (*end == ',')
+        {
+            end++;
+        }
+        else if (*end != '\0')
+        {
+            return false;
+        }
+        p = end;
+    }
+    return CPU_COUNT(cpus) > 0;
+}
@@ -0,0 +1,334 @@
+#include "process.h"
+
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "util.h"
+
+// how long to wait for a terminated process to actually exit before respawning it
+#define PROCESS_EXIT_TIMEOUT_MS 1000
+
+static int pidfd_open(pid_t);
+static int pidfd_send_signal(int, int);
+
+static int pidfd_open(pid_t pid)
+{
+#ifdef SYS_pidfd_open
+    return (int)syscall(SYS_pidfd_open, pid, 0);
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+static int pidfd_send_signal(int pidfd, int sig)
+{
+#ifdef SYS_pidfd_send_signal
+    return (int)syscall(SYS_pidfd_send_signal, pidfd, sig, NULL, 0);
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+unsigned long long process_start_time(pid_t pid)
+{
+    char path[32];
+    char buffer[1024];
+
+    snprintf(path, sizeof(path), "/proc/%d/stat", (int)pid);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+    {
+        return 0;
+    }
+
+    ssize_t len = read(fd, buffer, sizeof(buffer) - 1);
+    close(fd);
+    if (len <= 0)
+    {
+        return 0;
+    }
+    buffer[len] = '\0';
+
+    // comm (field 2) may contain spaces and parentheses, so start after the last ')'
+    char *field = strrchr(buffer, ')');
+    if (field == NULL)
+    {
+        return 0;
+    }
+
+    // skip fields 3 to 21
+    for (int i = 3; i <= 22 && field != NULL; i++)
+    {
+        field = strchr(field + 1, ' ');
+    }
+    if (field == NULL)
+    {
+        return 0;
+    }
+
+    return strtoull(field + 1, NULL, 10);
+}
+
+bool process_tracked_find(const char *state_path, const char *key, tracked_process_t *process)
+{
+    FILE *file = fopen(state_path, "r");
+    if (file == NULL)
+    {
+        return false;
+    }
+
+    bool found = false;
+    char *line = NULL;
+    size_t line_size = 0;
+    while (getline(&line, &line_size, file) != -1)
+    {
+        int pid;
+        unsigned long long start_time;
+        int offset;
+
+        line[strcspn(line, "\n")] = 0;
+        if (sscanf(line, "%d %llu %n", &pid, &start_time, &offset) != 2 || strcmp(line + offset, key) != 0)
+        {
+            continue;
+        }
+
+        // a recycled pid has a different start time
+        if (start_time != 0 && process_start_time(pid) == start_time)
+        {
+            process->pid = pid;
+            process->start_time = start_time;
+            found = true;
+        }
+        break;
+    }
+
+    free(line);
+    fclose(file);
+    return found;
+}
+
+void process_tracked_store(const char *state_path, const char *key, pid_t pid)
+{
+    char *tmp_path = format_string("%s.tmp", state_path);
+    FILE *out = fopen(tmp_path, "w");
+    if (out == NULL)
+    {
+        die("fopen failed:");
+    }
+
+    // keep the entries of all other commands
+    FILE *in = fopen(state_path, "r");
+    if (in != NULL)
+    {
+        char *line = NULL;
+        size_t line_size = 0;
+        while (getline(&line, &line_size, in) != -1)
+        {
+            int offset = 0;
+            int other_pid;
+            unsigned long long start_time;
+
+            if (sscanf(line, "%d %llu %n", &other_pid, &start_time, &offset) != 2)
+            {
+                continue;
+            }
+            size_t key_len = strcspn(line + offset, "\n");
+            if (key_len == strlen(key) && strncmp(line + offset, key, key_len) == 0)
+            {
+                continue;
+            }
+            fputs(line, out);
+        }
+        free(line);
+        fclose(in);
+    }
+
+    fprintf(out, "%d %llu %s\n", (int)pid, process_start_time(pid), key);
+
+    if (ferror(out) || fclose(out) != 0)
+    {
+        die("writing to file failed:");
+    }
+    if (rename(tmp_path, state_path) != 0)
+    {
+        die("rename failed:");
+    }
+    free(tmp_path);
+}
+
+bool process_terminate(const tracked_process_t *process, int sig, bool group)
+{
+    int pidfd = pidfd_open(process->pid);
+    if (pidfd == -1 && errno != ENOSYS)
+    {
+        return false;
+    }
+
+    // verify after opening the pidfd, so the pid cannot be recycled in between
+    if (process->start_time != 0 && process_start_time(process->pid) != process->start_time)
+    {
+        if (pidfd != -1)
+            close(pidfd);
+        return false;
+    }
+
+    int rv = pidfd != -1 ? pidfd_send_signal(pidfd, sig) : kill(process->pid, sig);
+    if (rv == -1 && errno == ENOSYS)
+    {
+        rv = kill(process->pid, sig);
+    }
+    if (rv == -1)
+    {
+        if (errno == ESRCH)
+        {
+            if (pidfd != -1)
+                close(pidfd);
+            return false;
+        }
+        die("kill failed:");
+    }
+
+    // tracked processes lead their own session, take the rest of their process group along
+    if (group)
+    {
+        kill(-process->pid, sig);
+    }
+
+    if (pidfd != -1)
+    {
+        struct pollfd pfd = {.fd = pidfd, .events = POLLIN};
+        poll(&pfd, 1, PROCESS_EXIT_TIMEOUT_MS);
+        close(pidfd);
+    }
+
+    return true;
+}
+
+char *process_default_name(const char *command)
+{
+    size_t start = strspn(command, " \t");
+    size_t len = strcspn(command + start, " \t");
+    char *name = strndup(command + start, len);
+    if (name == NULL)
+    {
+        die("strndup failed:");
+    }
+
+    char *base = strrchr(name, '/');
+    if (base != NULL)
+    {
+        memmove(name, base + 1, strlen(base + 1) + 1);
+    }
+
+    name[strnlen(name, PROCESS_COMM_LEN)] = '\0';
+    return name;
+}
+
+bool process_find_started_after(const char *name, unsigned long long start_time, tracked_process_t *process)
+{
+    DIR *dir = opendir("/proc");
+    if (dir == NULL)
+    {
+        die("opendir failed:");
+    }
+
+    bool found = false;
+    struct dirent *ent;
+    while (!found && (ent = readdir(dir)) != NULL)
+    {
+        if (!isdigit(*ent->d_name))
+        {
+            continue;
+        }
+
+        char path[32];
+        char comm[32];
+        snprintf(path, sizeof(path), "/proc/%.16s/comm", ent->d_name);
+        int fd = open(path, O_RDONLY | O_CLOEXEC);
+        if (fd == -1)
+        {
+            continue;
+        }
+        ssize_t len = read(fd, comm, sizeof(comm) - 1);
+        close(fd);
+        if (len <= 0)
+        {
+            continue;
+        }
+        comm[len] = '\0';
+        comm[strcspn(comm, "\n")] = '\0';
+
+        if (strncmp(comm, name, PROCESS_COMM_LEN) == 0)
+        {
+            pid_t pid = (pid_t)strtol(ent->d_name, NULL, 10);
+            unsigned long long pid_start_time = process_start_time(pid);
+            if (pid_start_time >= start_time)
+            {
+                *process = (tracked_process_t){.pid = pid, .start_time = pid_start_time};
+                found = true;
+            }
+        }
+    }
+
+    closedir(dir);
+    return found;
+}
+
+bool process_wait(pid_t pid, int timeout_ms, int *status)
+{
+    // the pidfd bounds the wait, without one waitpid simply blocks
+    int pidfd = pidfd_open(pid);
+    if (pidfd != -1)
+    {
+        struct pollfd pfd = {.fd = pidfd, .events = POLLIN};
+        int rv;
+        while ((rv = poll(&pfd, 1, timeout_ms)) == -1 && errno == EINTR)
+            ;
+        close(pidfd);
+        if (rv == 0)
+        {
+            return false;
+        }
+    }
+
+    while (waitpid(pid, status, 0) == -1)
+    {
+        if (errno != EINTR)
+        {
+            die("waitpid failed:");
+        }
+    }
+    return true;
+}
+
+bool process_terminate_command(const char *state_path, const char *command, const char *process_name)
+{
+    tracked_process_t process;
+
+    if (process_tracked_find(state_path, command, &process))
+    {
+        return process_terminate(&process, SIGTERM, true);
+    }
+
+    // not started by us (or state lost), fall back to scanning /proc
+    pid_t pid = find_pid_by_name(process_name);
+    if (pid == -1)
+    {
+        return false;
+    }
+
+    process = (tracked_process_t){.pid = pid, .start_time = process_start_time(pid)};
+    return process_terminate(&process, SIGTERM, false);
+}
@@ -0,0 +1,288 @@
+#include "quantize.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "oklab.h"
+#include "util.h"
+
+// pixels are first reduced to a histogram of 5 bit per channel bins, clustering runs over the bins
+#define QUANTIZE_BITS 5
+#define QUANTIZE_BINS (1u << (3 * QUANTIZE_BITS))
+#define QUANTIZE_ITERATIONS 32
+
+typedef struct
+{
+    uint64_t count;
+    uint64_t r;
+    uint64_t g;
+    uint64_t b;
+} bin_t;
+
+typedef struct
+{
+    float position[3]; // coordinates in the clustering color space
+    float weight;
+    RGB color; // mean color of the pixels in the bin
+    size_t cluster;
+} sample_t;
+
+static size_t quantize_samples(const uint8_t *, size_t, color_space_t, sample_t **);
+static void quantize_position(const RGB *, color_space_t, float *);
+static float quantize_distance(const float *, const float *);
+static size_t quantize_nearest(const float (*)[3], size_t, const float *);
+static size_t quantize_sort_unique(RGB *, size_t);
+
+static void quantize_position(const RGB *color, color_space_t space, float *position)
+{
+    if (space == COLOR_SPACE_OKLAB)
+    {
+        OKLab lab;
+        rgb_to_oklab(color, &lab);
+        position[0] = lab.l;
+        position[1] = lab.a;
+        position[2] = lab.b;
+        return;
+    }
+
+    position[0] = (float)color->r / 255.0f;
+    position[1] = (float)color->g / 255.0f;
+    position[2] = (float)color->b / 255.0f;
+}
+
+static float quantize_distance(const float *p1, const float *p2)
+{
+    // squared euclidean, in OKLab this is oklab_distance
+    float d0 = p1[0] - p2[0];
+    float d1 = p1[1] - p2[1];
+    float d2 = p1[2] - p2[2];
+    return d0 * d0 + d1 * d1 + d2 * d2;
+}
+
+static size_t quantize_nearest(const float (*centers)[3], size_t centers_size, const float *position)
+{
+    size_t nearest = 0;
+    float nearest_distance = quantize_distance(centers[0], position);
+    for (size_t i = 1; i < centers_size; i++)
+    {
+        float distance = quantize_distance(centers[i], position);
+        if (distance < nearest_distance)
+        {
+            nearest = i;
+            nearest_distance = distance;
+        }
+    }
+    return nearest;
+}
+
+static size_t quantize_samples(const uint8_t *pixels, size_t pixels_size, color_space_t space, sample_t **samples)
+{
+    bin_t *bins = safe_calloc(QUANTIZE_BINS, sizeof(bin_t));
+    for (size_t i = 0; i < pixels_size; i++)
+    {
+        const uint8_t *p = &pixels[3 * i];
+        bin_t *bin = &bins[(unsigned int)(p[0] >> (8 - QUANTIZE_BITS)) << (2 * QUANTIZE_BITS) |
+                           (unsigned int)(p[1] >> (8 - QUANTIZE_BITS)) << QUANTIZE_BITS |
+                           (unsigned int)(p[2] >> (8 - QUANTIZE_BITS))];
+        bin->count++;
+        bin->r += p[0];
+        bin->g += p[1];
+        bin->b += p[2];
+    }
+
+    size_t samples_size = 0;
+    for (size_t i = 0; i < QUANTIZE_BINS; i++)
+    {
+        samples_size += bins[i].count != 0;
+    }
+
+    *samples = safe_calloc(samples_size, sizeof(sample_t));
+    size_t j = 0;
+    for (size_t i = 0; i < QUANTIZE_BINS; i++)
+    {
+        const bin_t *bin = &bins[i];
+        if (bin->count == 0)
+        {
+            continue;
+        }
+
+        sample_t *sample = &(*samples)[j++];
+        sample->weight = (float)bin->count;
+        sample->color = (RGB){
+            .r = (unsigned int)((bin->r + bin->count / 2) / bin->count),
+            .g = (unsigned int)((bin->g + bin->count / 2) / bin->count),
+            .b = (unsigned int)((bin->b + bin->count / 2) / bin->count),
+        };
+        quantize_position(&sample->color, space, sample->position);
+    }
+
+    free(bins);
+    return samples_size;
+}
+
+static size_t quantize_sort_unique(RGB *colors, size_t colors_size)
+{
+    // darkest first, the extracted palette is expected in that order
+    float lightness[colors_size];
+    for (size_t i = 0; i < colors_size; i++)
+    {
+        OKLab lab;
+        rgb_to_oklab(&colors[i], &lab);
+        lightness[i] = lab.l;
+    }
+
+    for (size_t i = 1; i < colors_size; i++)
+    {
+        RGB color = colors[i];
+        float l = lightness[i];
+        size_t j = i;
+        while (j > 0 && lightness[j - 1] > l)
+        {
+            colors[j] = colors[j - 1];
+            lightness[j] = lightness[j - 1];
+            j--;
+        }
+        colors[j] = color;
+        lightness[j] = l;
+    }
+
+    size_t unique_size = 0;
+    for (size_t i = 0; i < colors_size; i++)
+    {
+        bool duplicate = false;
+        for (size_t j = 0; j < unique_size; j++)
+        {
+            duplicate |= colors[j].r == colors[i].r && colors[j].g == colors[i].g && colors[j].b == colors[i].b;
+        }
+        if (!duplicate)
+        {
+            colors[unique_size++] = colors[i];
+        }
+    }
+    return unique_size;
+}
+
+size_t quantize_kmeans(const uint8_t *pixels, size_t pixels_size, color_space_t space, RGB *colors,
+                       size_t colors_size)
+{
+    sample_t *samples;
+    size_t samples_size = quantize_samples(pixels, pixels_size, space, &samples);
+    if (samples_size <= colors_size)
+    {
+        for (size_t i = 0; i < samples_size; i++)
+        {
+            colors[i] = samples[i].color;
+        }
+        free(samples);
+        return quantize_sort_unique(colors, samples_size);
+    }
+
+    // deterministic seeding: the most common bin, then always the bin farthest from all centers weighted by size
+    float(*centers)[3] = safe_calloc(colors_size, sizeof(*centers));
+    float *nearest_distance = safe_calloc(samples_size, sizeof(float));
+    size_t first = 0;
+    for (size_t i = 1; i < samples_size; i++)
+    {
+        if (samples[i].weight > samples[first].weight)
+            first = i;
+    }
+    memcpy(centers[0], samples[first].position, sizeof(centers[0]));
+
+    size_t centers_size = 1;
+    for (size_t i = 0; i < samples_size; i++)
+    {
+        nearest_distance[i] = quantize_distance(centers[0], samples[i].position);
+    }
+    while (centers_size < colors_size)
+    {
+        size_t farthest = 0;
+        float farthest_score = 0.0f;
+        for (size_t i = 0; i < samples_size; i++)
+        {
+            float score = nearest_distance[i] * samples[i].weight;
+            if (score > farthest_score)
+            {
+                farthest = i;
+                farthest_score = score;
+            }
+        }
+        if (farthest_score == 0.0f)
+        {
+            break;
+        }
+
+        memcpy(centers[centers_size], samples[farthest].position, sizeof(centers[0]));
+        for (size_t i = 0; i < samples_size; i++)
+        {
+            float distance = quantize_distance(centers[centers_size], samples[i].position);
+            if (distance < nearest_distance[i])
+                nearest_distance[i] = distance;
+        }
+        centers_size++;
+    }
+    free(nearest_distance);
+
+    // lloyd iterations until no bin changes its cluster
+    float(*sums)[4] = safe_calloc(centers_size, sizeof(*sums));
+    for (size_t i = 0; i < samples_size; i++)
+    {
+        samples[i].cluster = SIZE_MAX;
+    }
+    for (int iteration = 0; iteration < QUANTIZE_ITERATIONS; iteration++)
+    {
+        bool changed = false;
+        memset(sums, 0, centers_size * sizeof(*sums));
+        for (size_t i = 0; i < samples_size; i++)
+        {
+            sample_t *sample = &samples[i];
+            size_t cluster = quantize_nearest((const float(*)[3])centers, centers_size, sample->position);
+            changed |= cluster != sample->cluster;
+            sample->cluster = cluster;
+            for (int c = 0; c < 3; c++)
+            {
+                sums[cluster][c] += sample->position[c] * sample->weight;
+            }
+            sums[cluster][3] += sample->weight;
+        }
+
+        if (!changed)
+        {
+            break;
+        }
+
+        for (size_t i = 0; i < centers_size; i++)
+        {
+            if (sums[i][3] == 0.0f)
+            {
+                continue; // keep empty clusters where they are
+            }
+            for (int c = 0; c < 3; c++)
+            {
+                centers[i][c] = sums[i][c] / sums[i][3];
+            }
+        }
+    }
+
+    for (size_t i = 0; i < centers_size; i++)
+    {
+        if (space == COLOR_SPACE_OKLAB)
+        {
+            OKLab lab = {.l = centers[i][0], .a = centers[i][1], .b = centers[i][2]};
+            oklab_to_rgb(&lab, &colors[i]);
+        }
+        else
+        {
+            colors[i] = (RGB){
+                .r = (unsigned int)(centers[i][0] * 255.0f + 0.5f),
+                .g = (unsigned int)(centers[i][1] * 255.0f + 0.5f),
+                .b = (unsigned int)(centers[i][2] * 255.0f + 0.5f),
+            };
+        }
+    }
+
+    free(sums);
+    free(centers);
+    free(samples);
+    return quantize_sort_unique(colors, centers_size);
+}
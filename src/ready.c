@@ -0,0 +1,172 @@
+#include "ready.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "process.h"
+#include "util.h"
+
+// /proc has no change notification, processes are looked for this often
+#define READY_PROCESS_INTERVAL_MS 20
+// pause between two runs of a failing ready command
+#define READY_COMMAND_INTERVAL_MS 50
+
+static int ready_remaining_ms(const ready_mark_t *, int);
+static bool ready_wait_process(const ready_t *, const ready_mark_t *);
+static bool ready_file_written(const char *, const ready_mark_t *);
+static bool ready_wait_file(const ready_t *, const ready_mark_t *);
+static bool ready_wait_command(const ready_t *, const ready_mark_t *);
+static void sleep_ms(int);
+
+void ready_mark(ready_mark_t *mark)
+{
+    clock_gettime(CLOCK_BOOTTIME, &mark->boottime);
+    clock_gettime(CLOCK_REALTIME, &mark->realtime);
+}
+
+static int ready_remaining_ms(const ready_mark_t *mark, int timeout_ms)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_BOOTTIME, &now);
+    long long elapsed_ms =
+        (now.tv_sec - mark->boottime.tv_sec) * 1000LL + (now.tv_nsec - mark->boottime.tv_nsec) / 1000000;
+    return elapsed_ms >= timeout_ms ? 0 : (int)(timeout_ms - elapsed_ms);
+}
+
+static void sleep_ms(int ms)
+{
+    struct timespec ts = {.tv_sec = ms / 1000, .tv_nsec = (ms % 1000) * 1000000L};
+    while (nanosleep(&ts, &ts) == -1 && errno == EINTR)
+        ;
+}
+
+static bool ready_wait_process(const ready_t *ready, const ready_mark_t *mark)
+{
+    // start times are clock ticks since boot
+    long ticks = sysconf(_SC_CLK_TCK);
+    unsigned long long since = (unsigned long long)mark->boottime.tv_sec * (unsigned long long)ticks +
+                               (unsigned long long)mark->boottime.tv_nsec * (unsigned long long)ticks / 1000000000ULL;
+
+    tracked_process_t process;
+    int remaining;
+    while (!process_find_started_after(ready->target, since, &process))
+    {
+        if ((remaining = ready_remaining_ms(mark, ready->timeout_ms)) == 0)
+        {
+            return false;
+        }
+        sleep_ms(remaining < READY_PROCESS_INTERVAL_MS ? remaining : READY_PROCESS_INTERVAL_MS);
+    }
+    return true;
+}
+
+static bool ready_file_written(const char *path, const ready_mark_t *mark)
+{
+    struct stat st;
+    if (stat(path, &st) == -1)
+    {
+        return false;
+    }
+    return st.st_mtim.tv_sec > mark->realtime.tv_sec ||
+           (st.st_mtim.tv_sec == mark->realtime.tv_sec && st.st_mtim.tv_nsec >= mark->realtime.tv_nsec);
+}
+
+static bool ready_wait_file(const ready_t *ready, const ready_mark_t *mark)
+{
+    // watch the directory, the file itself may not exist yet
+    char *dir = strdup(ready->target);
+    int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd == -1 || inotify_add_watch(fd, dirname(dir), IN_CREATE | IN_MOVED_TO | IN_CLOSE_WRITE | IN_ATTRIB) == -1)
+    {
+        die("inotify failed for %s:", ready->target);
+    }
+    free(dir);
+
+    bool ready_now;
+    int remaining;
+    while (!(ready_now = ready_file_written(ready->target, mark)) &&
+           (remaining = ready_remaining_ms(mark, ready->timeout_ms)) > 0)
+    {
+        struct pollfd pfd = {.fd = fd, .events = POLLIN};
+        if (poll(&pfd, 1, remaining) > 0)
+        {
+            // the events only say something changed, the stat above decides
+            char buffer[4096];
+            while (read(fd, buffer, sizeof(buffer)) > 0)
+                ;
+        }
+    }
+
+    close(fd);
+    return ready_now;
+}
+
+static bool ready_wait_command(const ready_t *ready, const ready_mark_t *mark)
+{
+    for (;;)
+    {
+        fflush(NULL);
+        pid_t pid = fork();
+        if (pid == -1)
+        {
+            die("fork failed:");
+        }
+        if (pid == 0)
+        {
+            setpgid(0, 0);
+            if (freopen("/dev/null", "r", stdin) == NULL || freopen("/dev/null", "w", stdout) == NULL ||
+                freopen("/dev/null", "w", stderr) == NULL)
+            {
+                die("freopen failed");
+            }
+            execv("/bin/sh", (char *[]){"sh", "-c", ready->target, NULL});
+            die("execv failed:");
+        }
+        setpgid(pid, pid);
+
+        // a hanging probe counts as not ready
+        int status;
+        if (!process_wait(pid, ready_remaining_ms(mark, ready->timeout_ms), &status))
+        {
+            kill(-pid, SIGKILL);
+            process_wait(pid, -1, &status);
+            return false;
+        }
+        if (WIFEXITED(status) && WEXITSTATUS(status) == 0)
+        {
+            return true;
+        }
+
+        int remaining = ready_remaining_ms(mark, ready->timeout_ms);
+        if (remaining == 0)
+        {
+            return false;
+        }
+        sleep_ms(remaining < READY_COMMAND_INTERVAL_MS ? remaining : READY_COMMAND_INTERVAL_MS);
+    }
+}
+
+bool ready_wait(const ready_t *ready, const ready_mark_t *mark)
+{
+    switch (ready->type)
+    {
+    case READY_PROCESS:
+        return ready_wait_process(ready, mark);
+    case READY_FILE:
+        return ready_wait_file(ready, mark);
+    case READY_COMMAND:
+        return ready_wait_command(ready, mark);
+    default:
+        return true;
+    }
+}
@@ -0,0 +1,196 @@
+#include "replace.h"
+
+#include <ctype.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "util.h"
+
+static unsigned char replacer_fold(unsigned char);
+static bool replacer_bounded(const replacer_t *, int32_t, const char *, size_t, size_t, size_t);
+
+// the automaton only knows lowercase hex letters
+static unsigned char replacer_fold(unsigned char c)
+{
+    return c >= 'A' && c <= 'F' ? (unsigned char)(c - 'A' + 'a') : c;
+}
+
+void replacer_init(replacer_t *replacer, const char *const *patterns, const char *const *replacements, size_t size)
+{
+    size_t states_max = 1;
+    for (size_t i = 0; i < size; i++)
+    {
+        if (patterns[i][0] == '\0')
+        {
+            die("Error: empty replacement pattern");
+        }
+        states_max += strlen(patterns[i]);
+    }
+
+    replacer->size = size;
+    replacer->next = safe_calloc(states_max, sizeof(*replacer->next));
+    replacer->match = safe_malloc(states_max * sizeof(int32_t));
+    replacer->output = safe_calloc(states_max, sizeof(int32_t));
+    replacer->depth = safe_calloc(states_max, sizeof(int32_t));
+    replacer->hex_edges = safe_calloc(size, sizeof(unsigned char));
+    replacer->replacements = safe_calloc(size, sizeof(char *));
+    replacer->pattern_lengths = safe_calloc(size, sizeof(size_t));
+    replacer->replacement_lengths = safe_calloc(size, sizeof(size_t));
+    for (size_t i = 0; i < states_max; i++)
+    {
+        replacer->match[i] = -1;
+    }
+
+    // trie of all patterns, 0 means no edge while building since nothing points back to the root
+    size_t states_size = 1;
+    for (size_t i = 0; i < size; i++)
+    {
+        int32_t state = 0;
+        for (const unsigned char *c = (const unsigned char *)patterns[i]; *c != '\0'; c++)
+        {
+            unsigned char folded = replacer_fold(*c);
+            if (replacer->next[state][folded] == 0)
+            {
+                replacer->next[state][folded] = (int32_t)states_size;
+                replacer->depth[states_size++] = replacer->depth[state] + 1;
+            }
+            state = replacer->next[state][folded];
+        }
+        if (replacer->match[state] == -1)
+        {
+            replacer->match[state] = (int32_t)i;
+        }
+
+        replacer->replacements[i] = strdup(replacements[i]);
+        replacer->pattern_lengths[i] = strlen(patterns[i]);
+        replacer->replacement_lengths[i] = strlen(replacements[i]);
+        replacer->hex_edges[i] =
+            (unsigned char)((isxdigit((unsigned char)patterns[i][0]) ? REPLACER_HEX_START : 0) |
+                            (isxdigit((unsigned char)patterns[i][replacer->pattern_lengths[i] - 1]) ? REPLACER_HEX_END
+                                                                                                     : 0));
+    }
+
+    // breadth first, fill the missing edges from the failure state and link to the matches along it
+    int32_t *fail = safe_calloc(states_size, sizeof(int32_t));
+    int32_t *queue = safe_malloc(states_size * sizeof(int32_t));
+    size_t head = 0, tail = 0;
+    queue[tail++] = 0;
+    while (head < tail)
+    {
+        int32_t state = queue[head++];
+        for (int c = 0; c < 256; c++)
+        {
+            int32_t child = replacer->next[state][c];
+            if (child == 0)
+            {
+                replacer->next[state][c] = replacer->next[fail[state]][c];
+                continue;
+            }
+
+            fail[child] = state == 0 ? 0 : replacer->next[fail[state]][c];
+            replacer->output[child] = replacer->match[fail[child]] != -1 ? fail[child] : replacer->output[fail[child]];
+            queue[tail++] = child;
+        }
+    }
+    for (size_t state = 0; state < states_size; state++)
+    {
+        for (int c = 'A'; c <= 'F'; c++)
+        {
+            replacer->next[state][c] = replacer->next[state][c - 'A' + 'a'];
+        }
+    }
+    replacer->states_size = states_size;
+
+    free(queue);
+    free(fail);
+}
+
+// a color like #abc must not replace the start of #abcdef
+static bool replacer_bounded(const replacer_t *replacer, int32_t match, const char *text, size_t size, size_t start,
+                             size_t end)
+{
+    if ((replacer->hex_edges[match] & REPLACER_HEX_START) && start > 0 && isxdigit((unsigned char)text[start - 1]))
+    {
+        return false;
+    }
+    if ((replacer->hex_edges[match] & REPLACER_HEX_END) && end < size && isxdigit((unsigned char)text[end]))
+    {
+        return false;
+    }
+    return true;
+}
+
+size_t replacer_apply(const replacer_t *replacer, const char *text, size_t size, FILE *file, uint64_t *matched)
+{
+    // matches never overlap, scanning restarts after the one taken
+    if (matched != NULL)
+    {
+        memset(matched, 0, REPLACER_SLOT_WORDS(replacer->size) * sizeof(uint64_t));
+    }
+    size_t replaced = 0;
+    size_t written = 0;
+    int32_t state = 0;
+    int32_t best = -1; // leftmost, then longest match seen since the last one taken
+    size_t best_start = 0;
+    size_t i = 0;
+    while (i < size)
+    {
+        state = replacer->next[state][(unsigned char)text[i]];
+        i++;
+
+        // every pattern ending here, longest first, so the first one that fits starts leftmost
+        for (int32_t s = replacer->match[state] != -1 ? state : replacer->output[state]; s != 0;
+             s = replacer->output[s])
+        {
+            int32_t match = replacer->match[s];
+            size_t start = i - replacer->pattern_lengths[match];
+            if (!replacer_bounded(replacer, match, text, size, start, i))
+            {
+                continue;
+            }
+            if (best == -1 || start <= best_start)
+            {
+                best = match;
+                best_start = start;
+            }
+            break;
+        }
+
+        // take it once nothing still being matched could start at or before it
+        if (best == -1 || (i - (size_t)replacer->depth[state] <= best_start && i < size))
+        {
+            continue;
+        }
+        fwrite(text + written, 1, best_start - written, file);
+        fwrite(replacer->replacements[best], 1, replacer->replacement_lengths[best], file);
+        written = best_start + replacer->pattern_lengths[best];
+        i = written;
+        state = 0;
+        replaced++;
+        if (matched != NULL)
+        {
+            matched[best / 64] |= 1ull << (best % 64);
+        }
+        best = -1;
+    }
+    fwrite(text + written, 1, size - written, file);
+
+    return replaced;
+}
+
+void replacer_free(replacer_t *replacer)
+{
+    for (size_t i = 0; i < replacer->size; i++)
+    {
+        free(replacer->replacements[i]);
+    }
+    free(replacer->replacements);
+    free(replacer->pattern_lengths);
+    free(replacer->replacement_lengths);
+    free(replacer->hex_edges);
+    free(replacer->depth);
+    free(replacer->output);
+    free(replacer->match);
+    free(replacer->next);
+}
@@ -0,0 +1,130 @@
+#include "request.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <unistd.h>
+
+#include "process.h"
+#include "util.h"
+
+static void request_cancel(int);
+static char *request_token(void);
+static char *request_read(const char *);
+
+// a run holds cache_path/generate.lock while it generates and reloads, the file names the holder.
+// cache_path/request names the newest run, older ones give up as soon as they notice.
+static int lock_fd = -1;
+static volatile sig_atomic_t cancel_signal;
+
+static void request_cancel(int sig)
+{
+    cancel_signal = sig;
+    commands_cancel();
+}
+
+static char *request_token(void)
+{
+    pid_t pid = getpid();
+    return format_string("%d %llu\n", (int)pid, process_start_time(pid));
+}
+
+static char *request_read(const char *path)
+{
+    FILE *file = fopen(path, "r");
+    if (file == NULL)
+    {
+        return NULL;
+    }
+
+    char line[128];
+    char *token = fgets(line, sizeof(line), file) != NULL ? strdup(line) : NULL;
+    fclose(file);
+    return token;
+}
+
+void request_handle_signals(void)
+{
+    // kill the commands of this run along with it, they live in their own process groups
+    struct sigaction action = {.sa_handler = request_cancel, .sa_flags = SA_RESTART};
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    sigaction(SIGUSR1, &action, NULL);
+}
+
+bool request_begin(const char *cache_path)
+{
+    char *token = request_token();
+
+    // announce this run as the newest one
+    char *request_path = format_string("%s/request", cache_path);
+    char *tmp_path = format_string("%s.tmp.%d", request_path, (int)getpid());
+    FILE *file = fopen(tmp_path, "w");
+    if (file == NULL || fputs(token, file) == EOF || fclose(file) != 0)
+    {
+        die("writing to file %s failed:", tmp_path);
+    }
+    if (rename(tmp_path, request_path) != 0)
+    {
+        die("rename failed:");
+    }
+    free(tmp_path);
+
+    // cancel the run in progress, its commands die and it exits at its next step
+    char *lock_path = format_string("%s/generate.lock", cache_path);
+    lock_fd = open(lock_path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (lock_fd == -1)
+    {
+        die("open failed for %s:", lock_path);
+    }
+    free(lock_path);
+
+    char holder[128] = {0};
+    tracked_process_t process;
+    if (pread(lock_fd, holder, sizeof(holder) - 1, 0) > 0 &&
+        sscanf(holder, "%d %llu", &process.pid, &process.start_time) == 2 && process.pid != getpid() &&
+        process_start_time(process.pid) == process.start_time)
+    {
+        kill(process.pid, SIGUSR1);
+    }
+
+    while (flock(lock_fd, LOCK_EX) == -1)
+    {
+        if (errno != EINTR)
+        {
+            die("flock failed:");
+        }
+    }
+
+    // while this run waited another one may have come in, only the newest does the work
+    char *newest = request_read(request_path);
+    bool current = newest != NULL && strcmp(newest, token) == 0;
+    free(newest);
+    free(request_path);
+    if (!current)
+    {
+        free(token);
+        return false;
+    }
+
+    if (ftruncate(lock_fd, 0) == -1 || pwrite(lock_fd, token, strlen(token), 0) == -1)
+    {
+        die("writing to lock file failed:");
+    }
+    free(token);
+    return true;
+}
+
+void request_checkpoint(void)
+{
+    // nothing of a cancelled run becomes visible after this point, a superseded run was not a failure
+    if (commands_cancelled())
+    {
+        exit(cancel_signal == SIGUSR1 ? EXIT_SUCCESS : 128 + cancel_signal);
+    }
+}
@@ -0,0 +1,968 @@
+#define _GNU_SOURCE
+#include "supervisor.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "metrics.h"
+#include "process.h"
+#include "theming_palette.h"
+#include "util.h"
+
+#define SUPERVISOR_BACKOFF_MIN 1  // seconds
+#define SUPERVISOR_BACKOFF_MAX 60 // seconds
+#define SUPERVISOR_STABLE_TIME 30 // a child running this long gets its backoff reset
+#define SUPERVISOR_REQUEST_SIZE 4096 // "reload <command>" carries a whole command line
+#define SUPERVISOR_MAX_EVENTS 8
+#define SUPERVISOR_SUBSCRIBER_QUEUE 16384 // bytes a subscriber may fall behind before it is dropped
+#define SUPERVISOR_STOP_TIMEOUT_MS 2000    // children that outlive SIGTERM this long at shutdown are killed
+
+typedef enum
+{
+    CHILD_STOPPED,
+    CHILD_RUNNING,
+    CHILD_BACKOFF,
+} child_state_t;
+
+typedef struct
+{
+    const command_t *command;
+    pid_t pid;
+    child_state_t state;
+    bool restart_pending; // respawn right away once reaped
+    unsigned int restarts;
+    time_t backoff;
+    time_t started;
+    time_t respawn_at;
+    int last_status;
+} child_t;
+
+typedef enum
+{
+    CLIENT_REQUEST,    // its request line is still coming in
+    CLIENT_REPLY,      // closed once the reply is out
+    CLIENT_SUBSCRIBER, // stays connected to get every palette as a JSON line
+} client_state_t;
+
+// a connection to the socket, never waited on: it is read and written when epoll reports it ready
+typedef struct
+{
+    int fd;
+    client_state_t state;
+    char *request; // SUPERVISOR_REQUEST_SIZE bytes while the request comes in
+    size_t request_size;
+    char *queue; // what the socket did not take yet
+    size_t queue_size;
+    bool input_closed; // it shut down its sending side, it may still read
+} client_t;
+
+typedef struct
+{
+    child_t *children;
+    size_t children_size;
+    client_t *clients;
+    size_t clients_size;
+    size_t subscribers_size;
+    // removed clients are closed after the current batch of events, until then their numbers can not be reused
+    int *removed_fds;
+    size_t removed_fds_size;
+    char *palette_path;
+    int epoll_fd;
+    int timer_fd;
+    sigset_t old_mask; // restored in spawned children
+    bool running;
+} supervisor_t;
+
+static time_t monotonic_now(void);
+static int unix_socket_address(config_t, struct sockaddr_un *);
+static bool is_simple_command(const char *);
+static void spawn_child(supervisor_t *, child_t *);
+static void reap_children(supervisor_t *);
+static void arm_timer(supervisor_t *);
+static void respawn_due(supervisor_t *);
+static void reload_child(supervisor_t *, child_t *);
+static void reload_children(supervisor_t *);
+static void write_status(supervisor_t *, FILE *);
+static void handle_request(supervisor_t *, int, const char *);
+static char *palette_message(const char *);
+static void client_add(supervisor_t *, int);
+static size_t client_find(const supervisor_t *, int);
+static void client_subscribe(supervisor_t *, size_t);
+static void client_remove(supervisor_t *, size_t);
+static void client_close_removed(supervisor_t *);
+static void client_watch(supervisor_t *, const client_t *);
+static bool client_flush(client_t *);
+static void client_send(supervisor_t *, size_t, const char *, size_t);
+static bool client_read_request(supervisor_t *, size_t);
+static void client_event(supervisor_t *, int, uint32_t);
+static void publish_palette(supervisor_t *);
+
+static time_t monotonic_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec;
+}
+
+char *supervisor_socket_path(config_t config)
+{
+    return format_string("%s/theming.sock", config.cache_path);
+}
+
+static int unix_socket_address(config_t config, struct sockaddr_un *addr)
+{
+    char *path = supervisor_socket_path(config);
+    if (strlen(path) >= sizeof(addr->sun_path))
+    {
+        die("Error: socket path %s is too long", path);
+    }
+
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    strcpy(addr->sun_path, path);
+    free(path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1)
+    {
+        die("socket failed:");
+    }
+
+    return fd;
+}
+
+static bool is_simple_command(const char *command)
+{
+    return strpbrk(command, ";&|(){}\n") == NULL;
+}
+
+static void spawn_child(supervisor_t *supervisor, child_t *child)
+{
+    pid_t pid = fork();
+    if (pid == -1)
+    {
+        die("fork failed:");
+    }
+
+    if (pid == 0)
+    {
+        // child process
+
+        if (sigprocmask(SIG_SETMASK, &supervisor->old_mask, NULL) == -1)
+        {
+            die("sigprocmask failed:");
+        }
+        if (setpgid(0, 0) == -1)
+        {
+            die("setpgid failed:");
+        }
+        priority_apply(&child->command->priority, NULL);
+
+        // redirect standard input, output and error to /dev/null
+        if (freopen("/dev/null", "r", stdin) == NULL)
+        {
+            die("freopen failed");
+        }
+        if (freopen("/dev/null", "w", stdout) == NULL)
+        {
+            die("freopen failed");
+        }
+        if (freopen("/dev/null", "w", stderr) == NULL)
+        {
+            die("freopen failed");
+        }
+
+        // let the program replace the shell, so the reload signal reaches it and not sh
+        char *command = is_simple_command(child->command->command) ? format_string("exec %s", child->command->command)
+                                                                    : child->command->command;
+        execv("/bin/sh", (char *[]){"sh", "-c", command, NULL});
+        die("execv failed:");
+    }
+
+    // parent process
+    if (child->state != CHILD_STOPPED)
+    {
+        child->restarts++;
+    }
+    child->pid = pid;
+    child->state = CHILD_RUNNING;
+    child->started = monotonic_now();
+}
+
+static void reap_children(supervisor_t *supervisor)
+{
+    pid_t pid;
+    int status;
+
+    while ((pid = waitpid(-1, &status, WNOHANG)) > 0)
+    {
+        for (size_t i = 0; i < supervisor->children_size; i++)
+        {
+            child_t *child = &supervisor->children[i];
+            if (child->pid != pid)
+            {
+                continue;
+            }
+
+            child->pid = -1;
+            child->last_status = status;
+
+            if (!supervisor->running)
+            {
+                child->state = CHILD_STOPPED;
+            }
+            else if (child->restart_pending)
+            {
+                child->restart_pending = false;
+                spawn_child(supervisor, child);
+            }
+            else
+            {
+                // crashed, back off exponentially unless it was up for a while
+                time_t now = monotonic_now();
+                if (now - child->started >= SUPERVISOR_STABLE_TIME || child->backoff == 0)
+                {
+                    child->backoff = SUPERVISOR_BACKOFF_MIN;
+                }
+                else if (child->backoff < SUPERVISOR_BACKOFF_MAX)
+                {
+                    child->backoff = child->backoff * 2 > SUPERVISOR_BACKOFF_MAX ? SUPERVISOR_BACKOFF_MAX
+                                                                                  : child->backoff * 2;
+                }
+
+                child->state = CHILD_BACKOFF;
+                child->respawn_at = now + child->backoff;
+
+                char *label = metrics_label("command", child->command->command);
+                metrics_add("theming_supervised_crashes_total", label, 1);
+                free(label);
+            }
+            break;
+        }
+    }
+
+    arm_timer(supervisor);
+}
+
+static void arm_timer(supervisor_t *supervisor)
+{
+    time_t next = 0;
+    for (size_t i = 0; i < supervisor->children_size; i++)
+    {
+        const child_t *child = &supervisor->children[i];
+        if (child->state == CHILD_BACKOFF && (next == 0 || child->respawn_at < next))
+        {
+            next = child->respawn_at;
+        }
+    }
+
+    // an all zero it_value disarms the timer
+    struct itimerspec spec = {0};
+    if (next != 0)
+    {
+        time_t now = monotonic_now();
+        spec.it_value.tv_sec = next > now ? next - now : 0;
+        spec.it_value.tv_nsec = next > now ? 0 : 1;
+    }
+
+    if (timerfd_settime(supervisor->timer_fd, 0, &spec, NULL) == -1)
+    {
+        die("timerfd_settime failed:");
+    }
+}
+
+static void respawn_due(supervisor_t *supervisor)
+{
+    time_t now = monotonic_now();
+    for (size_t i = 0; i < supervisor->children_size; i++)
+    {
+        child_t *child = &supervisor->children[i];
+        if (child->state == CHILD_BACKOFF && child->respawn_at <= now)
+        {
+            spawn_child(supervisor, child);
+        }
+    }
+
+    arm_timer(supervisor);
+}
+
+static void reload_child(supervisor_t *supervisor, child_t *child)
+{
+    if (child->state == CHILD_BACKOFF)
+    {
+        spawn_child(supervisor, child);
+    }
+    else if (child->state == CHILD_RUNNING && child->command->reload_signal != 0)
+    {
+        if (kill(child->pid, child->command->reload_signal) == -1 && errno != ESRCH)
+        {
+            die("kill failed:");
+        }
+    }
+    else if (child->state == CHILD_RUNNING && !child->restart_pending)
+    {
+        // no reload signal, restart it once it is gone
+        child->restart_pending = true;
+        kill(-child->pid, SIGTERM);
+    }
+}
+
+static void reload_children(supervisor_t *supervisor)
+{
+    for (size_t i = 0; i < supervisor->children_size; i++)
+    {
+        reload_child(supervisor, &supervisor->children[i]);
+    }
+
+    arm_timer(supervisor);
+}
+
+static void write_status(supervisor_t *supervisor, FILE *output)
+{
+    time_t now = monotonic_now();
+    for (size_t i = 0; i < supervisor->children_size; i++)
+    {
+        const child_t *child = &supervisor->children[i];
+
+        switch (child->state)
+        {
+        case CHILD_RUNNING:
+            fprintf(output, "%s: running pid=%d uptime=%llds restarts=%u\n", child->command->command, (int)child->pid,
+                    (long long)(now - child->started), child->restarts);
+            break;
+        case CHILD_BACKOFF:
+            fprintf(output, "%s: backoff retry_in=%llds restarts=%u last_status=%d\n", child->command->command,
+                    (long long)(child->respawn_at - now), child->restarts,
+                    WIFEXITED(child->last_status) ? WEXITSTATUS(child->last_status)
+                                                  : 128 + WTERMSIG(child->last_status));
+            break;
+        case CHILD_STOPPED:
+            fprintf(output, "%s: stopped\n", child->command->command);
+            break;
+        }
+    }
+}
+
+// the reply goes out through the client queue. the request may have reordered the clients, so it is looked up again
+static void handle_request(supervisor_t *supervisor, int fd, const char *request)
+{
+    char *reply = NULL;
+    size_t reply_size = 0;
+    FILE *output = open_memstream(&reply, &reply_size);
+    if (output == NULL)
+    {
+        die("open_memstream failed:");
+    }
+
+    bool subscribe = false;
+    if (strcmp(request, "reload") == 0)
+    {
+        reload_children(supervisor);
+        fprintf(output, "ok\n");
+    }
+    else if (strncmp(request, "reload ", 7) == 0)
+    {
+        child_t *child = NULL;
+        for (size_t i = 0; i < supervisor->children_size && child == NULL; i++)
+        {
+            if (strcmp(supervisor->children[i].command->command, request + 7) == 0)
+            {
+                child = &supervisor->children[i];
+            }
+        }
+        if (child != NULL)
+        {
+            reload_child(supervisor, child);
+            arm_timer(supervisor);
+            fprintf(output, "ok\n");
+        }
+        else
+        {
+            fprintf(output, "error: %s is not supervised\n", request + 7);
+        }
+    }
+    else if (strcmp(request, "subscribe") == 0)
+    {
+        subscribe = true;
+    }
+    else if (strcmp(request, "palette") == 0)
+    {
+        publish_palette(supervisor);
+        fprintf(output, "ok\n");
+    }
+    else if (strcmp(request, "status") == 0)
+    {
+        write_status(supervisor, output);
+    }
+    else
+    {
+        fprintf(output, "error: unknown request %s\n", request);
+    }
+    fclose(output);
+
+    size_t index = client_find(supervisor, fd);
+    if (index < supervisor->clients_size && subscribe)
+    {
+        client_subscribe(supervisor, index);
+    }
+    else if (index < supervisor->clients_size)
+    {
+        supervisor->clients[index].state = CLIENT_REPLY;
+        client_send(supervisor, index, reply, reply_size);
+    }
+    free(reply);
+}
+
+static char *palette_message(const char *path)
+{
+    theming_palette_map_t map;
+    if (theming_palette_open(path, &map) != 0)
+    {
+        return NULL;
+    }
+    theming_palette_t palette;
+    uint32_t sequence;
+    int rv = theming_palette_read(&map, &palette, &sequence);
+    theming_palette_close(&map);
+    if (rv != 0)
+    {
+        return NULL;
+    }
+
+    // one line, so clients can read it with anything that reads lines
+    char colors[16 * 11];
+    size_t used = 0;
+    for (size_t i = 0; i < 16; i++)
+    {
+        const theming_palette_color_t *c = &palette.colors[i];
+        used += (size_t)snprintf(colors + used, sizeof(colors) - used, "%s\"#%02x%02x%02x\"", i > 0 ? "," : "", c->r,
+                                 c->g, c->b);
+    }
+    return format_string("{\"sequence\":%u,\"generation\":%llu,\"variant\":\"%s\",\"colors\":[%s],"
+                         "\"foreground\":\"#%02x%02x%02x\",\"background\":\"#%02x%02x%02x\","
+                         "\"cursor\":\"#%02x%02x%02x\"}\n",
+                         sequence, (unsigned long long)palette.generation, palette.dark ? "dark" : "light", colors,
+                         palette.foreground.r, palette.foreground.g, palette.foreground.b, palette.background.r,
+                         palette.background.g, palette.background.b, palette.cursor.r, palette.cursor.g,
+                         palette.cursor.b);
+}
+
+static void client_add(supervisor_t *supervisor, int fd)
+{
+    // the loop never waits on it
+    if (fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) == -1)
+    {
+        die("fcntl failed:");
+    }
+
+    struct epoll_event event = {.events = EPOLLIN | EPOLLRDHUP, .data.fd = fd};
+    if (epoll_ctl(supervisor->epoll_fd, EPOLL_CTL_ADD, fd, &event) == -1)
+    {
+        die("epoll_ctl failed:");
+    }
+
+    supervisor->clients = safe_realloc(supervisor->clients, (supervisor->clients_size + 1) * sizeof(client_t));
+    supervisor->clients[supervisor->clients_size++] =
+        (client_t){.fd = fd, .state = CLIENT_REQUEST, .request = safe_malloc(SUPERVISOR_REQUEST_SIZE)};
+}
+
+// clients_size if it is not connected any more
+static size_t client_find(const supervisor_t *supervisor, int fd)
+{
+    size_t index = 0;
+    while (index < supervisor->clients_size && supervisor->clients[index].fd != fd)
+        index++;
+    return index;
+}
+
+static void client_subscribe(supervisor_t *supervisor, size_t index)
+{
+    supervisor->clients[index].state = CLIENT_SUBSCRIBER;
+    supervisor->subscribers_size++;
+    metrics_set("theming_subscribers", "", (double)supervisor->subscribers_size);
+
+    // start it off with the palette in use
+    char *message = palette_message(supervisor->palette_path);
+    if (message != NULL)
+    {
+        client_send(supervisor, index, message, strlen(message));
+        free(message);
+    }
+}
+
+static void client_remove(supervisor_t *supervisor, size_t index)
+{
+    client_t *client = &supervisor->clients[index];
+    epoll_ctl(supervisor->epoll_fd, EPOLL_CTL_DEL, client->fd, NULL);
+    supervisor->removed_fds =
+        safe_realloc(supervisor->removed_fds, (supervisor->removed_fds_size + 1) * sizeof(int));
+    supervisor->removed_fds[supervisor->removed_fds_size++] = client->fd;
+    if (client->state == CLIENT_SUBSCRIBER)
+    {
+        supervisor->subscribers_size--;
+        metrics_set("theming_subscribers", "", (double)supervisor->subscribers_size);
+    }
+    free(client->request);
+    free(client->queue);
+    supervisor->clients[index] = supervisor->clients[--supervisor->clients_size];
+}
+
+static void client_close_removed(supervisor_t *supervisor)
+{
+    for (size_t i = 0; i < supervisor->removed_fds_size; i++)
+    {
+        close(supervisor->removed_fds[i]);
+    }
+    supervisor->removed_fds_size = 0;
+}
+
+static void client_watch(supervisor_t *supervisor, const client_t *client)
+{
+    // hangups and errors are reported without asking
+    struct epoll_event event = {.data.fd = client->fd};
+    if (!client->input_closed)
+    {
+        event.events |= EPOLLIN | EPOLLRDHUP;
+    }
+    if (client->queue_size > 0)
+    {
+        event.events |= EPOLLOUT;
+    }
+    epoll_ctl(supervisor->epoll_fd, EPOLL_CTL_MOD, client->fd, &event);
+}
+
+// false if the client is gone
+static bool client_flush(client_t *client)
+{
+    size_t sent = 0;
+    while (sent < client->queue_size)
+    {
+        ssize_t len = send(client->fd, client->queue + sent, client->queue_size - sent, MSG_NOSIGNAL);
+        if (len == -1 && errno == EINTR)
+            continue;
+        if (len == -1 && errno == EAGAIN)
+            break;
+        if (len <= 0)
+            return false;
+        sent += (size_t)len;
+    }
+
+    memmove(client->queue, client->queue + sent, client->queue_size - sent);
+    client->queue_size -= sent;
+    return true;
+}
+
+static void client_send(supervisor_t *supervisor, size_t index, const char *message, size_t size)
+{
+    client_t *client = &supervisor->clients[index];
+
+    // a subscriber that does not keep up is dropped instead of buffering without bound
+    if (client->state == CLIENT_SUBSCRIBER && client->queue_size + size > SUPERVISOR_SUBSCRIBER_QUEUE)
+    {
+        client_remove(supervisor, index);
+        return;
+    }
+
+    bool was_empty = client->queue_size == 0;
+    client->queue = safe_realloc(client->queue, client->queue_size + size);
+    memcpy(client->queue + client->queue_size, message, size);
+    client->queue_size += size;
+
+    // a reply that is out is the end of the connection
+    if (!client_flush(client) || (client->state == CLIENT_REPLY && client->queue_size == 0))
+    {
+        client_remove(supervisor, index);
+        return;
+    }
+
+    // the rest goes out when the socket has room again
+    if (was_empty && client->queue_size > 0)
+    {
+        client_watch(supervisor, client);
+    }
+}
+
+// true once the request is complete: a whole line, the end of the input or as much as fits. false while more is to
+// come or if the client is gone
+static bool client_read_request(supervisor_t *supervisor, size_t index)
+{
+    client_t *client = &supervisor->clients[index];
+    while (client->request_size < SUPERVISOR_REQUEST_SIZE - 1)
+    {
+        ssize_t len = recv(client->fd, client->request + client->request_size,
+                           SUPERVISOR_REQUEST_SIZE - 1 - client->request_size, 0);
+        if (len > 0)
+        {
+            bool newline = memchr(client->request + client->request_size, '\n', (size_t)len) != NULL;
+            client->request_size += (size_t)len;
+            if (newline)
+            {
+                return true;
+            }
+        }
+        else if (len == 0)
+        {
+            client->input_closed = true;
+            client_watch(supervisor, client);
+            return true;
+        }
+        else if (errno == EAGAIN)
+        {
+            return false;
+        }
+        else if (errno != EINTR)
+        {
+            client_remove(supervisor, index);
+            return false;
+        }
+    }
+    return true;
+}
+
+static void client_event(supervisor_t *supervisor, int fd, uint32_t events)
+{
+    size_t index = client_find(supervisor, fd);
+    if (index == supervisor->clients_size)
+    {
+        return;
+    }
+    client_t *client = &supervisor->clients[index];
+
+    // a request that came in right before a hangup is still served, only its reply goes nowhere
+    if (client->state == CLIENT_REQUEST)
+    {
+        if (client_read_request(supervisor, index))
+        {
+            char *request = client->request;
+            request[client->request_size] = '\0';
+            request[strcspn(request, "\n")] = '\0';
+            client->request = NULL;
+            handle_request(supervisor, fd, request);
+            free(request);
+        }
+        return;
+    }
+
+    // only a connection that is gone ends a subscription
+    if (events & (EPOLLHUP | EPOLLERR))
+    {
+        client_remove(supervisor, index);
+        return;
+    }
+
+    // past the request clients have nothing to say, what they send is dropped. one that shut down its sending side
+    // (e.g. `socat -u`) still reads, it is only not watched for input any more
+    if (events & (EPOLLIN | EPOLLRDHUP))
+    {
+        char buffer[64];
+        ssize_t len;
+        while ((len = recv(fd, buffer, sizeof(buffer), 0)) > 0)
+        {
+        }
+        if (len == 0)
+        {
+            client->input_closed = true;
+            client_watch(supervisor, client);
+        }
+        else if (errno != EAGAIN && errno != EINTR)
+        {
+            client_remove(supervisor, index);
+            return;
+        }
+    }
+
+    if (events & EPOLLOUT)
+    {
+        if (!client_flush(client) || (client->state == CLIENT_REPLY && client->queue_size == 0))
+        {
+            client_remove(supervisor, index);
+            return;
+        }
+        if (client->queue_size == 0)
+        {
+            client_watch(supervisor, client);
+        }
+    }
+}
+
+static void publish_palette(supervisor_t *supervisor)
+{
+    char *message = palette_message(supervisor->palette_path);
+    if (message == NULL)
+    {
+        return;
+    }
+
+    // backwards, removing a client moves the last one into its slot
+    size_t size = strlen(message);
+    for (size_t i = supervisor->clients_size; i > 0; i--)
+    {
+        if (supervisor->clients[i - 1].state == CLIENT_SUBSCRIBER)
+        {
+            client_send(supervisor, i - 1, message, size);
+        }
+    }
+    free(message);
+}
+
+void supervisor_run(config_t config)
+{
+    supervisor_t supervisor = {.running = true, .palette_path = format_string("%s/palette.bin", config.cache_path)};
+
+    // signals are handled through a signalfd in the event loop
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigaddset(&mask, SIGTERM);
+    sigaddset(&mask, SIGINT);
+    if (sigprocmask(SIG_BLOCK, &mask, &supervisor.old_mask) == -1)
+    {
+        die("sigprocmask failed:");
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    int signal_fd = signalfd(-1, &mask, SFD_CLOEXEC | SFD_NONBLOCK);
+    if (signal_fd == -1)
+    {
+        die("signalfd failed:");
+    }
+
+    supervisor.timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+    if (supervisor.timer_fd == -1)
+    {
+        die("timerfd_create failed:");
+    }
+
+    // the daemon never exits on its own, what it counted is merged into the textfile periodically
+    int metrics_fd = -1;
+    if (config.metrics_path != NULL)
+    {
+        metrics_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+        struct itimerspec spec = {.it_interval.tv_sec = METRICS_FLUSH_INTERVAL,
+                                  .it_value.tv_sec = METRICS_FLUSH_INTERVAL};
+        if (metrics_fd == -1 || timerfd_settime(metrics_fd, 0, &spec, NULL) == -1)
+        {
+            die("timerfd failed:");
+        }
+    }
+
+    struct sockaddr_un addr;
+    int listen_fd = unix_socket_address(config, &addr);
+    if (connect(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) == 0)
+    {
+        die("Error: theming daemon is already running");
+    }
+    unlink(addr.sun_path); // stale socket of a dead daemon
+    if (bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) == -1)
+    {
+        die("bind failed:");
+    }
+    if (listen(listen_fd, 16) == -1)
+    {
+        die("listen failed:");
+    }
+
+    int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd == -1)
+    {
+        die("epoll_create1 failed:");
+    }
+    supervisor.epoll_fd = epoll_fd;
+    int fds[] = {signal_fd, supervisor.timer_fd, listen_fd, metrics_fd};
+    for (size_t i = 0; i < sizeof(fds) / sizeof(fds[0]); i++)
+    {
+        if (fds[i] == -1)
+        {
+            continue;
+        }
+        struct epoll_event event = {.events = EPOLLIN, .data.fd = fds[i]};
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fds[i], &event) == -1)
+        {
+            die("epoll_ctl failed:");
+        }
+    }
+
+    // take over restart commands, replacing instances spawned by previous reloads
+    char *state_path = format_string("%s/pids", config.cache_path);
+    supervisor.children = safe_calloc(config.reload_commands_size, sizeof(child_t));
+    for (size_t i = 0; i < config.reload_commands_size; i++)
+    {
+        if (!config.reload_commands[i].restart)
+        {
+            continue;
+        }
+
+        child_t *child = &supervisor.children[supervisor.children_size++];
+        *child = (child_t){.command = &config.reload_commands[i], .pid = -1, .state = CHILD_STOPPED};
+
+        process_terminate_command(state_path, child->command->command, child->command->process_name);
+        spawn_child(&supervisor, child);
+    }
+    free(state_path);
+
+    while (supervisor.running)
+    {
+        struct epoll_event events[SUPERVISOR_MAX_EVENTS];
+        int n = epoll_wait(epoll_fd, events, SUPERVISOR_MAX_EVENTS, -1);
+        if (n == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            die("epoll_wait failed:");
+        }
+
+        for (int i = 0; i < n; i++)
+        {
+            int fd = events[i].data.fd;
+
+            if (fd == signal_fd)
+            {
+                struct signalfd_siginfo info;
+                while (read(signal_fd, &info, sizeof(info)) == sizeof(info))
+                {
+                    if (info.ssi_signo == SIGTERM || info.ssi_signo == SIGINT)
+                    {
+                        supervisor.running = false;
+                    }
+                }
+                reap_children(&supervisor);
+            }
+            else if (fd == supervisor.timer_fd)
+            {
+                uint64_t expirations;
+                if (read(supervisor.timer_fd, &expirations, sizeof(expirations)) == sizeof(expirations))
+                {
+                    respawn_due(&supervisor);
+                }
+            }
+            else if (fd == metrics_fd)
+            {
+                uint64_t expirations;
+                if (read(metrics_fd, &expirations, sizeof(expirations)) == sizeof(expirations) && metrics_pending())
+                {
+                    metrics_flush();
+                }
+            }
+            else if (fd == listen_fd)
+            {
+                int client_fd = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+                if (client_fd != -1)
+                {
+                    client_add(&supervisor, client_fd);
+                }
+            }
+            else
+            {
+                client_event(&supervisor, fd, events[i].events);
+            }
+        }
+        client_close_removed(&supervisor);
+    }
+
+    // shut down: stop all children together, one that ignores SIGTERM must not keep the daemon from exiting
+    for (size_t i = 0; i < supervisor.children_size; i++)
+    {
+        if (supervisor.children[i].state == CHILD_RUNNING)
+        {
+            kill(-supervisor.children[i].pid, SIGTERM);
+        }
+    }
+    struct timespec stop_start;
+    clock_gettime(CLOCK_MONOTONIC, &stop_start);
+    for (size_t i = 0; i < supervisor.children_size; i++)
+    {
+        child_t *child = &supervisor.children[i];
+        if (child->state != CHILD_RUNNING)
+        {
+            continue;
+        }
+
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        long long elapsed_ms =
+            (now.tv_sec - stop_start.tv_sec) * 1000LL + (now.tv_nsec - stop_start.tv_nsec) / 1000000;
+        int remaining_ms =
+            elapsed_ms >= SUPERVISOR_STOP_TIMEOUT_MS ? 0 : (int)(SUPERVISOR_STOP_TIMEOUT_MS - elapsed_ms);
+        if (!process_wait(child->pid, remaining_ms, NULL))
+        {
+            kill(-child->pid, SIGKILL);
+            process_wait(child->pid, -1, NULL);
+        }
+        child->state = CHILD_STOPPED;
+    }
+
+    for (size_t i = supervisor.clients_size; i > 0; i--)
+    {
+        client_remove(&supervisor, i - 1);
+    }
+    client_close_removed(&supervisor);
+    free(supervisor.clients);
+    free(supervisor.removed_fds);
+    free(supervisor.palette_path);
+
+    unlink(addr.sun_path);
+    close(listen_fd);
+    close(epoll_fd);
+    close(supervisor.timer_fd);
+    close(signal_fd);
+    if (metrics_fd != -1)
+    {
+        close(metrics_fd);
+    }
+    free(supervisor.children);
+
+    if (sigprocmask(SIG_SETMASK, &supervisor.old_mask, NULL) == -1)
+    {
+        die("sigprocmask failed:");
+    }
+}
+
+// false when no daemon runs or it could not serve the request
+bool supervisor_request(config_t config, const char *request, FILE *output)
+{
+    struct sockaddr_un addr;
+    int fd = unix_socket_address(config, &addr);
+
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1)
+    {
+        close(fd);
+        return false;
+    }
+
+    if (dprintf(fd, "%s\n", request) < 0)
+    {
+        die("write failed:");
+    }
+    shutdown(fd, SHUT_WR);
+
+    // answers to requests the daemon can not serve start with "error:"
+    char buffer[BUFSIZ];
+    char start[6];
+    size_t start_size = 0;
+    ssize_t len;
+    while ((len = read(fd, buffer, sizeof(buffer))) > 0)
+    {
+        for (ssize_t i = 0; i < len && start_size < sizeof(start); i++)
+        {
+            start[start_size++] = buffer[i];
+        }
+        if (output != NULL)
+        {
+            fwrite(buffer, 1, (size_t)len, output);
+        }
+    }
+
+    close(fd);
+    return start_size < sizeof(start) || memcmp(start, "error:", sizeof(start)) != 0;
+}
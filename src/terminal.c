@@ -0,0 +1,206 @@
+#include "terminal.h"
+
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "util.h"
+
+#define TERMINAL_PTS_PATH "/dev/pts"
+
+typedef struct
+{
+    struct pollfd *fds;
+    size_t *offsets; // how much of the data each terminal has taken
+    size_t *ends;    // how much it is given, all of it until time runs out
+    size_t size;
+    size_t capacity;
+} terminal_set_t;
+
+static bool terminal_write(int, const void *, size_t, size_t *);
+static void terminal_add(terminal_set_t *, int, size_t, size_t);
+static void terminal_remove(terminal_set_t *, size_t);
+static size_t terminal_sequence_end(const char *, size_t, size_t);
+static int terminal_remaining_ms(const struct timespec *, int);
+
+// false once the terminal is done with, finished or failed
+static bool terminal_write(int fd, const void *data, size_t size, size_t *offset)
+{
+    while (*offset < size)
+    {
+        ssize_t written = write(fd, (const char *)data + *offset, size - *offset);
+        if (written == -1)
+        {
+            return errno == EAGAIN || errno == EINTR;
+        }
+        *offset += (size_t)written;
+    }
+    return false;
+}
+
+static void terminal_add(terminal_set_t *set, int fd, size_t offset, size_t end)
+{
+    if (set->size == set->capacity)
+    {
+        set->capacity = set->capacity == 0 ? 16 : set->capacity * 2;
+        set->fds = safe_realloc(set->fds, set->capacity * sizeof(struct pollfd));
+        set->offsets = safe_realloc(set->offsets, set->capacity * sizeof(size_t));
+        set->ends = safe_realloc(set->ends, set->capacity * sizeof(size_t));
+    }
+    set->fds[set->size] = (struct pollfd){.fd = fd, .events = POLLOUT};
+    set->offsets[set->size] = offset;
+    set->ends[set->size] = end;
+    set->size++;
+}
+
+static void terminal_remove(terminal_set_t *set, size_t index)
+{
+    close(set->fds[index].fd);
+    set->size--;
+    set->fds[index] = set->fds[set->size];
+    set->offsets[index] = set->offsets[set->size];
+    set->ends[index] = set->ends[set->size];
+}
+
+// where the escape sequence that offset is in ends, offset itself when it is between two sequences
+static size_t terminal_sequence_end(const char *data, size_t size, size_t offset)
+{
+    if (offset == 0 || offset == size || data[offset - 1] == '\a' ||
+        (offset >= 2 && data[offset - 2] == '\033' && data[offset - 1] == '\\'))
+    {
+        return offset;
+    }
+    for (size_t i = offset; i < size; i++)
+    {
+        if (data[i] == '\a' || (i > 0 && data[i - 1] == '\033' && data[i] == '\\'))
+        {
+            return i + 1;
+        }
+    }
+    return size;
+}
+
+static int terminal_remaining_ms(const struct timespec *start, int timeout_ms)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    long long elapsed_ms = (now.tv_sec - start->tv_sec) * 1000LL + (now.tv_nsec - start->tv_nsec) / 1000000;
+    return elapsed_ms >= timeout_ms ? 0 : (int)(timeout_ms - elapsed_ms);
+}
+
+void terminal_broadcast(const void *data, size_t size, terminal_stats_t *stats)
+{
+    *stats = (terminal_stats_t){0};
+
+    DIR *dir = opendir(TERMINAL_PTS_PATH);
+    if (dir == NULL)
+    {
+        return;
+    }
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    // what every terminal takes at once is done, the rest waits on poll
+    terminal_set_t pending = {0};
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL)
+    {
+        if (!isdigit(entry->d_name[0]))
+        {
+            continue;
+        }
+
+        int fd = openat(dirfd(dir), entry->d_name, O_WRONLY | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+        if (fd == -1)
+        {
+            continue;
+        }
+        struct stat st;
+        if (fstat(fd, &st) == -1 || !S_ISCHR(st.st_mode) || st.st_uid != getuid())
+        {
+            close(fd);
+            continue;
+        }
+
+        stats->terminals++;
+        size_t offset = 0;
+        if (terminal_write(fd, data, size, &offset))
+        {
+            terminal_add(&pending, fd, offset, size);
+            continue;
+        }
+        stats->written += offset == size;
+        stats->skipped += offset != size;
+        close(fd);
+    }
+    closedir(dir);
+
+    // a terminal that stopped reading is given up on after the timeout, it must not hold up the reload
+    int timeout_ms = TERMINAL_WRITE_TIMEOUT_MS;
+    bool finishing = false;
+    while (pending.size > 0)
+    {
+        int remaining = terminal_remaining_ms(&start, timeout_ms);
+        if (remaining == 0)
+        {
+            if (finishing)
+            {
+                break;
+            }
+
+            // a terminal left inside a sequence would swallow its own output, it gets to finish that one only
+            finishing = true;
+            timeout_ms = TERMINAL_FINISH_TIMEOUT_MS;
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            for (size_t i = 0; i < pending.size;)
+            {
+                pending.ends[i] = terminal_sequence_end(data, size, pending.offsets[i]);
+                if (pending.ends[i] == pending.offsets[i])
+                {
+                    stats->skipped++;
+                    terminal_remove(&pending, i);
+                    continue;
+                }
+                i++;
+            }
+            continue;
+        }
+
+        if (poll(pending.fds, pending.size, remaining) <= 0)
+        {
+            continue;
+        }
+
+        for (size_t i = 0; i < pending.size;)
+        {
+            if (pending.fds[i].revents == 0 ||
+                ((pending.fds[i].revents & POLLOUT) &&
+                 terminal_write(pending.fds[i].fd, data, pending.ends[i], &pending.offsets[i])))
+            {
+                i++;
+                continue;
+            }
+
+            stats->written += pending.offsets[i] == size;
+            stats->skipped += pending.offsets[i] != size;
+            terminal_remove(&pending, i);
+        }
+    }
+
+    for (size_t i = 0; i < pending.size; i++)
+    {
+        close(pending.fds[i].fd);
+    }
+    stats->skipped += pending.size;
+    free(pending.fds);
+    free(pending.offsets);
+    free(pending.ends);
+}
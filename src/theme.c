@@ -0,0 +1,810 @@
+#define _GNU_SOURCE
+#include "theme.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "pool.h"
+#include "replace.h"
+#include "util.h"
+
+typedef struct
+{
+    char **paths; // relative to the skeleton
+    size_t size;
+    size_t capacity;
+} theme_paths_t;
+
+// what a file was generated from, enough to tell whether a new palette changes it
+typedef struct
+{
+    char *path;      // relative to the source
+    uint64_t *slots; // bit i set if the file contains pattern i, REPLACER_SLOT_WORDS(patterns_size) words
+    long long size;  // of the source
+    long long mtime_sec;
+    long long mtime_nsec;
+    uint64_t hash; // of the output
+} theme_manifest_entry_t;
+
+typedef struct
+{
+    char *source_path;
+    char *output_path;
+    char **patterns;
+    char **values;
+    size_t patterns_size;
+    theme_manifest_entry_t *entries; // sorted by path
+    size_t size;
+} theme_manifest_t;
+
+typedef struct
+{
+    const char *source_path;
+    const char *output_path;
+    const theme_paths_t *files;
+    const replacer_t *replacer;
+    const char *staging_path;             // next to the tree, for files replacing those of a live one
+    const theme_manifest_t *old_manifest; // NULL when the whole tree is written from scratch
+    const uint64_t *changed_slots;
+    size_t slot_words;
+    theme_manifest_entry_t *entries; // filled for every file
+    atomic_size_t written;
+    atomic_size_t bytes;
+} theme_job_t;
+
+static void theme_paths_add(theme_paths_t *, char *);
+static void theme_paths_free(theme_paths_t *);
+static int theme_paths_compare(const void *, const void *);
+static void theme_paths_sort(theme_paths_t *);
+static bool theme_paths_contains(const theme_paths_t *, const char *);
+static void theme_prune(const char *, const char *, const theme_paths_t *, const theme_paths_t *,
+                        const theme_paths_t *);
+static void theme_collect(const char *, const char *, theme_paths_t *, theme_paths_t *, theme_paths_t *);
+static size_t theme_read_colors(const char *, char ***, char ***);
+static void theme_free_colors(char **, char **, size_t);
+static const char *theme_find_color(char **, char **, size_t, const char *);
+static int theme_manifest_compare(const void *, const void *);
+static bool theme_manifest_load(const char *, theme_manifest_t *);
+static void theme_manifest_store(const char *, const theme_manifest_t *);
+static void theme_manifest_free(theme_manifest_t *);
+static const theme_manifest_entry_t *theme_manifest_find(const theme_manifest_t *, const char *);
+static bool theme_file_unchanged(const theme_job_t *, const char *, const struct stat *);
+static void theme_write_file(size_t, void *);
+static void theme_update_symlink(const char *, const char *, const char *);
+static void theme_copy_tree(const char *, const char *, const char *, char **, char **, size_t, const char *,
+                            theme_stats_t *);
+
+static void theme_paths_add(theme_paths_t *paths, char *path)
+{
+    if (paths->size == paths->capacity)
+    {
+        paths->capacity = paths->capacity == 0 ? 64 : paths->capacity * 2;
+        paths->paths = safe_realloc(paths->paths, paths->capacity * sizeof(char *));
+    }
+    paths->paths[paths->size++] = path;
+}
+
+static void theme_paths_free(theme_paths_t *paths)
+{
+    for (size_t i = 0; i < paths->size; i++)
+    {
+        free(paths->paths[i]);
+    }
+    free(paths->paths);
+}
+
+static int theme_paths_compare(const void *a, const void *b)
+{
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+// a parent sorts before its contents
+static void theme_paths_sort(theme_paths_t *paths)
+{
+    qsort(paths->paths, paths->size, sizeof(char *), theme_paths_compare);
+}
+
+static bool theme_paths_contains(const theme_paths_t *paths, const char *path)
+{
+    return bsearch(&path, paths->paths, paths->size, sizeof(char *), theme_paths_compare) != NULL;
+}
+
+// removes what the source no longer has from a tree updated in place, also entries that changed their type
+static void theme_prune(const char *output_path, const char *relative, const theme_paths_t *directories,
+                        const theme_paths_t *symlinks, const theme_paths_t *files)
+{
+    char *path = relative[0] == '\0' ? strdup(output_path) : format_string("%s/%s", output_path, relative);
+    DIR *dir = opendir(path);
+    if (dir == NULL)
+    {
+        die("opendir failed for %s:", path);
+    }
+
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL)
+    {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+        {
+            continue;
+        }
+
+        char *entry_relative =
+            relative[0] == '\0' ? strdup(entry->d_name) : format_string("%s/%s", relative, entry->d_name);
+        struct stat st;
+        if (fstatat(dirfd(dir), entry->d_name, &st, AT_SYMLINK_NOFOLLOW) == -1)
+        {
+            free(entry_relative);
+            continue;
+        }
+
+        if (S_ISDIR(st.st_mode) && theme_paths_contains(directories, entry_relative))
+        {
+            theme_prune(output_path, entry_relative, directories, symlinks, files);
+        }
+        else if (!(S_ISLNK(st.st_mode) && theme_paths_contains(symlinks, entry_relative)) &&
+                 !(S_ISREG(st.st_mode) && theme_paths_contains(files, entry_relative)))
+        {
+            char *entry_path = format_string("%s/%s", path, entry->d_name);
+            if (S_ISDIR(st.st_mode))
+            {
+                rmrf(entry_path);
+            }
+            else if (unlink(entry_path) != 0)
+            {
+                die("unlink failed for %s:", entry_path);
+            }
+            free(entry_path);
+        }
+        free(entry_relative);
+    }
+
+    closedir(dir);
+    free(path);
+}
+
+static void theme_collect(const char *skeleton_path, const char *relative, theme_paths_t *directories,
+                          theme_paths_t *symlinks, theme_paths_t *files)
+{
+    char *path = relative[0] == '\0' ? strdup(skeleton_path) : format_string("%s/%s", skeleton_path, relative);
+    DIR *dir = opendir(path);
+    if (dir == NULL)
+    {
+        die("opendir failed for %s:", path);
+    }
+
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL)
+    {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+        {
+            continue;
+        }
+
+        char *entry_relative =
+            relative[0] == '\0' ? strdup(entry->d_name) : format_string("%s/%s", relative, entry->d_name);
+        struct stat st;
+        if (fstatat(dirfd(dir), entry->d_name, &st, AT_SYMLINK_NOFOLLOW) == -1)
+        {
+            die("stat failed for %s/%s:", path, entry->d_name);
+        }
+
+        // parents are always added before their contents
+        if (S_ISDIR(st.st_mode))
+        {
+            theme_paths_add(directories, entry_relative);
+            theme_collect(skeleton_path, entry_relative, directories, symlinks, files);
+        }
+        else if (S_ISLNK(st.st_mode))
+        {
+            theme_paths_add(symlinks, entry_relative);
+        }
+        else if (S_ISREG(st.st_mode))
+        {
+            theme_paths_add(files, entry_relative);
+        }
+        else
+        {
+            free(entry_relative);
+        }
+    }
+
+    closedir(dir);
+    free(path);
+}
+
+static size_t theme_read_colors(const char *colors_path, char ***patterns, char ***values)
+{
+    // the KEY=VALUE file oomox reads, every KEY is substituted as %KEY%
+    FILE *file = fopen(colors_path, "r");
+    if (file == NULL)
+    {
+        die("fopen failed for %s:", colors_path);
+    }
+
+    size_t size = 0, capacity = 0;
+    *patterns = NULL;
+    *values = NULL;
+    char line[256];
+    while (fgets(line, sizeof(line), file) != NULL)
+    {
+        line[strcspn(line, "\n")] = '\0';
+        char *separator = strchr(line, '=');
+        if (separator == NULL || separator == line)
+        {
+            continue;
+        }
+        *separator = '\0';
+
+        char *value = separator + 1;
+        size_t value_length = strlen(value);
+        if (value_length >= 2 && value[0] == '"' && value[value_length - 1] == '"')
+        {
+            value[value_length - 1] = '\0';
+            value++;
+        }
+
+        if (size == capacity)
+        {
+            capacity = capacity == 0 ? 32 : capacity * 2;
+            *patterns = safe_realloc(*patterns, capacity * sizeof(char *));
+            *values = safe_realloc(*values, capacity * sizeof(char *));
+        }
+        (*patterns)[size] = format_string("%%%s%%", line);
+        (*values)[size] = strdup(value);
+        size++;
+    }
+
+    fclose(file);
+    return size;
+}
+
+static void theme_free_colors(char **patterns, char **values, size_t size)
+{
+    for (size_t i = 0; i < size; i++)
+    {
+        free(patterns[i]);
+        free(values[i]);
+    }
+    free(patterns);
+    free(values);
+}
+
+static const char *theme_find_color(char **patterns, char **values, size_t size, const char *key)
+{
+    // patterns are %KEY%
+    size_t key_length = strlen(key);
+    for (size_t i = 0; i < size; i++)
+    {
+        if (strncmp(patterns[i] + 1, key, key_length) == 0 && strcmp(patterns[i] + 1 + key_length, "%") == 0)
+        {
+            return values[i];
+        }
+    }
+    return NULL;
+}
+
+static int theme_manifest_compare(const void *a, const void *b)
+{
+    return strcmp(((const theme_manifest_entry_t *)a)->path, ((const theme_manifest_entry_t *)b)->path);
+}
+
+static bool theme_manifest_load(const char *manifest_path, theme_manifest_t *manifest)
+{
+    *manifest = (theme_manifest_t){0};
+    FILE *file = fopen(manifest_path, "r");
+    if (file == NULL)
+    {
+        return false;
+    }
+
+    // text, one header line per value and then one line per file:
+    // theming-manifest 2 / source <path> / output <path> / patterns <n> / <pattern>\t<value>... /
+    // files <n> / <slot word>,<slot word>... <size> <mtime_sec> <mtime_nsec> <hash> <path>...
+    char line[8192];
+    bool valid = fgets(line, sizeof(line), file) != NULL && strcmp(line, "theming-manifest 2\n") == 0;
+    if (valid && (valid = fgets(line, sizeof(line), file) != NULL && strncmp(line, "source ", 7) == 0))
+    {
+        line[strcspn(line, "\n")] = '\0';
+        manifest->source_path = strdup(line + 7);
+    }
+    if (valid && (valid = fgets(line, sizeof(line), file) != NULL && strncmp(line, "output ", 7) == 0))
+    {
+        line[strcspn(line, "\n")] = '\0';
+        manifest->output_path = strdup(line + 7);
+    }
+    valid = valid && fgets(line, sizeof(line), file) != NULL &&
+            sscanf(line, "patterns %zu", &manifest->patterns_size) == 1 && manifest->patterns_size < 4096;
+    if (valid)
+    {
+        manifest->patterns = safe_calloc(manifest->patterns_size, sizeof(char *));
+        manifest->values = safe_calloc(manifest->patterns_size, sizeof(char *));
+    }
+    for (size_t i = 0; valid && i < manifest->patterns_size; i++)
+    {
+        char *separator;
+        valid = fgets(line, sizeof(line), file) != NULL && (separator = strchr(line, '\t')) != NULL;
+        if (valid)
+        {
+            line[strcspn(line, "\n")] = '\0';
+            *separator = '\0';
+            manifest->patterns[i] = strdup(line);
+            manifest->values[i] = strdup(separator + 1);
+        }
+    }
+
+    // the count is only trusted once that many lines were read, the entries grow with them so a corrupt count
+    // makes the load fail instead of asking for an absurd allocation
+    size_t count = 0, capacity = 0;
+    valid = valid && fgets(line, sizeof(line), file) != NULL && sscanf(line, "files %zu", &count) == 1;
+    size_t slot_words = REPLACER_SLOT_WORDS(manifest->patterns_size);
+    while (valid && manifest->size < count && fgets(line, sizeof(line), file) != NULL)
+    {
+        if (manifest->size == capacity)
+        {
+            capacity = capacity == 0 ? 256 : capacity * 2;
+            manifest->entries = safe_realloc(manifest->entries, capacity * sizeof(theme_manifest_entry_t));
+        }
+        theme_manifest_entry_t *entry = &manifest->entries[manifest->size];
+        uint64_t *slots = safe_calloc(slot_words, sizeof(uint64_t));
+        char *rest = line;
+        for (size_t i = 0; valid && i < slot_words; i++)
+        {
+            char *end;
+            slots[i] = strtoull(rest, &end, 16);
+            valid = end != rest && *end == (i + 1 < slot_words ? ',' : ' ');
+            rest = end + 1;
+        }
+
+        unsigned long long hash;
+        int offset = 0;
+        valid = valid &&
+                sscanf(rest, "%lld %lld %lld %llx %n", &entry->size, &entry->mtime_sec, &entry->mtime_nsec, &hash,
+                       &offset) == 4 &&
+                offset > 0;
+        if (!valid)
+        {
+            free(slots);
+            break;
+        }
+        rest[strcspn(rest, "\n")] = '\0';
+        entry->path = strdup(rest + offset);
+        entry->slots = slots;
+        entry->hash = hash;
+        manifest->size++;
+    }
+    valid = valid && manifest->size == count;
+    fclose(file);
+
+    if (!valid)
+    {
+        theme_manifest_free(manifest);
+        return false;
+    }
+
+    qsort(manifest->entries, manifest->size, sizeof(theme_manifest_entry_t), theme_manifest_compare);
+    return true;
+}
+
+static void theme_manifest_store(const char *manifest_path, const theme_manifest_t *manifest)
+{
+    char *tmp_path = format_string("%s.tmp", manifest_path);
+    FILE *file = fopen(tmp_path, "w");
+    if (file == NULL)
+    {
+        die("fopen failed for %s:", tmp_path);
+    }
+
+    fprintf(file, "theming-manifest 2\nsource %s\noutput %s\npatterns %zu\n", manifest->source_path,
+            manifest->output_path, manifest->patterns_size);
+    for (size_t i = 0; i < manifest->patterns_size; i++)
+    {
+        fprintf(file, "%s\t%s\n", manifest->patterns[i], manifest->values[i]);
+    }
+    fprintf(file, "files %zu\n", manifest->size);
+    for (size_t i = 0; i < manifest->size; i++)
+    {
+        const theme_manifest_entry_t *entry = &manifest->entries[i];
+        for (size_t j = 0; j < REPLACER_SLOT_WORDS(manifest->patterns_size); j++)
+        {
+            fprintf(file, "%s%llx", j > 0 ? "," : "", (unsigned long long)entry->slots[j]);
+        }
+        fprintf(file, " %lld %lld %lld %016llx %s\n", entry->size, entry->mtime_sec, entry->mtime_nsec,
+                (unsigned long long)entry->hash, entry->path);
+    }
+
+    if (ferror(file) || fclose(file) != 0)
+    {
+        die("writing to file %s failed:", tmp_path);
+    }
+    if (rename(tmp_path, manifest_path) != 0)
+    {
+        die("rename failed for %s:", manifest_path);
+    }
+    free(tmp_path);
+}
+
+static void theme_manifest_free(theme_manifest_t *manifest)
+{
+    for (size_t i = 0; i < manifest->patterns_size; i++)
+    {
+        if (manifest->patterns != NULL)
+            free(manifest->patterns[i]);
+        if (manifest->values != NULL)
+            free(manifest->values[i]);
+    }
+    for (size_t i = 0; i < manifest->size; i++)
+    {
+        free(manifest->entries[i].path);
+        free(manifest->entries[i].slots);
+    }
+    free(manifest->patterns);
+    free(manifest->values);
+    free(manifest->entries);
+    free(manifest->source_path);
+    free(manifest->output_path);
+    *manifest = (theme_manifest_t){0};
+}
+
+static const theme_manifest_entry_t *theme_manifest_find(const theme_manifest_t *manifest, const char *path)
+{
+    theme_manifest_entry_t key = {.path = (char *)path};
+    return bsearch(&key, manifest->entries, manifest->size, sizeof(theme_manifest_entry_t), theme_manifest_compare);
+}
+
+static bool theme_file_unchanged(const theme_job_t *job, const char *relative, const struct stat *st)
+{
+    if (job->old_manifest == NULL)
+    {
+        return false;
+    }
+
+    const theme_manifest_entry_t *old = theme_manifest_find(job->old_manifest, relative);
+    if (old == NULL || old->size != (long long)st->st_size || old->mtime_sec != (long long)st->st_mtim.tv_sec ||
+        old->mtime_nsec != (long long)st->st_mtim.tv_nsec)
+    {
+        return false;
+    }
+    for (size_t i = 0; i < job->slot_words; i++)
+    {
+        if ((old->slots[i] & job->changed_slots[i]) != 0)
+        {
+            return false;
+        }
+    }
+
+    // someone may have deleted the output
+    char *to = format_string("%s/%s", job->output_path, relative);
+    bool exists = access(to, F_OK) == 0;
+    free(to);
+    return exists;
+}
+
+static void theme_write_file(size_t index, void *userdata)
+{
+    theme_job_t *job = userdata;
+    const char *relative = job->files->paths[index];
+    theme_manifest_entry_t *entry = &job->entries[index];
+    char *from = format_string("%s/%s", job->source_path, relative);
+
+    int fd = open(from, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+    {
+        die("open failed for %s:", from);
+    }
+    struct stat st;
+    if (fstat(fd, &st) == -1)
+    {
+        die("fstat failed for %s:", from);
+    }
+
+    entry->path = strdup(relative);
+    entry->slots = safe_calloc(job->slot_words, sizeof(uint64_t));
+    entry->size = (long long)st.st_size;
+    entry->mtime_sec = (long long)st.st_mtim.tv_sec;
+    entry->mtime_nsec = (long long)st.st_mtim.tv_nsec;
+
+    // the file references none of the palette slots that changed, its output stays as it is
+    if (theme_file_unchanged(job, relative, &st))
+    {
+        const theme_manifest_entry_t *old = theme_manifest_find(job->old_manifest, relative);
+        memcpy(entry->slots, old->slots, job->slot_words * sizeof(uint64_t));
+        entry->hash = old->hash;
+        close(fd);
+        free(from);
+        return;
+    }
+
+    size_t size = (size_t)st.st_size;
+    const char *text = "";
+    if (size > 0)
+    {
+        text = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (text == MAP_FAILED)
+        {
+            die("mmap failed for %s:", from);
+        }
+    }
+    close(fd);
+
+    char *output;
+    size_t output_size;
+    FILE *stream = open_memstream(&output, &output_size);
+    if (stream == NULL)
+    {
+        die("open_memstream failed:");
+    }
+    replacer_apply(job->replacer, text, size, stream, entry->slots);
+    if (ferror(stream) || fclose(stream) != 0)
+    {
+        die("replacing colors in %s failed:", from);
+    }
+    if (size > 0)
+    {
+        munmap((void *)text, size);
+    }
+    entry->hash = hash_bytes(output, output_size, 0);
+
+    char *to = format_string("%s/%s", job->output_path, relative);
+    const theme_manifest_entry_t *old =
+        job->old_manifest != NULL ? theme_manifest_find(job->old_manifest, relative) : NULL;
+    if (old != NULL && old->hash == entry->hash && access(to, F_OK) == 0)
+    {
+        // same output after all, keep the file and its mtime
+        free(output);
+        free(to);
+        free(from);
+        return;
+    }
+
+    // files of a live theme are replaced atomically, written where nothing looking into the theme sees them
+    char *tmp_path = job->old_manifest != NULL ? format_string("%s/%zu", job->staging_path, index) : strdup(to);
+    int out_fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, st.st_mode & 07777);
+    if (out_fd == -1)
+    {
+        die("open failed for %s:", tmp_path);
+    }
+    for (size_t written = 0; written < output_size;)
+    {
+        ssize_t n = write(out_fd, output + written, output_size - written);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            die("writing to file %s failed:", tmp_path);
+        }
+        written += (size_t)n;
+    }
+    if (close(out_fd) != 0)
+    {
+        die("writing to file %s failed:", tmp_path);
+    }
+    if (strcmp(tmp_path, to) != 0 && rename(tmp_path, to) != 0)
+    {
+        die("rename failed for %s:", to);
+    }
+
+    atomic_fetch_add(&job->written, 1);
+    atomic_fetch_add(&job->bytes, output_size);
+    free(tmp_path);
+    free(output);
+    free(to);
+    free(from);
+}
+
+// tmp_path is where the link is made before it replaces one of a live tree, NULL to make it in place
+static void theme_update_symlink(const char *from, const char *to, const char *tmp_path)
+{
+    char target[4096];
+    ssize_t length = readlink(from, target, sizeof(target) - 1);
+    if (length < 0)
+    {
+        die("readlink failed for %s:", from);
+    }
+    target[length] = '\0';
+
+    char current[4096];
+    ssize_t current_length = readlink(to, current, sizeof(current) - 1);
+    if (current_length == length && memcmp(current, target, (size_t)length) == 0)
+    {
+        return;
+    }
+
+    if (tmp_path == NULL)
+    {
+        if (symlink(target, to) != 0)
+        {
+            die("symlink failed for %s:", to);
+        }
+        return;
+    }
+    unlink(tmp_path);
+    if (symlink(target, tmp_path) != 0 || rename(tmp_path, to) != 0)
+    {
+        die("symlink failed for %s:", to);
+    }
+}
+
+static void theme_copy_tree(const char *source_path, const char *parent_path, const char *name, char **patterns,
+                            char **values, size_t patterns_size, const char *manifest_path, theme_stats_t *stats)
+{
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    replacer_t replacer;
+    replacer_init(&replacer, (const char *const *)patterns, (const char *const *)values, patterns_size);
+
+    theme_paths_t directories = {0}, symlinks = {0}, files = {0};
+    theme_collect(source_path, "", &directories, &symlinks, &files);
+    theme_paths_sort(&directories);
+    theme_paths_sort(&symlinks);
+    theme_paths_sort(&files);
+
+    char *output_path = format_string("%s/%s", parent_path, name);
+
+    // a tree made from the same source with the same patterns is updated in place, slots whose value changed
+    // tell which files need to be rewritten
+    theme_manifest_t old_manifest;
+    bool loaded = theme_manifest_load(manifest_path, &old_manifest);
+    bool incremental = loaded && check_directory(output_path) == 0 &&
+                       strcmp(old_manifest.source_path, source_path) == 0 &&
+                       strcmp(old_manifest.output_path, output_path) == 0 &&
+                       old_manifest.patterns_size == patterns_size;
+    size_t slot_words = REPLACER_SLOT_WORDS(patterns_size);
+    uint64_t *changed_slots = safe_calloc(slot_words, sizeof(uint64_t));
+    for (size_t i = 0; incremental && i < patterns_size; i++)
+    {
+        incremental = strcmp(old_manifest.patterns[i], patterns[i]) == 0;
+        if (strcmp(old_manifest.values[i], values[i]) != 0)
+        {
+            changed_slots[i / 64] |= 1ull << (i % 64);
+        }
+    }
+
+    // a sibling on the same filesystem, the new tree or the staged files replacing those of the live one
+    char *tmp_path = format_string("%s/.%s.tmp", parent_path, name);
+    const char *write_path = incremental ? output_path : tmp_path;
+    if (check_directory(tmp_path) == 0)
+    {
+        rmrf(tmp_path);
+    }
+    if (mkdir(tmp_path, 0755) != 0)
+    {
+        die("mkdir failed for %s:", tmp_path);
+    }
+    if (incremental)
+    {
+        theme_prune(output_path, "", &directories, &symlinks, &files);
+    }
+
+    for (size_t i = 0; i < directories.size; i++)
+    {
+        char *path = format_string("%s/%s", write_path, directories.paths[i]);
+        if (mkdir(path, 0755) != 0 && errno != EEXIST)
+        {
+            die("mkdir failed for %s:", path);
+        }
+        free(path);
+    }
+
+    for (size_t i = 0; i < symlinks.size; i++)
+    {
+        char *from = format_string("%s/%s", source_path, symlinks.paths[i]);
+        char *to = format_string("%s/%s", write_path, symlinks.paths[i]);
+        char *link_tmp_path = incremental ? format_string("%s/link-%zu", tmp_path, i) : NULL;
+        theme_update_symlink(from, to, link_tmp_path);
+        free(link_tmp_path);
+        free(from);
+        free(to);
+    }
+
+    theme_job_t job = {
+        .source_path = source_path,
+        .output_path = write_path,
+        .files = &files,
+        .replacer = &replacer,
+        .staging_path = tmp_path,
+        .old_manifest = incremental ? &old_manifest : NULL,
+        .changed_slots = changed_slots,
+        .slot_words = slot_words,
+        .entries = safe_calloc(files.size, sizeof(theme_manifest_entry_t)),
+    };
+    atomic_init(&job.written, 0);
+    atomic_init(&job.bytes, 0);
+    parallel_for(files.size, theme_write_file, &job);
+
+    theme_manifest_t manifest = {
+        .source_path = strdup(source_path),
+        .output_path = strdup(output_path),
+        .patterns = safe_calloc(patterns_size, sizeof(char *)),
+        .values = safe_calloc(patterns_size, sizeof(char *)),
+        .patterns_size = patterns_size,
+        .entries = job.entries,
+        .size = files.size,
+    };
+    for (size_t i = 0; i < patterns_size; i++)
+    {
+        manifest.patterns[i] = strdup(patterns[i]);
+        manifest.values[i] = strdup(values[i]);
+    }
+    qsort(manifest.entries, manifest.size, sizeof(theme_manifest_entry_t), theme_manifest_compare);
+
+    if (incremental)
+    {
+        rmrf(tmp_path);
+    }
+    else
+    {
+        replace_directory(tmp_path, output_path);
+    }
+    if (loaded)
+    {
+        theme_manifest_free(&old_manifest);
+    }
+    theme_manifest_store(manifest_path, &manifest);
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    if (stats != NULL)
+    {
+        stats->files = files.size;
+        stats->written = atomic_load(&job.written);
+        stats->bytes = atomic_load(&job.bytes);
+        stats->seconds = (double)(end.tv_sec - start.tv_sec) + (double)(end.tv_nsec - start.tv_nsec) / 1e9;
+    }
+
+    theme_manifest_free(&manifest);
+    theme_paths_free(&directories);
+    theme_paths_free(&symlinks);
+    theme_paths_free(&files);
+    replacer_free(&replacer);
+    free(changed_slots);
+    free(output_path);
+    free(tmp_path);
+}
+
+void theme_generate(const char *skeleton_path, const char *theme_path, const char *name, const char *colors_path,
+                    const char *manifest_path, theme_stats_t *stats)
+{
+    char **patterns, **values;
+    size_t colors_size = theme_read_colors(colors_path, &patterns, &values);
+    theme_copy_tree(skeleton_path, theme_path, name, patterns, values, colors_size, manifest_path, stats);
+    theme_free_colors(patterns, values, colors_size);
+}
+
+void theme_generate_icons(const char *source_path, const char *icon_theme_path, const char *name,
+                          const char *colors_path, char *const *sources, char *const *keys, size_t size,
+                          const char *manifest_path, theme_stats_t *stats)
+{
+    char **patterns, **values;
+    size_t colors_size = theme_read_colors(colors_path, &patterns, &values);
+
+    // svgs spell colors in either case, the replacer matches both
+    char **hex_patterns = safe_calloc(size, sizeof(char *));
+    char **hex_values = safe_calloc(size, sizeof(char *));
+    size_t hex_size = 0;
+    for (size_t i = 0; i < size; i++)
+    {
+        const char *value = keys[i][0] == '#' ? keys[i] + 1 : theme_find_color(patterns, values, colors_size, keys[i]);
+        if (value == NULL)
+        {
+            die("Error: icon_color_map: %s is not a color of %s", keys[i], colors_path);
+        }
+
+        const char *source = sources[i][0] == '#' ? sources[i] + 1 : sources[i];
+        hex_values[hex_size] = format_string("#%s", value);
+        hex_patterns[hex_size++] = format_string("#%s", source);
+    }
+    theme_free_colors(patterns, values, colors_size);
+
+    theme_copy_tree(source_path, icon_theme_path, name, hex_patterns, hex_values, hex_size, manifest_path, stats);
+    theme_free_colors(hex_patterns, hex_values, hex_size);
+}
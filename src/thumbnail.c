@@ -0,0 +1,349 @@
+#include "thumbnail.h"
+
+#include <ctype.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "metrics.h"
+#include "util.h"
+
+// bytes hashed at the start and the end of the image to identify it
+#define THUMBNAIL_KEY_SAMPLE 65536
+// thumbnails kept in cache_path/thumbnails, the least recently used go first
+#define THUMBNAIL_CACHE_MAX 32
+
+typedef struct
+{
+    char *path;
+    struct timespec used; // the mtime, touched on every hit
+} thumbnail_entry_t;
+
+static bool thumbnail_source_key(const char *, uint64_t *);
+static char *thumbnail_key_path(const char *, uint64_t);
+static bool ppm_read_number(const uint8_t *, size_t, size_t *, uint32_t *);
+static void thumbnail_from_ppm(const char *, const char *, uint64_t);
+static int compare_entry_used(const void *, const void *);
+static void thumbnail_evict(const char *);
+
+static bool thumbnail_source_key(const char *image_path, uint64_t *key)
+{
+    int fd = open(image_path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+    {
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == -1)
+    {
+        close(fd);
+        return false;
+    }
+
+    // size and mtime plus the head and tail of the file, cheap even for huge images
+    uint8_t sample[2 * THUMBNAIL_KEY_SAMPLE];
+    ssize_t head = pread(fd, sample, THUMBNAIL_KEY_SAMPLE, 0);
+    off_t tail_offset = st.st_size > THUMBNAIL_KEY_SAMPLE ? st.st_size - THUMBNAIL_KEY_SAMPLE : 0;
+    ssize_t tail = pread(fd, sample + THUMBNAIL_KEY_SAMPLE, THUMBNAIL_KEY_SAMPLE, tail_offset);
+    close(fd);
+    if (head < 0 || tail < 0)
+    {
+        return false;
+    }
+
+    uint64_t meta[3] = {(uint64_t)st.st_size, (uint64_t)st.st_mtim.tv_sec, (uint64_t)st.st_mtim.tv_nsec};
+    *key = hash_bytes(meta, sizeof(meta), hash_bytes(sample, (size_t)head, 0) ^
+                                              hash_bytes(sample + THUMBNAIL_KEY_SAMPLE, (size_t)tail, 1));
+    return true;
+}
+
+static char *thumbnail_key_path(const char *cache_path, uint64_t key)
+{
+    return format_string("%s/thumbnails/%016llx.thumb", cache_path, (unsigned long long)key);
+}
+
+char *thumbnail_path(const char *cache_path, const char *image_path)
+{
+    uint64_t key;
+    if (!thumbnail_source_key(image_path, &key))
+    {
+        die("Error: could not read %s:", image_path);
+    }
+
+    return thumbnail_key_path(cache_path, key);
+}
+
+bool thumbnail_load(const char *cache_path, const char *image_path, thumbnail_t *thumbnail)
+{
+    uint64_t key;
+    if (!thumbnail_source_key(image_path, &key))
+    {
+        return false;
+    }
+
+    char *path = thumbnail_key_path(cache_path, key);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+    {
+        free(path);
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == -1 || (size_t)st.st_size < sizeof(thumbnail_header_t))
+    {
+        close(fd);
+        free(path);
+        return false;
+    }
+
+    void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+    {
+        free(path);
+        return false;
+    }
+
+    const thumbnail_header_t *header = map;
+    if (memcmp(header->magic, "THMB", 4) != 0 || header->version != THUMBNAIL_VERSION || header->source_key != key ||
+        (size_t)st.st_size != sizeof(thumbnail_header_t) + (size_t)header->width * header->height * 3)
+    {
+        munmap(map, (size_t)st.st_size);
+        free(path);
+        return false;
+    }
+
+    *thumbnail = (thumbnail_t){
+        .path = path,
+        .width = header->width,
+        .height = header->height,
+        .pixels = (const uint8_t *)map + sizeof(thumbnail_header_t),
+        .map = map,
+        .map_size = (size_t)st.st_size,
+    };
+    return true;
+}
+
+static bool ppm_read_number(const uint8_t *data, size_t size, size_t *offset, uint32_t *number)
+{
+    // skip whitespace and comments
+    while (*offset < size && (isspace(data[*offset]) || data[*offset] == '#'))
+    {
+        if (data[*offset] == '#')
+        {
+            while (*offset < size && data[*offset] != '\n')
+                (*offset)++;
+        }
+        else
+        {
+            (*offset)++;
+        }
+    }
+
+    if (*offset >= size || !isdigit(data[*offset]))
+    {
+        return false;
+    }
+
+    *number = 0;
+    while (*offset < size && isdigit(data[*offset]))
+    {
+        *number = *number * 10 + (uint32_t)(data[*offset] - '0');
+        (*offset)++;
+    }
+
+    return true;
+}
+
+static void thumbnail_from_ppm(const char *ppm_path, const char *path, uint64_t key)
+{
+    int fd = open(ppm_path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+    {
+        die("open failed:");
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == -1)
+    {
+        die("fstat failed:");
+    }
+
+    const uint8_t *data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+    {
+        die("mmap failed:");
+    }
+
+    size_t size = (size_t)st.st_size;
+    size_t offset = 2;
+    uint32_t width, height, max_value;
+    if (size < 2 || memcmp(data, "P6", 2) != 0 || !ppm_read_number(data, size, &offset, &width) ||
+        !ppm_read_number(data, size, &offset, &height) || !ppm_read_number(data, size, &offset, &max_value) ||
+        max_value != 255)
+    {
+        die("Error: unexpected thumbnail format from magick");
+    }
+    offset++; // single whitespace before the pixels
+
+    size_t pixels_size = (size_t)width * height * 3;
+    if (offset + pixels_size > size)
+    {
+        die("Error: truncated thumbnail from magick");
+    }
+
+    thumbnail_header_t header = {
+        .magic = {'T', 'H', 'M', 'B'},
+        .version = THUMBNAIL_VERSION,
+        .width = width,
+        .height = height,
+        .source_key = key,
+    };
+
+    char *tmp_path = format_string("%s.tmp", path);
+    FILE *file = fopen(tmp_path, "w");
+    if (file == NULL)
+    {
+        die("fopen failed:");
+    }
+    fwrite(&header, sizeof(header), 1, file);
+    fwrite(data + offset, 1, pixels_size, file);
+    if (ferror(file) || fclose(file) != 0)
+    {
+        die("writing to file failed:");
+    }
+    if (rename(tmp_path, path) != 0)
+    {
+        die("rename failed:");
+    }
+
+    free(tmp_path);
+    munmap((void *)data, size);
+}
+
+// oldest first
+static int compare_entry_used(const void *a, const void *b)
+{
+    const struct timespec *x = &((const thumbnail_entry_t *)a)->used;
+    const struct timespec *y = &((const thumbnail_entry_t *)b)->used;
+    if (x->tv_sec != y->tv_sec)
+    {
+        return (x->tv_sec > y->tv_sec) - (x->tv_sec < y->tv_sec);
+    }
+    return (x->tv_nsec > y->tv_nsec) - (x->tv_nsec < y->tv_nsec);
+}
+
+// one thumbnail per wallpaper ever used would grow without bound
+static void thumbnail_evict(const char *cache_path)
+{
+    char *dir_path = format_string("%s/thumbnails", cache_path);
+    DIR *dir = opendir(dir_path);
+    if (dir == NULL)
+    {
+        free(dir_path);
+        return;
+    }
+
+    thumbnail_entry_t *entries = NULL;
+    size_t size = 0;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL)
+    {
+        size_t length = strlen(entry->d_name);
+        if (length < 6 || strcmp(entry->d_name + length - 6, ".thumb") != 0)
+        {
+            continue;
+        }
+
+        char *path = format_string("%s/%s", dir_path, entry->d_name);
+        struct stat st;
+        if (stat(path, &st) == -1)
+        {
+            free(path);
+            continue;
+        }
+        entries = safe_realloc(entries, (size + 1) * sizeof(thumbnail_entry_t));
+        entries[size++] = (thumbnail_entry_t){.path = path, .used = st.st_mtim};
+    }
+    closedir(dir);
+
+    // readers that still map an evicted one keep their pages
+    if (size > THUMBNAIL_CACHE_MAX)
+    {
+        qsort(entries, size, sizeof(thumbnail_entry_t), compare_entry_used);
+        for (size_t i = 0; i < size - THUMBNAIL_CACHE_MAX; i++)
+        {
+            unlink(entries[i].path);
+        }
+    }
+
+    for (size_t i = 0; i < size; i++)
+    {
+        free(entries[i].path);
+    }
+    free(entries);
+    free(dir_path);
+}
+
+bool thumbnail_get(const char *cache_path, const char *image_path, thumbnail_t *thumbnail)
+{
+    bool hit = thumbnail_load(cache_path, image_path, thumbnail);
+    metrics_add(hit ? "theming_cache_hits_total" : "theming_cache_misses_total", "cache=\"thumbnail\"", 1);
+    if (hit)
+    {
+        // the mtime orders thumbnails for eviction
+        utimensat(AT_FDCWD, thumbnail->path, NULL, 0);
+        return true;
+    }
+
+    uint64_t key;
+    if (!thumbnail_source_key(image_path, &key))
+    {
+        die("Error: could not read %s:", image_path);
+    }
+
+    char *dir = format_string("%s/thumbnails", cache_path);
+    mkdir_p(dir);
+    free(dir);
+
+    // the same downscale the color extraction always used
+    char *path = thumbnail_key_path(cache_path, key);
+    char *ppm_path = format_string("%s.ppm", path);
+    if (exec_command_format(false, NULL, 0, "magick %s -resize 25%% -depth 8 ppm:%s", image_path, ppm_path) ==
+        COMMAND_CANCELLED)
+    {
+        // magick was killed halfway, its output is not a thumbnail
+        unlink(ppm_path);
+        free(ppm_path);
+        free(path);
+        return false;
+    }
+    thumbnail_from_ppm(ppm_path, path, key);
+    unlink(ppm_path);
+    free(ppm_path);
+    free(path);
+
+    if (!thumbnail_load(cache_path, image_path, thumbnail))
+    {
+        die("Error: could not load thumbnail of %s", image_path);
+    }
+    thumbnail_evict(cache_path);
+    return true;
+}
+
+void thumbnail_free(thumbnail_t *thumbnail)
+{
+    munmap(thumbnail->map, thumbnail->map_size);
+    free(thumbnail->path);
+    thumbnail->map = NULL;
+    thumbnail->pixels = NULL;
+    thumbnail->path = NULL;
+}
@@ -1,19 +1,41 @@
+#define _GNU_SOURCE
 #include "util.h"
 
 #include <ctype.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <stdlib.h>
+#include <linux/fs.h>
+#include <signal.h>
+#include <stdatomic.h>
 #include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/sendfile.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
+#include <time.h>
 #include <unistd.h>
 #define __USE_XOPEN_EXTENDED 1
 #include <dirent.h>
 #include <ftw.h>
 
+#include "capture.h"
+#include "process.h"
+
 static char *format_string_internal(const char *, va_list) __attribute__((format(printf, 1, 0)));
 static int unlink_cb(const char *, const struct stat *, int, struct FTW *);
+static bool file_up_to_date(const char *, int, const struct stat *);
+static int copy_data(int, int, off_t, copy_strategy_t);
+static void running_commands_add(pid_t);
+static void running_commands_remove(pid_t);
+static int exec_command_internal(const char *, bool, char *, size_t, const priority_t *, command_usage_t *);
+
+// process groups of the commands exec_command is waiting for, so they can be killed from a signal handler
+#define RUNNING_COMMANDS_MAX 64
+static atomic_int running_commands[RUNNING_COMMANDS_MAX];
+static volatile sig_atomic_t commands_cancelled_flag;
 
 void die(const char *fmt, ...)
 {
@@ -157,40 +179,71 @@ void mkdir_p(const char *path)
     free(expanded_path);
 }
 
+// reads until end of file, output is truncated to buffer_size - 1 bytes and always terminated
 void read_file(FILE *file, char *output, size_t buffer_size)
 {
-    size_t len = buffer_size;
     size_t used = 0;
-    output[0] = '\0';
+    size_t size;
+    while (used + 1 < buffer_size && (size = fread(output + used, 1, buffer_size - 1 - used, file)) > 0)
+    {
+        used += size;
+    }
+    output[used] = '\0';
 
-    char *buffer = safe_malloc(buffer_size);
-    while (fgets(buffer, sizeof(buffer), file) != NULL)
+    // drain the rest, the writer must not block on a full pipe
+    char discard[BUFSIZ];
+    while (fread(discard, 1, sizeof(discard), file) > 0)
     {
-        size_t buffer_len = strlen(buffer);
-        if (used + buffer_len + 1 > len)
-        {
-            len += buffer_size;
-            output = safe_realloc(output, len);
-        }
-        strcpy(output + used, buffer);
-        used += buffer_len;
     }
-    free(buffer);
 }
 
-void exec_command(const char *command, bool ignore_error, char *output, size_t buffer_size)
+int exec_command(const char *command, bool ignore_error, char *output, size_t buffer_size)
+{
+    return exec_command_internal(command, ignore_error, output, buffer_size, NULL, NULL);
+}
+
+int exec_command_priority(const char *command, bool ignore_error, const priority_t *priority,
+                          command_usage_t *usage)
+{
+    return exec_command_internal(command, ignore_error, NULL, 0, priority, usage);
+}
+
+static int exec_command_internal(const char *command, bool ignore_error, char *output, size_t buffer_size,
+                                 const priority_t *priority, command_usage_t *usage)
 {
     int pfd[2];
     pid_t pid;
 
+    // a cancelled run starts nothing new, the caller ends it at its next checkpoint
+    if (commands_cancelled())
+    {
+        if (output != NULL && buffer_size > 0)
+        {
+            output[0] = '\0';
+        }
+        return COMMAND_CANCELLED;
+    }
+
+    // close on exec, commands started by other threads at the same time must not hold the write end open
     if (output != NULL)
     {
-        if (pipe(pfd) == -1)
+        if (pipe2(pfd, O_CLOEXEC) == -1)
         {
-            die("pipe failed:");
+            die("pipe2 failed:");
         }
     }
 
+    // output nobody reads goes to the command log instead of /dev/null
+    int capture_fd = -1;
+    capture_t *capture = output == NULL ? capture_open(command, &capture_fd) : NULL;
+
+    // limits that need a cgroup get a transient one for just this command
+    char *cgroup_path = priority != NULL ? priority_cgroup_create(priority) : NULL;
+
+    // the child reopens stdout, pending output must not be written twice
+    fflush(NULL);
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
     pid = fork();
     if (pid == -1)
     {
@@ -200,6 +253,11 @@ void exec_command(const char *command, bool ignore_error, char *output, size_t b
     if (pid == 0)
     {
         // child process
+        setpgid(0, 0);
+        if (priority != NULL)
+        {
+            priority_apply(priority, cgroup_path);
+        }
 
         if (output != NULL)
         {
@@ -210,6 +268,18 @@ void exec_command(const char *command, bool ignore_error, char *output, size_t b
             }
             close(pfd[1]); // close original write end. Not needed anymore
         }
+        else if (capture != NULL)
+        {
+            if (freopen("/dev/null", "r", stdin) == NULL)
+            {
+                die("freopen failed");
+            }
+            if (dup2(capture_fd, STDOUT_FILENO) == -1 || dup2(capture_fd, STDERR_FILENO) == -1)
+            {
+                die("dup2 failed:");
+            }
+            close(capture_fd);
+        }
         else
         {
             // redirect standard input, output and error to /dev/null
@@ -232,6 +302,17 @@ void exec_command(const char *command, bool ignore_error, char *output, size_t b
     }
 
     // parent process
+    setpgid(pid, pid);
+    running_commands_add(pid);
+    if (capture_fd != -1)
+    {
+        close(capture_fd);
+    }
+    if (commands_cancelled())
+    {
+        kill(-pid, SIGTERM);
+    }
+
     if (output != NULL)
     {
         close(pfd[1]); // close write end
@@ -247,9 +328,29 @@ void exec_command(const char *command, bool ignore_error, char *output, size_t b
     }
 
     int status;
-    if (waitpid(pid, &status, 0) == -1)
+    struct rusage rusage;
+    while (wait4(pid, &status, 0, &rusage) == -1)
     {
-        die("waitpid failed:");
+        if (errno != EINTR)
+        {
+            die("wait4 failed:");
+        }
+    }
+    running_commands_remove(pid);
+    capture_close(capture, status);
+    if (usage != NULL)
+    {
+        struct timespec end;
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        usage->wall = (double)(end.tv_sec - start.tv_sec) + (double)(end.tv_nsec - start.tv_nsec) / 1e9;
+        usage->cpu = (double)(rusage.ru_utime.tv_sec + rusage.ru_stime.tv_sec) +
+                     (double)(rusage.ru_utime.tv_usec + rusage.ru_stime.tv_usec) / 1e6;
+        usage->max_rss = rusage.ru_maxrss;
+    }
+    priority_cgroup_remove(cgroup_path);
+    if (commands_cancelled())
+    {
+        return COMMAND_CANCELLED;
     }
 
     if (WIFEXITED(status) && WEXITSTATUS(status) != 0)
@@ -262,22 +363,34 @@ void exec_command(const char *command, bool ignore_error, char *output, size_t b
         {
             fprintf(stderr, "%s failed with exit status %d\n", command, WEXITSTATUS(status));
         }
+        return WEXITSTATUS(status);
     }
     if (WIFSIGNALED(status))
     {
-        die("%s terminated by signal %d", command, WTERMSIG(status));
+        // reported like the shell does, the caller decides whether it ends the run
+        if (!ignore_error)
+        {
+            die("%s terminated by signal %d", command, WTERMSIG(status));
+        }
+        else
+        {
+            fprintf(stderr, "%s terminated by signal %d\n", command, WTERMSIG(status));
+        }
+        return 128 + WTERMSIG(status);
     }
+    return 0;
 }
 
-void exec_command_format(bool ignore_error, char *output, size_t buffer_size, const char *format, ...)
+int exec_command_format(bool ignore_error, char *output, size_t buffer_size, const char *format, ...)
 {
     va_list args;
     va_start(args, format);
     char *command = format_string_internal(format, args);
     va_end(args);
 
-    exec_command(command, ignore_error, output, buffer_size);
+    int status = exec_command(command, ignore_error, output, buffer_size);
     free(command);
+    return status;
 }
 
 char *resolve_absolute_path(const char *path)
@@ -399,6 +512,8 @@ pid_t find_pid_by_name(const char *name)
 {
     DIR *dir;
     struct dirent *ent; // dir entry
+    char path[32];
+    char comm[32];
 
     if (!(dir = opendir("/proc")))
     {
@@ -412,37 +527,47 @@ pid_t find_pid_by_name(const char *name)
             continue;
         }
 
-        char *proc_comm = format_string("/proc/%s/comm", ent->d_name);
-        FILE *file = fopen(proc_comm, "r");
-        free(proc_comm);
-        if (!file)
+        snprintf(path, sizeof(path), "/proc/%.16s/comm", ent->d_name);
+        int fd = open(path, O_RDONLY | O_CLOEXEC);
+        if (fd == -1)
         {
             continue;
         }
 
-        char *output = safe_malloc(512);
-        read_file(file, output, 512);
-        output[strcspn(output, "\n")] = 0; // remove newline character
-        fclose(file);
+        ssize_t len = read(fd, comm, sizeof(comm) - 1);
+        close(fd);
+        if (len <= 0)
+        {
+            continue;
+        }
+        comm[len] = '\0';
+        comm[strcspn(comm, "\n")] = 0; // remove newline character
 
-        if (strcmp(output, name) == 0)
+        // comm is truncated by the kernel, compare only that much of name
+        if (strncmp(comm, name, PROCESS_COMM_LEN) == 0)
         {
-            free(output);
             closedir(dir);
             return (pid_t)strtol(ent->d_name, NULL, 10);
         }
-        free(output);
     }
 
     closedir(dir);
     return -1;
 }
 
-void exec_command_and_disown(const char *command)
+pid_t exec_command_and_disown(const char *command, const priority_t *priority)
 {
     pid_t pid;
     pid_t sid;
+    int pfd[2];
+
+    // the intermediate child reports the pid of the grandchild through this pipe
+    if (pipe2(pfd, O_CLOEXEC) == -1)
+    {
+        die("pipe failed:");
+    }
 
+    fflush(NULL);
     pid = fork();
     if (pid == -1)
     {
@@ -452,6 +577,7 @@ void exec_command_and_disown(const char *command)
     if (pid == 0)
     {
         // child process
+        close(pfd[0]);
 
         sid = setsid(); // create a new session and become the session leader
         if (sid == -1)
@@ -469,6 +595,13 @@ void exec_command_and_disown(const char *command)
         {
             // grandchild process
 
+            // lead an own process group, so the whole command can be signaled through its pid
+            if (setpgid(0, 0) == -1)
+            {
+                die("setpgid failed");
+            }
+            priority_apply(priority, NULL);
+
             // redirect standard input, output and error to /dev/null
             if (freopen("/dev/null", "r", stdin) == NULL)
             {
@@ -489,10 +622,22 @@ void exec_command_and_disown(const char *command)
 
         // parent process
 
+        if (write(pfd[1], &pid, sizeof(pid)) != sizeof(pid))
+        {
+            die("write failed:");
+        }
         exit(EXIT_SUCCESS);
     }
 
     // parent process
+    close(pfd[1]);
+
+    pid_t orphan = -1;
+    if (read(pfd[0], &orphan, sizeof(orphan)) != sizeof(orphan))
+    {
+        orphan = -1;
+    }
+    close(pfd[0]);
 
     int status;
     if (waitpid(pid, &status, 0) == -1)
@@ -500,30 +645,185 @@ void exec_command_and_disown(const char *command)
         die("waitpid failed:");
     }
 
-    if (WIFEXITED(status) && WEXITSTATUS(status) == 0)
+    if (WIFEXITED(status) && WEXITSTATUS(status) == 0 && orphan != -1)
     {
     }
     else
     {
         die("failed to spawn orphan");
     }
+
+    return orphan;
 }
 
-int cp(const char *to, const char *from)
+uint64_t hash_bytes(const void *data, size_t size, uint64_t seed)
 {
-    int fd_to, fd_from;
-    char buf[4096];
-    ssize_t nread;
-    int saved_errno;
+    // word at a time multiply/xorshift mix, for change detection only
+    const unsigned char *p = data;
+    uint64_t h = seed ^ (size * 0x9e3779b97f4a7c15ULL);
 
-    fd_from = open(from, O_RDONLY);
-    if (fd_from < 0)
+    for (; size >= 8; size -= 8, p += 8)
+    {
+        uint64_t w;
+        memcpy(&w, p, 8);
+        h = (h ^ w) * 0xff51afd7ed558ccdULL;
+        h ^= h >> 32;
+    }
+
+    uint64_t tail = 0;
+    memcpy(&tail, p, size);
+    h = (h ^ tail) * 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 29;
+
+    return h;
+}
+
+int hash_file(const char *path, uint64_t *hash)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+    {
         return -1;
+    }
 
-    fd_to = open(to, O_WRONLY | O_CREAT | O_EXCL, 0666);
-    if (fd_to < 0)
-        goto out_error;
+    struct stat st;
+    if (fstat(fd, &st) == -1)
+    {
+        close(fd);
+        return -1;
+    }
+
+    if (st.st_size == 0)
+    {
+        close(fd);
+        *hash = hash_bytes(NULL, 0, 0);
+        return 0;
+    }
+
+    void *data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+    {
+        return -1;
+    }
+
+    *hash = hash_bytes(data, (size_t)st.st_size, 0);
+    munmap(data, (size_t)st.st_size);
+    return 0;
+}
 
+static bool file_up_to_date(const char *to, int fd_from, const struct stat *st_from)
+{
+    struct stat st_to;
+    if (stat(to, &st_to) == -1 || !S_ISREG(st_to.st_mode))
+    {
+        return false;
+    }
+
+    // hardlinked on request
+    if (st_to.st_dev == st_from->st_dev && st_to.st_ino == st_from->st_ino)
+    {
+        return true;
+    }
+    if (st_to.st_size != st_from->st_size)
+    {
+        return false;
+    }
+    if (st_to.st_size == 0)
+    {
+        return true;
+    }
+
+    // cp gives its copies the mtime of the source, so the same size and mtime to the nanosecond is the same file,
+    // the same reasoning as the thumbnail key. anything else is decided by the bytes
+    if (st_to.st_mtim.tv_sec == st_from->st_mtim.tv_sec && st_to.st_mtim.tv_nsec == st_from->st_mtim.tv_nsec)
+    {
+        return true;
+    }
+    int fd_to = open(to, O_RDONLY | O_CLOEXEC);
+    if (fd_to == -1)
+    {
+        return false;
+    }
+    size_t size = (size_t)st_to.st_size;
+    void *data_to = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd_to, 0);
+    if (data_to == MAP_FAILED)
+    {
+        close(fd_to);
+        return false;
+    }
+    void *data_from = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd_from, 0);
+    bool equal = data_from != MAP_FAILED && memcmp(data_to, data_from, size) == 0;
+    if (data_from != MAP_FAILED)
+    {
+        munmap(data_from, size);
+    }
+    munmap(data_to, size);
+
+    // take over the mtime so the next check is decided without reading, best effort
+    if (equal)
+    {
+        struct timespec times[2] = {{.tv_nsec = UTIME_OMIT}, st_from->st_mtim};
+        futimens(fd_to, times);
+    }
+    close(fd_to);
+    return equal;
+}
+
+static int copy_data(int fd_to, int fd_from, off_t size, copy_strategy_t strategy)
+{
+    if (strategy != COPY_PLAIN)
+    {
+        // share the extents on copy on write filesystems
+        if (ioctl(fd_to, FICLONE, fd_from) == 0)
+        {
+            return 0;
+        }
+
+        off_t remaining = size;
+        while (remaining > 0)
+        {
+            ssize_t n = copy_file_range(fd_from, NULL, fd_to, NULL, (size_t)remaining, 0);
+            if (n <= 0)
+            {
+                break;
+            }
+            remaining -= n;
+        }
+        if (remaining == 0)
+        {
+            return 0;
+        }
+        if (remaining != size)
+        {
+            // partially copied, let the fallbacks start over
+            if (ftruncate(fd_to, 0) == -1 || lseek(fd_from, 0, SEEK_SET) == -1 || lseek(fd_to, 0, SEEK_SET) == -1)
+            {
+                return -1;
+            }
+        }
+    }
+
+    off_t offset = 0;
+    while (offset < size)
+    {
+        ssize_t n = sendfile(fd_to, fd_from, &offset, (size_t)(size - offset));
+        if (n <= 0)
+        {
+            break;
+        }
+    }
+    if (offset == size)
+    {
+        return 0;
+    }
+    if (lseek(fd_from, offset, SEEK_SET) == -1 || lseek(fd_to, offset, SEEK_SET) == -1)
+    {
+        return -1;
+    }
+
+    char buf[131072];
+    ssize_t nread;
     while (nread = read(fd_from, buf, sizeof buf), nread > 0)
     {
         char *out_ptr = buf;
@@ -531,7 +831,7 @@ int cp(const char *to, const char *from)
 
         do
         {
-            nwritten = write(fd_to, out_ptr, nread);
+            nwritten = write(fd_to, out_ptr, (size_t)nread);
 
             if (nwritten >= 0)
             {
@@ -540,23 +840,76 @@ int cp(const char *to, const char *from)
             }
             else if (errno != EINTR)
             {
-                goto out_error;
+                return -1;
             }
         } while (nread > 0);
     }
 
-    if (nread == 0)
+    return nread == 0 ? 0 : -1;
+}
+
+int cp(const char *to, const char *from, copy_strategy_t strategy)
+{
+    int fd_to = -1, fd_from;
+    int saved_errno;
+    struct stat st;
+
+    fd_from = open(from, O_RDONLY | O_CLOEXEC);
+    if (fd_from < 0)
+        return -1;
+
+    if (fstat(fd_from, &st) == -1)
+        goto out_error;
+
+    if (file_up_to_date(to, fd_from, &st))
+    {
+        close(fd_from);
+        return 1;
+    }
+
+    // build the copy next to the target and rename it into place, never leaving a partial file behind
+    char *tmp = format_string("%s.tmp", to);
+    unlink(tmp);
+
+    if (strategy == COPY_HARDLINK && link(from, tmp) == 0)
     {
-        if (close(fd_to) < 0)
+        if (rename(tmp, to) == 0)
         {
-            fd_to = -1;
-            goto out_error;
+            free(tmp);
+            close(fd_from);
+            return 0;
         }
-        close(fd_from);
+        unlink(tmp);
+    }
 
-        /* Success! */
-        return 0;
+    fd_to = open(tmp, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0666);
+    if (fd_to < 0 || copy_data(fd_to, fd_from, st.st_size, strategy) != 0)
+        goto out_unlink;
+
+    struct timespec times[2] = {{.tv_nsec = UTIME_OMIT}, st.st_mtim};
+    futimens(fd_to, times);
+
+    if (close(fd_to) < 0)
+    {
+        fd_to = -1;
+        goto out_unlink;
+    }
+    if (rename(tmp, to) != 0)
+    {
+        fd_to = -1;
+        goto out_unlink;
     }
+    free(tmp);
+    close(fd_from);
+
+    /* Success! */
+    return 0;
+
+out_unlink:
+    saved_errno = errno;
+    unlink(tmp);
+    free(tmp);
+    errno = saved_errno;
 
 out_error:
     saved_errno = errno;
@@ -568,3 +921,69 @@ out_error:
     errno = saved_errno;
     return -1;
 }
+
+static void running_commands_add(pid_t pid)
+{
+    for (size_t i = 0; i < RUNNING_COMMANDS_MAX; i++)
+    {
+        int expected = 0;
+        if (atomic_compare_exchange_strong(&running_commands[i], &expected, (int)pid))
+        {
+            return;
+        }
+    }
+}
+
+static void running_commands_remove(pid_t pid)
+{
+    for (size_t i = 0; i < RUNNING_COMMANDS_MAX; i++)
+    {
+        int expected = (int)pid;
+        if (atomic_compare_exchange_strong(&running_commands[i], &expected, 0))
+        {
+            return;
+        }
+    }
+}
+
+void commands_cancel(void)
+{
+    // called from signal handlers, only async-signal-safe calls from here on
+    commands_cancelled_flag = 1;
+    for (size_t i = 0; i < RUNNING_COMMANDS_MAX; i++)
+    {
+        int pid = atomic_load(&running_commands[i]);
+        if (pid > 0)
+        {
+            kill(-pid, SIGTERM);
+        }
+    }
+}
+
+bool commands_cancelled(void)
+{
+    return commands_cancelled_flag != 0;
+}
+
+void replace_directory(const char *tmp_path, const char *path)
+{
+    // readers see either the old or the new directory, never a half written one
+    if (renameat2(AT_FDCWD, tmp_path, AT_FDCWD, path, RENAME_EXCHANGE) == 0)
+    {
+        rmrf((char *)tmp_path);
+        return;
+    }
+    if (errno != ENOENT && errno != EINVAL)
+    {
+        die("renameat2 failed for %s:", path);
+    }
+
+    if (errno == EINVAL && check_directory(path) == 0)
+    {
+        rmrf((char *)path);
+    }
+    if (rename(tmp_path, path) != 0)
+    {
+        die("rename failed for %s:", path);
+    }
+}